@@ -0,0 +1,226 @@
+#include "../Gds/gds.h"
+
+#include "Generate.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <wchar.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+/*
+	Benchmark of loading, sizing, extracting and writing synthetic GDSII files
+
+	Usage: Bench [directory [scale]]
+
+	The files are generated in @directory (default the current one). @scale multiplies the number of
+	elements of every layout (default 1).
+ */
+
+// Fractions of the area of the top cell covered by the extraction windows
+static const double window_fractions[] = {0.0001, 0.01, 0.25, 1.0};
+
+static double peak_rss_mb()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+
+	return counters.PeakWorkingSetSize / (1024. * 1024.);
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+#ifdef __APPLE__
+	return usage.ru_maxrss / (1024. * 1024.); // Bytes
+#else
+	return usage.ru_maxrss / 1024.; // Kilobytes
+#endif
+#endif
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void report(const char* layout, const char* phase, double seconds, double count, const char* unit, double nvertices)
+{
+	// Throughput is left out for phases without records, polygons or vertices
+	printf("%-12s %-16s %9.3f s", layout, phase, seconds);
+
+	if (count > 0)
+	{
+		char per_second[16];
+		snprintf(per_second, sizeof(per_second), "%s/s", unit);
+
+		printf(" %12.3g %-10s", count / std::max(seconds, 1e-9), per_second);
+	} else
+	{
+		printf(" %23s", "");
+	}
+
+	if (nvertices > 0)
+		printf(" %12.3g vertices/s", nvertices / std::max(seconds, 1e-9));
+	else
+		printf(" %23s", "");
+
+	printf(" %9.1f MB peak\n", peak_rss_mb());
+}
+
+static int scaled(int n, double scale)
+{
+	return n > 0 ? std::max(1, (int)(n * scale)) : 0;
+}
+
+static void run(const std::wstring& dir, bench_layout layout, double scale)
+{
+	layout.nboundaries = scaled(layout.nboundaries, scale);
+	layout.npaths = scaled(layout.npaths, scale);
+	layout.nsrefs = scaled(layout.nsrefs, scale);
+	layout.aref_cols = scaled(layout.aref_cols, sqrt(scale));
+	layout.aref_rows = scaled(layout.aref_rows, sqrt(scale));
+
+	wchar_t name[64];
+	swprintf(name, 64, L"%hs.gds", layout.name);
+
+	std::wstring file = dir + L"/" + name;
+	std::wstring out = dir + L"/" + L"bench_out.gds";
+
+	// Generate
+	bench_file_stats stats;
+
+	auto start = std::chrono::steady_clock::now();
+
+	if (bench_generate(file.c_str(), &layout, &stats) != 0)
+	{
+		printf("%-12s could not write %ls\n", layout.name, file.c_str());
+		return;
+	}
+
+	report(layout.name, "generate", seconds_since(start), (double)stats.nrecords, "records", (double)stats.nvertices);
+
+	// Load on all hardware threads, with the statistics to time the bounding boxes computed while loading
+	gds_load_options options;
+	options.nthreads = 0;
+	options.stats = true;
+
+	start = std::chrono::steady_clock::now();
+
+	int result = ERR_SUCCESS;
+	gds_db* db = new gds_db(file.c_str(), &result, &options);
+
+	if (result != ERR_SUCCESS)
+	{
+		printf("%-12s error %d loading %ls\n", layout.name, result, file.c_str());
+		delete db;
+		return;
+	}
+
+	report(layout.name, "load", seconds_since(start), (double)stats.nrecords, "records", (double)stats.nvertices);
+
+	// Cell sizes, part of the load
+	report(layout.name, "cell sizes", db->stats.bbox_seconds, 0, NULL, 0);
+
+	// Extract square windows in the middle of the top cell
+	gds_cell* top = find_cell(db, "TOP");
+	gds_bbox box = top->bbox;
+
+	gds_polyset* pset = new gds_polyset;
+
+	for (double fraction : window_fractions)
+	{
+		double f = sqrt(fraction);
+		int64_t cx = (box.xmin + box.xmax) / 2;
+		int64_t cy = (box.ymin + box.ymax) / 2;
+		int64_t hw = (int64_t)(f * (box.xmax - box.xmin) / 2);
+		int64_t hh = (int64_t)(f * (box.ymax - box.ymin) / 2);
+
+		gds_bbox target = {cx - hw, cy - hh, cx + hw, cy + hh};
+
+		gds_polyset_clear(pset);
+
+		int64_t nskipped = 0;
+
+		start = std::chrono::steady_clock::now();
+		gds_extract(db, "TOP", target, 0, pset, &nskipped);
+		double seconds = seconds_since(start);
+
+		char phase[32];
+		snprintf(phase, sizeof(phase), "extract %g%%", 100 * fraction);
+
+		report(layout.name, phase, seconds, (double)pset->size(), "polygons", (double)pset->nvertices);
+	}
+
+	// Write the polygons of the last (complete) window
+	start = std::chrono::steady_clock::now();
+	result = gds_write(out.c_str(), pset, db->dbunit_in_uu, db->dbunit_in_meter);
+
+	if (result != EXIT_SUCCESS)
+		printf("%-12s error %d writing %ls\n", layout.name, result, out.c_str());
+	else
+		report(layout.name, "write", seconds_since(start), (double)pset->size(), "polygons", (double)pset->nvertices);
+
+	// Merge the polygons of the last window by layer, reporting the merged polygons
+	gds_polyset* merged = new gds_polyset;
+
+	start = std::chrono::steady_clock::now();
+	result = gds_merge(pset, merged);
+
+	if (result != ERR_SUCCESS)
+		printf("%-12s error %d merging\n", layout.name, result);
+	else
+		report(layout.name, "merge", seconds_since(start), (double)merged->size(), "polygons", (double)merged->nvertices);
+
+	gds_polyset_clear(merged);
+	delete merged;
+
+	gds_polyset_clear(pset);
+	delete pset;
+
+	delete db;
+}
+
+int main(int argc, char** argv)
+{
+	std::wstring dir = L".";
+	double scale = 1;
+
+	if (argc > 1)
+	{
+		wchar_t path[1024];
+		mbstowcs(path, argv[1], 1024);
+		dir = path;
+	}
+
+	if (argc > 2)
+		scale = atof(argv[2]);
+
+	//                  name           bounds verts  paths depth cols  rows  srefs  transformed
+	bench_layout layouts[] = {
+		{"flat",        1000000,   4,     0,    0,    0,    0,    0,     false},
+		{"polygons",    100000,    32,    0,    0,    0,    0,    0,     false},
+		{"paths",       0,         4,     200000, 0,  0,    0,    0,     false},
+		{"deep",        200,       4,     0,    14,   0,    0,    0,     false},
+		{"aref",        4,         4,     0,    0,    1000, 1000, 0,     false},
+		{"transformed", 50,        4,     10,   0,    0,    0,    20000, true},
+	};
+
+	printf("%-12s %-16s %11s %23s %23s %15s\n", "layout", "phase", "time", "throughput", "", "memory");
+
+	for (const bench_layout& layout : layouts)
+		run(dir, layout, scale);
+
+	return 0;
+}
@@ -0,0 +1,351 @@
+#define _USE_MATH_DEFINES
+
+#include "Generate.h"
+
+#include "../Gds/File.h"
+#include "../Gds/Records.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <random>
+#include <vector>
+
+// Records are collected in a buffer and written in blocks of this size
+#define GENERATE_BUFFER_SIZE (4 << 20)
+
+typedef struct Generator
+{
+	FILE* file;
+	std::vector<uint8_t> buf;
+	bench_file_stats* stats;
+	bool failed;
+
+	std::mt19937 rng;
+} Generator;
+
+static void flush(Generator* g)
+{
+	if (!g->buf.empty() && fwrite(g->buf.data(), 1, g->buf.size(), g->file) != g->buf.size())
+		g->failed = true;
+
+	g->stats->nbytes += g->buf.size();
+
+	g->buf.clear();
+}
+
+static void put_short(Generator* g, int value)
+{
+	g->buf.push_back((value >> 8) & 0xFF);
+	g->buf.push_back(value & 0xFF);
+}
+
+static void put_int(Generator* g, int32_t value)
+{
+	g->buf.push_back((value >> 24) & 0xFF);
+	g->buf.push_back((value >> 16) & 0xFF);
+	g->buf.push_back((value >> 8) & 0xFF);
+	g->buf.push_back(value & 0xFF);
+}
+
+static void put_real(Generator* g, double value)
+{
+	// GDSII real: sign bit, 7 bit exponent of 16 (excess 64) and a 56 bit mantissa below 1
+
+	uint64_t bits = 0;
+
+	if (value != 0)
+	{
+		uint64_t sign = value < 0 ? 1 : 0;
+		value = fabs(value);
+
+		int exponent = 0;
+		while (value >= 1) { value /= 16; exponent++; }
+		while (value < 1. / 16) { value *= 16; exponent--; }
+
+		uint64_t mantissa = (uint64_t)(value * 72057594037927936.0); // 2^56
+		bits = sign << 63 | (uint64_t)(exponent + 64) << 56 | mantissa;
+	}
+
+	for (int i = 7; i >= 0; i--)
+		g->buf.push_back((bits >> (8 * i)) & 0xFF);
+}
+
+static void begin_record(Generator* g, uint16_t record, int payload)
+{
+	if (g->buf.size() > GENERATE_BUFFER_SIZE)
+		flush(g);
+
+	put_short(g, payload + 4);
+	put_short(g, record);
+
+	g->stats->nrecords++;
+}
+
+static void record(Generator* g, uint16_t record)
+{
+	begin_record(g, record, 0);
+}
+
+static void short_record(Generator* g, uint16_t record, int value)
+{
+	begin_record(g, record, 2);
+	put_short(g, value);
+}
+
+static void real_record(Generator* g, uint16_t record, double value)
+{
+	begin_record(g, record, 8);
+	put_real(g, value);
+}
+
+static void string_record(Generator* g, uint16_t record, const char* s)
+{
+	int n = (int)strlen(s);
+
+	begin_record(g, record, n + n % 2);
+	g->buf.insert(g->buf.end(), s, s + n);
+
+	if (n % 2)
+		g->buf.push_back(0);
+}
+
+static void xy_record(Generator* g, const int32_t* xy, int npairs)
+{
+	begin_record(g, XY, 8 * npairs);
+
+	for (int i = 0; i < 2 * npairs; i++)
+		put_int(g, xy[i]);
+}
+
+static void begin_structure(Generator* g, const char* name)
+{
+	begin_record(g, BGNSTR, 24);
+	g->buf.insert(g->buf.end(), 24, 0);
+
+	string_record(g, STRNAME, name);
+}
+
+static int random_int(Generator* g, int lo, int hi)
+{
+	return std::uniform_int_distribution<int>(lo, hi)(g->rng);
+}
+
+static void boundary(Generator* g, int nvertices)
+{
+	std::vector<int32_t> xy;
+
+	int32_t x = random_int(g, 0, BENCH_LEAF_SIZE);
+	int32_t y = random_int(g, 0, BENCH_LEAF_SIZE);
+
+	if (nvertices <= 4)
+	{
+		int32_t w = random_int(g, 50, 2000);
+		int32_t h = random_int(g, 50, 2000);
+
+		xy = {x, y, x + w, y, x + w, y + h, x, y + h};
+	} else
+	{
+		// Convex polygon with its vertices on a circle
+		double r = random_int(g, 100, 2000);
+
+		for (int i = 0; i < nvertices; i++)
+		{
+			double a = 2 * M_PI * i / nvertices;
+			xy.push_back(x + (int32_t)(r * cos(a)));
+			xy.push_back(y + (int32_t)(r * sin(a)));
+		}
+	}
+
+	// Closed polygon
+	xy.push_back(xy[0]);
+	xy.push_back(xy[1]);
+
+	record(g, BOUNDARY);
+	short_record(g, LAYER, random_int(g, 0, 63));
+	short_record(g, DATATYPE, random_int(g, 0, 3));
+	xy_record(g, xy.data(), (int)xy.size() / 2);
+	record(g, ENDEL);
+
+	g->stats->nvertices += xy.size() / 2;
+}
+
+static void path(Generator* g)
+{
+	int32_t x = random_int(g, 0, BENCH_LEAF_SIZE);
+	int32_t y = random_int(g, 0, BENCH_LEAF_SIZE);
+	int32_t dx = random_int(g, 200, 5000);
+	int32_t dy = random_int(g, 200, 5000);
+
+	int32_t xy[6] = {x, y, x + dx, y, x + dx, y + dy};
+
+	record(g, PATH);
+	short_record(g, LAYER, random_int(g, 0, 63));
+	short_record(g, DATATYPE, random_int(g, 0, 3));
+	short_record(g, PATHTYPE, random_int(g, 0, 1) * 2);
+
+	begin_record(g, WIDTH, 4);
+	put_int(g, random_int(g, 20, 200));
+
+	xy_record(g, xy, 3);
+	record(g, ENDEL);
+
+	g->stats->nvertices += 3;
+}
+
+static void sref(Generator* g, const char* name, int32_t x, int32_t y, bool mirror, double mag, double angle)
+{
+	record(g, SREF);
+	string_record(g, SNAME, name);
+
+	if (mirror || mag != 1 || angle != 0)
+	{
+		short_record(g, STRANS, mirror ? 0x8000 : 0);
+
+		if (mag != 1)
+			real_record(g, MAG, mag);
+
+		if (angle != 0)
+			real_record(g, ANGLE, angle);
+	}
+
+	int32_t xy[2] = {x, y};
+	xy_record(g, xy, 1);
+	record(g, ENDEL);
+}
+
+static void aref(Generator* g, const char* name, int ncols, int nrows, int32_t pitch)
+{
+	int32_t xy[6] = {0, 0, ncols * pitch, 0, 0, nrows * pitch};
+
+	record(g, AREF);
+	string_record(g, SNAME, name);
+
+	begin_record(g, COLROW, 4);
+	put_short(g, ncols);
+	put_short(g, nrows);
+
+	xy_record(g, xy, 3);
+	record(g, ENDEL);
+}
+
+static void leaf_elements(Generator* g, const bench_layout* layout)
+{
+	for (int i = 0; i < layout->nboundaries; i++)
+		boundary(g, layout->nvertices);
+
+	for (int i = 0; i < layout->npaths; i++)
+		path(g);
+}
+
+int bench_generate(const wchar_t* file, const bench_layout* layout, bench_file_stats* stats)
+{
+	Generator g;
+	g.file = gds_fopen(file, L"wb");
+	g.stats = stats;
+	g.failed = false;
+	g.rng.seed(1);
+
+	if (g.file == NULL)
+		return -1;
+
+	*stats = {0, 0, 0};
+
+	short_record(&g, HEADER, 600);
+
+	begin_record(&g, BGNLIB, 24);
+	g.buf.insert(g.buf.end(), 24, 0);
+
+	string_record(&g, LIBNAME, layout->name);
+
+	begin_record(&g, UNITS, 16);
+	put_real(&g, 0.001);
+	put_real(&g, 1e-9);
+
+	bool flat = layout->depth == 0 && layout->aref_cols == 0 && layout->nsrefs == 0;
+
+	if (flat)
+	{
+		begin_structure(&g, "TOP");
+		leaf_elements(&g, layout);
+		record(&g, ENDSTR);
+	} else
+	{
+		begin_structure(&g, "LEAF");
+		leaf_elements(&g, layout);
+		record(&g, ENDSTR);
+
+		// Each level places two copies of the level below next to each other, alternating between
+		// the x and y direction so the levels stay square
+		char below[16] = "LEAF";
+		int32_t w = BENCH_LEAF_SIZE + BENCH_LEAF_SIZE / 10;
+		int32_t h = w;
+
+		for (int level = 1; level <= layout->depth; level++)
+		{
+			char name[16];
+			snprintf(name, sizeof(name), "L%d", level);
+
+			begin_structure(&g, name);
+			sref(&g, below, 0, 0, false, 1, 0);
+
+			if (level % 2)
+			{
+				sref(&g, below, w, 0, false, 1, 0);
+				w *= 2;
+			} else
+			{
+				sref(&g, below, 0, h, false, 1, 0);
+				h *= 2;
+			}
+
+			record(&g, ENDSTR);
+
+			strcpy(below, name);
+		}
+
+		begin_structure(&g, "TOP");
+
+		if (layout->depth > 0)
+			sref(&g, below, 0, 0, false, 1, 0);
+
+		if (layout->aref_cols > 0)
+			aref(&g, "LEAF", layout->aref_cols, layout->aref_rows, BENCH_LEAF_SIZE + BENCH_LEAF_SIZE / 10);
+
+		// The single SREFs are spread over a square with about one leaf per leaf area
+		int side = (int)ceil(sqrt((double)layout->nsrefs));
+
+		for (int i = 0; i < layout->nsrefs; i++)
+		{
+			int32_t x = random_int(&g, 0, side) * BENCH_LEAF_SIZE;
+			int32_t y = random_int(&g, 0, side) * BENCH_LEAF_SIZE;
+
+			bool mirror = false;
+			double mag = 1, angle = 0;
+
+			if (layout->transformed)
+			{
+				static const double angles[] = {0, 90, 180, 270, 30, 45};
+				static const double mags[] = {1, 1, 0.5, 2};
+
+				mirror = random_int(&g, 0, 1) != 0;
+				angle = angles[random_int(&g, 0, 5)];
+				mag = mags[random_int(&g, 0, 3)];
+			}
+
+			sref(&g, "LEAF", x, y, mirror, mag, angle);
+		}
+
+		record(&g, ENDSTR);
+	}
+
+	record(&g, ENDLIB);
+
+	flush(&g);
+
+	if (fclose(g.file) != 0 || g.failed)
+		return -1;
+
+	return 0;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+	Shape of a synthetic GDSII library. The elements go in a leaf cell "LEAF" which is placed under
+	the top cell "TOP" by a chain of SREF levels, an AREF and single SREFs. A layout without any
+	references has its elements directly in "TOP".
+ */
+struct bench_layout
+{
+	const char* name;
+
+	int nboundaries; // Boundaries in the leaf cell
+	int nvertices; // Vertices of each boundary (4 gives rectangles)
+	int npaths; // Paths in the leaf cell
+
+	int depth; // Levels of cells between the top and the leaf, each placing the level below twice
+	int aref_cols, aref_rows; // AREF of the leaf in the top cell (0 for none)
+	int nsrefs; // SREFs of the leaf in the top cell at random positions
+
+	bool transformed; // Rotate, mirror and magnify the SREFs of the top cell
+};
+
+// What went into a generated file
+struct bench_file_stats
+{
+	int64_t nrecords;
+	int64_t nvertices; // Vertices in XY records of boundaries and paths
+	int64_t nbytes;
+};
+
+// Side of the square the elements of the leaf cell are spread over, in database units
+#define BENCH_LEAF_SIZE 100000
+
+/*
+	Write a GDSII file with the shape of @layout. The same layout always gives the same file.
+
+	@return: 0 on success, -1 if the file could not be written
+ */
+int bench_generate(const wchar_t* file, const bench_layout* layout, bench_file_stats* stats);
@@ -0,0 +1,70 @@
+#include "Arena.h"
+
+#include <stdlib.h>
+
+// Blocks grow with the arena from the first to the maximum size so small cells stay small
+#define ARENA_FIRST_BLOCK 512
+#define ARENA_MAX_BLOCK (1 << 20)
+
+gds_arena::gds_arena()
+{
+	next = NULL;
+	left = 0;
+	allocated = 0;
+}
+
+gds_arena::~gds_arena()
+{
+	for (void* block : blocks)
+		free(block);
+}
+
+void* arena_alloc(gds_arena* self, size_t size)
+{
+	// Keep every allocation 8 byte aligned
+	size = (size + 7) & ~(size_t)7;
+
+	if (size > self->left)
+	{
+		size_t block_size = self->allocated;
+
+		if (block_size < ARENA_FIRST_BLOCK)
+			block_size = ARENA_FIRST_BLOCK;
+
+		if (block_size > ARENA_MAX_BLOCK)
+			block_size = ARENA_MAX_BLOCK;
+
+		if (block_size < size)
+			block_size = size;
+
+		// calloc gives zeroed memory and bumped memory is never reused
+		uint8_t* block = (uint8_t*)calloc(1, block_size);
+		if (block == NULL)
+			return NULL;
+
+		self->blocks.push_back(block);
+		self->allocated += block_size;
+
+		self->next = block;
+		self->left = block_size;
+	}
+
+	void* p = self->next;
+
+	self->next += size;
+	self->left -= size;
+
+	return p;
+}
+
+void arena_take(gds_arena* self, gds_arena* other)
+{
+	// Taken blocks go in front so the current block of @self stays the last one
+	self->blocks.insert(self->blocks.begin(), other->blocks.begin(), other->blocks.end());
+	self->allocated += other->allocated;
+
+	other->blocks.clear();
+	other->next = NULL;
+	other->left = 0;
+	other->allocated = 0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+/*
+	Bump allocator for the elements and coordinate arrays of a cell. Memory is handed out from a
+	few large blocks and only released all at once when the arena is destructed.
+ */
+struct gds_arena
+{
+public:
+	gds_arena();
+	~gds_arena();
+
+	std::vector<void*> blocks; // All blocks allocated so far (the last one is being filled)
+
+	uint8_t* next; // Next free byte in the current block
+	size_t left; // Free bytes left in the current block
+
+	size_t allocated; // Total bytes in all blocks
+};
+
+/*
+	Return @size bytes of zero initialized memory aligned to 8 bytes, or NULL when out of memory
+ */
+void* arena_alloc(gds_arena* self, size_t size);
+
+/*
+	Move all blocks of @other to @self, which frees them from then on. Memory handed out by @other
+	stays valid and @other is empty afterwards.
+ */
+void arena_take(gds_arena* self, gds_arena* other);
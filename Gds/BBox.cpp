@@ -1,4 +1,5 @@
 #include "BBox.h"
+#include "Simd.h"
 
 inline static
 int64_t min(int64_t const x, int64_t const y)
@@ -35,9 +36,7 @@ void bbox_fit_points(gds_bbox* self, const gds_pair* pairs, int npairs)
 {
 	// Adjust the size of a bounding box to fit a array of pairs
 
-	for (int i = 0; i < npairs; ++i) {
-		bbox_fit_point(self, pairs[i]);
-	}
+	simd_kernels()->fit_points(self, pairs, npairs);
 }
 
 void bbox_fit_bbox(gds_bbox* self, const gds_bbox* other)
@@ -62,20 +61,23 @@ gds_bbox bbox_transform(const gds_bbox* in, const gds_transform* transform, bool
 {
 	// Return a transformed bounding box
 
+	gds_bbox out;
+	bbox_init(&out);
+
 	gds_pair pairs[4];
 	gds_pair tpairs[4];
 
+	// Rotations over multiples of 90 degrees map opposite corners onto opposite corners
+	int ncorners = transform->quarters >= 0 ? 2 : 4;
+
 	pairs[0] = {in->xmin, in->ymin};
-	pairs[1] = {in->xmin, in->ymax};
-	pairs[2] = {in->xmax, in->ymax};
+	pairs[1] = {in->xmax, in->ymax};
+	pairs[2] = {in->xmin, in->ymax};
 	pairs[3] = {in->xmax, in->ymin};
 
-	transform_pairs(tpairs, pairs, 4, transform, inv);
-
-	gds_bbox out;
-	bbox_init(&out);
+	transform_pairs(tpairs, pairs, ncorners, transform, inv);
 
-	bbox_fit_points(&out, tpairs, 4);
+	bbox_fit_points(&out, tpairs, ncorners);
 
 	return out;
 }
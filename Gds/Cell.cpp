@@ -1,6 +1,7 @@
 #include "Cell.h"
 
 #include "BBox.h"
+#include "Index.h"
 
 #include <limits.h>
 #include <stdlib.h>
@@ -10,39 +11,47 @@ gds_cell::gds_cell()
 	name[0] = 0;
 
 	bbox_init(&bbox);
+	layer_mask_clear(&layers);
 
 	initialized = false;
 
-	srefs = new std::vector<gds_sref*>;
-	arefs = new std::vector<gds_aref*>;
-	boundaries = new std::vector<gds_boundary*>;
-	paths = new std::vector<gds_path*>;
+	loaded = true;
+	toc = NULL;
 
+	compact = NULL;
+
+	index = NULL;
 }
 
 gds_cell::~gds_cell()
 {
-	for (gds_sref* sref : *srefs) {
-		free(sref);
-	}
-	delete srefs;
+	// The elements and their coordinates are released together with the arena
+	delete toc;
+	delete compact;
+	delete index;
+}
 
-	for (gds_aref* aref : *arefs) {
-		free(aref);
+void cell_boundary(const gds_cell* cell, int i, gds_boundary* view, std::vector<gds_pair>* scratch)
+{
+	if (cell->compact == NULL)
+	{
+		*view = *cell->boundaries[i];
+		return;
 	}
-	delete arefs;
 
-	for (gds_boundary* elem : *boundaries) {
-		free(elem->pairs);
-		free(elem);
-	}
-	delete boundaries;
+	const gds_compact_boundaries* c = cell->compact;
 
-	for (gds_path* elem : *paths) {
-		//gds_path* elem = (gds_path*) cell->paths[j];
-		free(elem->pairs);
-		free(elem->epairs);
-		free(elem);
-	}
-	delete paths;
+	uint32_t count = c->count[i];
+	const int32_t* p = &c->coords[2 * (size_t)c->offset[i]];
+
+	scratch->resize(count);
+
+	for (uint32_t n = 0; n < count; n++)
+		(*scratch)[n] = {p[2 * n], p[2 * n + 1]};
+
+	view->layer = c->layer[i];
+	view->datatype = c->datatype[i];
+	view->pairs = scratch->data();
+	view->npairs = (int)count;
+	view->bbox = cell_boundary_bbox(cell, i);
 }
@@ -1,17 +1,20 @@
 #pragma once
 
+#include "Arena.h"
 #include "BBox.h"
+#include "Layers.h"
 #include "Pair.h"
 
 #include "stdint.h"
 
+#include <string>
 #include <vector>
 
 #define GDS_MAX_CELL_NAME 32
 
 struct gds_boundary
 {
-	uint16_t layer;
+	uint16_t layer, datatype;
 	gds_pair* pairs;
 	int npairs;
 	gds_bbox bbox;
@@ -19,7 +22,7 @@ struct gds_boundary
 
 struct gds_path
 {
-	uint16_t layer, pathtype;
+	uint16_t layer, datatype, pathtype;
 	uint32_t width;
 
 	gds_pair* pairs;
@@ -32,9 +35,41 @@ struct gds_path
 	gds_bbox bbox;
 };
 
+// Bounding box with the 32 bit coordinates of the GDSII stream
+struct gds_bbox32
+{
+	int32_t xmin, ymin, xmax, ymax;
+};
+
+/*
+	Compact structure-of-arrays storage of the boundaries of a cell. The vertices of all boundaries
+	share one pool of 32 bit coordinates and the layers and bounding boxes are kept in parallel
+	arrays so they can be scanned without touching the vertices.
+ */
+struct gds_compact_boundaries
+{
+	std::vector<int32_t> coords; // x, y of all vertices of all boundaries
+	std::vector<uint32_t> offset; // Index of the first vertex of each boundary in @coords (in pairs)
+	std::vector<uint32_t> count; // Number of vertices of each boundary
+
+	std::vector<uint16_t> layer;
+	std::vector<uint16_t> datatype;
+	std::vector<gds_bbox32> bbox;
+};
+
 // Forward declaration type gds_cell because of circular dependency
 struct gds_cell;
 
+// Spatial index of the elements of a cell (defined in Index.h)
+struct gds_index;
+
+// Table of contents entry of a structure, recorded by the lazy loader on its first pass
+struct gds_toc_entry
+{
+	uint64_t offset, length; // Byte range of the structure in the file
+	std::vector<std::string> snames; // Names of the referenced structures (each name once)
+};
+
 struct gds_sref
 {
 	uint16_t strans;
@@ -62,11 +97,60 @@ public:
 
 	char name[GDS_MAX_CELL_NAME + 1];
 
-	std::vector<gds_boundary*> *boundaries;
-	std::vector<gds_path*> *paths;
-	std::vector<gds_sref*> *srefs;
-	std::vector<gds_aref*> *arefs;
+	std::vector<gds_boundary*> boundaries;
+	std::vector<gds_path*> paths;
+	std::vector<gds_sref*> srefs;
+	std::vector<gds_aref*> arefs;
+
+	// Owns all elements and coordinate arrays of the cell
+	gds_arena arena;
+
+	// Boundaries in the compact layout (loaded with gds_load_options::compact). The boundaries list
+	// is empty then; use the cell_boundary functions to access the boundaries in either layout.
+	gds_compact_boundaries* compact;
 
 	gds_bbox bbox; // Is recursively calculated after loading the database
-	bool initialized; // Is set true when member @bbox is initialized
-};
\ No newline at end of file
+	bool initialized; // Is set true when member @bbox (and @index and @layers) is initialized
+
+	gds_layer_mask layers; // Layers of the elements of the cell and of all cells below it
+
+	bool loaded; // Is false while the elements of a lazily loaded cell are not parsed yet
+	gds_toc_entry* toc; // Location and references of the structure in a lazily loaded database
+
+	gds_index* index; // Spatial index of the elements, NULL for cells with only a few elements
+};
+
+// Number of boundaries of @cell
+inline int cell_boundary_count(const gds_cell* cell)
+{
+	return cell->compact ? (int)cell->compact->count.size() : (int)cell->boundaries.size();
+}
+
+// Datatype of boundary @i of @cell
+inline uint16_t cell_boundary_datatype(const gds_cell* cell, int i)
+{
+	return cell->compact ? cell->compact->datatype[i] : cell->boundaries[i]->datatype;
+}
+
+// Bounding box of boundary @i of @cell
+inline gds_bbox cell_boundary_bbox(const gds_cell* cell, int i)
+{
+	if (cell->compact == NULL)
+		return cell->boundaries[i]->bbox;
+
+	const gds_bbox32& b = cell->compact->bbox[i];
+
+	return {b.xmin, b.ymin, b.xmax, b.ymax};
+}
+
+// Layer of boundary @i of @cell
+inline uint16_t cell_boundary_layer(const gds_cell* cell, int i)
+{
+	return cell->compact ? cell->compact->layer[i] : cell->boundaries[i]->layer;
+}
+
+/*
+	Fill @view with boundary @i of @cell. The vertices of a compact cell are widened into @scratch,
+	which has to be kept alive (and unchanged) while the view is used.
+ */
+void cell_boundary(const gds_cell* cell, int i, gds_boundary* view, std::vector<gds_pair>* scratch);
\ No newline at end of file
@@ -1,112 +1,264 @@
 #include "Gds.h"
+#include "Index.h"
+#include "Parallel.h"
+#include "Reference.h"
 
 #include <inttypes.h>
 #include <stdio.h>
 
-static gds_bbox
-cell_sizes_recurse(gds_cell* cell, gds_transform transform, unsigned int level)
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+static void
+build_index(gds_cell* cell)
 {
-	if (cell->initialized)
-		return bbox_transform(&cell->bbox, &transform, false);
+	// Index the local bounding boxes of all elements of a cell with enough elements to benefit.
+	// References are indexed with the bounding box of the referenced cell (all instances for an AREF).
+
+	int nboundaries = cell_boundary_count(cell);
+
+	size_t nelements = nboundaries + cell->paths.size() + cell->srefs.size() + cell->arefs.size();
+	if (nelements < INDEX_MIN_ELEMENTS)
+		return;
+
+	// A hit can not hold the position of an element of such a cell, it is scanned linearly
+	if ((size_t)nboundaries >= INDEX_MAX_ELEMENTS || cell->paths.size() >= INDEX_MAX_ELEMENTS ||
+		cell->srefs.size() >= INDEX_MAX_ELEMENTS || cell->arefs.size() >= INDEX_MAX_ELEMENTS)
+		return;
+
+	gds_index* index = new gds_index;
+	index->entries.reserve(nelements);
+
+	for (int i = 0; i < nboundaries; i++) {
+		gds_bbox box = cell_boundary_bbox(cell, i);
+		index_add(index, &box, INDEX_BOUNDARY, i);
+	}
+
+	for (size_t i = 0; i < cell->paths.size(); i++) {
+		index_add(index, &cell->paths[i]->bbox, INDEX_PATH, (uint32_t)i);
+	}
+
+	for (size_t i = 0; i < cell->srefs.size(); i++) {
+		gds_sref* sref = cell->srefs[i];
+
+		gds_transform t = reference_transform(sref->origin, sref->mag, sref->angle, sref->strans);
+		gds_bbox box = bbox_transform(&sref->cell->bbox, &t, false);
+
+		index_add(index, &box, INDEX_SREF, (uint32_t)i);
+	}
 
-	// We start with an empty bounding box at the origin and start filling it recursively with all
-	// boundary elements, paths, and reference cells
+	for (size_t i = 0; i < cell->arefs.size(); i++) {
+		gds_bbox box = aref_extent(cell->arefs[i]);
+		index_add(index, &box, INDEX_AREF, (uint32_t)i);
+	}
+
+	index_build(index);
+
+	cell->index = index;
+}
+
+static void
+cell_bbox(gds_cell* cell)
+{
+	// Bounding box of a cell in its own coordinates from its elements and the bounding boxes of the
+	// cells it references, which need to be known already. We start with an empty bounding box at
+	// the origin.
 
 	gds_bbox bbox_cell;
 	bbox_init(&bbox_cell);
 	bbox_fit_point(&bbox_cell, {0, 0});
 
-	for (gds_boundary* b : *cell->boundaries) {
-		bbox_fit_bbox(&bbox_cell, &b->bbox);
+	int nboundaries = cell_boundary_count(cell);
+	for (int i = 0; i < nboundaries; i++) {
+		gds_bbox b_bbox = cell_boundary_bbox(cell, i);
+		bbox_fit_bbox(&bbox_cell, &b_bbox);
 	}
 
-	for (gds_path* p : *cell->paths) {
+	for (gds_path* p : cell->paths) {
 		bbox_fit_bbox(&bbox_cell, &p->bbox);
 	}
 
-	// Transform the resulting bounding box with the accumulated transformation
-	bbox_transform(&bbox_cell, &transform, false);
+	// Each reference is transformed once
+	for (gds_sref* sref : cell->srefs) {
+		gds_transform t = reference_transform(sref->origin, sref->mag, sref->angle, sref->strans);
+
+		gds_bbox tmp = bbox_transform(&sref->cell->bbox, &t, false);
+		bbox_fit_bbox(&bbox_cell, &tmp);
+	}
+
+	for (gds_aref* aref : cell->arefs) {
+		gds_bbox tmp = aref_extent(aref);
+		bbox_fit_bbox(&bbox_cell, &tmp);
+	}
+
+	cell->bbox = bbox_cell;
+}
+
+static void
+cell_layers(gds_cell* cell)
+{
+	// Layers in the subtree of a cell from its own elements and the layers of the cells it
+	// references, which need to be known already
+
+	gds_layer_mask mask;
+	layer_mask_clear(&mask);
+
+	int nboundaries = cell_boundary_count(cell);
+	for (int i = 0; i < nboundaries; i++) {
+		layer_mask_add(&mask, cell_boundary_layer(cell, i));
+	}
+
+	for (gds_path* p : cell->paths) {
+		layer_mask_add(&mask, p->layer);
+	}
+
+	for (gds_sref* sref : cell->srefs) {
+		layer_mask_merge(&mask, &sref->cell->layers);
+	}
+
+	for (gds_aref* aref : cell->arefs) {
+		layer_mask_merge(&mask, &aref->cell->layers);
+	}
+
+	cell->layers = mask;
+}
+
+// Height of a cell that references a cell missing from the database, directly or below. It is
+// not sized and stays without a bounding box.
+#define CELL_UNRESOLVED -2
+
+static int
+cell_height(gds_cell* cell, std::unordered_map<gds_cell*, int>* heights, std::vector<std::vector<gds_cell*>>* levels)
+{
+	// Sort the cells below @cell without a bounding box into @levels by their height above the
+	// leaves, so each level only references cells of the levels before it
+
+	if (cell->initialized)
+		return -1;
+
+	auto it = heights->find(cell);
+	if (it != heights->end())
+		return it->second;
 
-	// Update the bounding box to fit all gds_sref elements
-	for (gds_sref* sref : *cell->srefs) {
+	// Entered before recursing so a (malformed) circular reference ends here
+	(*heights)[cell] = 0;
 
-		gds_transform acc;
-		acc.translation = transform_pair(sref->origin, &transform, false);
-		acc.magnification = transform.magnification * sref->mag;
-		acc.angle = transform.angle + sref->angle;
-		acc.mirror = transform.mirror ^ (sref->strans & 0x8000);
+	int height = 0;
+	bool unresolved = false;
 
-		// Recurse into the reference cell
-		gds_bbox tmp = cell_sizes_recurse(sref->cell, acc, level + 1);
+	for (gds_sref* sref : cell->srefs) {
+		int h = sref->cell != NULL ? cell_height(sref->cell, heights, levels) : CELL_UNRESOLVED;
 
-		bbox_fit_bbox(&bbox_cell, &tmp); // adjust the bounding box
+		unresolved |= h == CELL_UNRESOLVED;
+		height = std::max(height, h + 1);
 	}
 
-	for (gds_aref* aref : *cell->arefs) {
+	for (gds_aref* aref : cell->arefs) {
+		int h = aref->cell != NULL ? cell_height(aref->cell, heights, levels) : CELL_UNRESOLVED;
 
-		double v_col_x, v_col_y, v_row_x, v_row_y;
+		unresolved |= h == CELL_UNRESOLVED;
+		height = std::max(height, h + 1);
+	}
 
-		int64_t x1 = aref->vectors[0].x;
-		int64_t y1 = aref->vectors[0].y;
-		int64_t x2 = aref->vectors[1].x;
-		int64_t y2 = aref->vectors[1].y;
-		int64_t x3 = aref->vectors[2].x;
-		int64_t y3 = aref->vectors[2].y;
+	if (unresolved) {
+		(*heights)[cell] = CELL_UNRESOLVED;
+		return CELL_UNRESOLVED;
+	}
 
-		// (v_col_x, v_col_y) vector pair column direction
-		v_col_x = ((double)(x2 - x1)) / aref->ncols;
-		v_col_y = ((double)(y2 - y1)) / aref->ncols;
+	(*heights)[cell] = height;
 
-		// (v_row_x, v_row_y) vector pair row direction
-		v_row_x = ((double)(x3 - x1)) / aref->nrows;
-		v_row_y = ((double)(y3 - y1)) / aref->nrows;
+	if ((int)levels->size() <= height)
+		levels->resize(height + 1);
 
-		// Loop through the array and recurse each
-		for (int c = 0; c < aref->ncols; c++) {
-			for (int r = 0; r < aref->nrows; r++) {
-				// Position of the sub structure cell being referenced
+	(*levels)[height].push_back(cell);
 
-				int64_t x_ref = (int64_t)(x1 + c * v_col_x + r * v_row_x);
-				int64_t y_ref = (int64_t)(y1 + c * v_col_y + r * v_row_y);
+	return height;
+}
 
-				gds_transform acc;
-				acc.translation = transform_pair({x_ref, y_ref}, &transform, false);
-				acc.magnification = transform.magnification * aref->mag;
-				acc.angle = transform.angle + aref->angle;
-				acc.mirror = transform.mirror ^ (aref->strans & 0x8000);
+static void
+size_cells(gds_cell* const* cells, size_t ncells, int nthreads)
+{
+	// Determine the bounding boxes and layers of @cells and all cells below them bottom-up, one
+	// level at a time. The cells of a level only depend on lower levels so they are done in
+	// parallel, and their indices are built right away.
 
-				// Recurse into the reference cell
-				gds_bbox tmp = cell_sizes_recurse(aref->cell, acc, level + 1);
+	std::unordered_map<gds_cell*, int> heights;
+	std::vector<std::vector<gds_cell*>> levels;
 
-				bbox_fit_bbox(&bbox_cell, &tmp); // adjust the bounding box
-			}
-		}
+	for (size_t i = 0; i < ncells; i++)
+		cell_height(cells[i], &heights, &levels);
+
+	for (std::vector<gds_cell*>& level : levels) {
+		parallel_for((int)level.size(), nthreads, [&](int i) {
+			gds_cell* cell = level[i];
+
+			cell_bbox(cell);
+			cell_layers(cell);
+			build_index(cell);
+
+			cell->initialized = true;
+		});
 	}
+}
 
-	// Find and store the bounding box of the structure without transformation (by doing the inverse) 
-	cell->bbox = bbox_transform(&bbox_cell, &transform, true);
-	cell->initialized = true;
+int gds_prepare_cell(gds_db* db, gds_cell* cell)
+{
+	std::lock_guard<std::mutex> lock(db->load_mutex);
+
+	if (cell->initialized)
+		return ERR_SUCCESS;
+
+	int result = gds_load_subtree(db, cell);
+	if (result != ERR_SUCCESS)
+		return result;
+
+	auto start = std::chrono::steady_clock::now();
 
-	return bbox_cell;
+	size_cells(&cell, 1, db->options.nthreads);
+
+	if (db->options.stats)
+		db->stats.bbox_seconds += stats_seconds_since(start);
+
+	// A reference below the cell names a cell that is not in the database
+	if (!cell->initialized)
+		return ERR_CELL_NAME_NOT_FOUND;
+
+	return ERR_SUCCESS;
 }
 
 void gds_cell_sizes(gds_db* db)
 {
-	// Calculate cell bounding boxes and output to console
+	// Under the load lock like gds_prepare_cell, so extractions may run at the same time
+	std::lock_guard<std::mutex> lock(db->load_mutex);
 
-	printf("\nAll cells in database with width and height in database units:\n");
+	// Parse the cells of a lazily loaded database first. Cells that fail to load, or that reference
+	// a cell missing from the database, are left without a bounding box.
+	std::vector<gds_cell*> cells;
 
-	for (int i = 0; i < db->cell_list.size(); i++) {
-		gds_cell* cell = db->cell_list[i];
+	for (gds_cell* cell : db->cell_list) {
+		if (gds_load_subtree(db, cell) == ERR_SUCCESS)
+			cells.push_back(cell);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	size_cells(cells.data(), cells.size(), db->options.nthreads);
+
+	if (db->options.stats)
+		db->stats.bbox_seconds += stats_seconds_since(start);
+}
+
+void gds_print_cell_sizes(gds_db* db)
+{
+	printf("\nAll cells in database with width and height in database units:\n");
 
-		gds_transform transform;
-		transform.translation = {0, 0};
-		transform.magnification = 1.f;
-		transform.angle = 0.f;
-		transform.mirror = 0x0000;
+	for (gds_cell* cell : db->cell_list) {
+		if (gds_prepare_cell(db, cell) != ERR_SUCCESS)
+			continue;
 
-		gds_bbox box = cell_sizes_recurse(cell, transform, 0);
+		gds_bbox box = cell->bbox;
 
-		printf("%s: %lld by %lld\n", cell->name, box.xmax - box.ymin, box.ymax - box.ymin);
+		printf("%s: %lld by %lld\n", cell->name, box.xmax - box.xmin, box.ymax - box.ymin);
 	}
 }
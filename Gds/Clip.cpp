@@ -0,0 +1,172 @@
+#include "Clip.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+// The edges of the target, each keeping the side towards the inside of the target
+enum ClipEdge
+{
+	CLIP_LEFT,
+	CLIP_RIGHT,
+	CLIP_BOTTOM,
+	CLIP_TOP
+};
+
+bool clip_needed(const gds_bbox* box, const gds_bbox* target)
+{
+	return box->xmin < target->xmin || box->ymin < target->ymin || box->xmax > target->xmax ||
+		box->ymax > target->ymax;
+}
+
+static
+bool is_rectangle(const gds_pair* p, int n)
+{
+	if (n != 4)
+		return false;
+
+	return (p[0].x == p[1].x && p[1].y == p[2].y && p[2].x == p[3].x && p[3].y == p[0].y) ||
+		(p[0].y == p[1].y && p[1].x == p[2].x && p[2].y == p[3].y && p[3].x == p[0].x);
+}
+
+static
+bool clip_inside(gds_pair p, ClipEdge edge, int64_t v)
+{
+	switch (edge)
+	{
+	case CLIP_LEFT:
+		return p.x >= v;
+	case CLIP_RIGHT:
+		return p.x <= v;
+	case CLIP_BOTTOM:
+		return p.y >= v;
+	default:
+		return p.y <= v;
+	}
+}
+
+static
+int64_t interpolate(int64_t a0, int64_t b0, int64_t a1, int64_t b1, int64_t b)
+{
+	// Coordinate a at @b on the edge from (a0, b0) to (a1, b1), which crosses @b
+
+	// Exact for the edges of Manhattan polygons
+	if (a0 == a1)
+		return a0;
+
+	// Always from the lower end, so an edge shared by two polygons is cut at the same vertex for both
+	if (b1 < b0)
+	{
+		std::swap(a0, a1);
+		std::swap(b0, b1);
+	}
+
+	return a0 + llround((double)(a1 - a0) * (double)(b - b0) / (double)(b1 - b0));
+}
+
+static
+gds_pair clip_cross(gds_pair p, gds_pair q, ClipEdge edge, int64_t v)
+{
+	if (edge == CLIP_LEFT || edge == CLIP_RIGHT)
+		return {v, interpolate(p.y, p.x, q.y, q.x, v)};
+
+	return {interpolate(p.x, p.y, q.x, q.y, v), v};
+}
+
+static
+void clip_edge(const std::vector<gds_pair>& in, std::vector<gds_pair>* out, ClipEdge edge, int64_t v)
+{
+	// One Sutherland-Hodgman pass over the open polygon @in
+
+	out->clear();
+
+	size_t n = in.size();
+	if (n == 0)
+		return;
+
+	gds_pair prev = in[n - 1];
+	bool prev_inside = clip_inside(prev, edge, v);
+
+	for (size_t i = 0; i < n; i++)
+	{
+		gds_pair cur = in[i];
+		bool cur_inside = clip_inside(cur, edge, v);
+
+		if (cur_inside != prev_inside)
+			out->push_back(clip_cross(prev, cur, edge, v));
+
+		if (cur_inside)
+			out->push_back(cur);
+
+		prev = cur;
+		prev_inside = cur_inside;
+	}
+}
+
+static
+double twice_area(const std::vector<gds_pair>& p)
+{
+	double area = 0;
+
+	for (size_t i = 0, j = p.size() - 1; i < p.size(); j = i++)
+		area += (double)p[j].x * (double)p[i].y - (double)p[i].x * (double)p[j].y;
+
+	return area;
+}
+
+int clip_polygon(const gds_pair* pairs, int npairs, const gds_bbox* target, std::vector<gds_pair>* out,
+	std::vector<gds_pair>* scratch)
+{
+	// Work on the open polygon
+	int n = npairs;
+	if (n > 1 && pairs[0].x == pairs[n - 1].x && pairs[0].y == pairs[n - 1].y)
+		n--;
+
+	out->clear();
+
+	if (n < 3)
+		return 0;
+
+	if (is_rectangle(pairs, n))
+	{
+		// Overlap of the boxes, from the same corner and in the same orientation as the input
+		int64_t xmin = std::max(std::min(pairs[0].x, pairs[2].x), target->xmin);
+		int64_t xmax = std::min(std::max(pairs[0].x, pairs[2].x), target->xmax);
+		int64_t ymin = std::max(std::min(pairs[0].y, pairs[2].y), target->ymin);
+		int64_t ymax = std::min(std::max(pairs[0].y, pairs[2].y), target->ymax);
+
+		if (xmin >= xmax || ymin >= ymax)
+			return 0;
+
+		for (int i = 0; i < 4; i++)
+			out->push_back({pairs[i].x == std::min(pairs[0].x, pairs[2].x) ? xmin : xmax,
+				pairs[i].y == std::min(pairs[0].y, pairs[2].y) ? ymin : ymax});
+
+		out->push_back(out->front());
+		return 5;
+	}
+
+	out->assign(pairs, pairs + n);
+
+	clip_edge(*out, scratch, CLIP_LEFT, target->xmin);
+	clip_edge(*scratch, out, CLIP_RIGHT, target->xmax);
+	clip_edge(*out, scratch, CLIP_BOTTOM, target->ymin);
+	clip_edge(*scratch, out, CLIP_TOP, target->ymax);
+
+	// Drop the repeated vertices where the polygon touched an edge of the target
+	out->erase(std::unique(out->begin(), out->end(), [](gds_pair a, gds_pair b) {
+		return a.x == b.x && a.y == b.y;
+	}), out->end());
+
+	while (out->size() > 1 && out->front().x == out->back().x && out->front().y == out->back().y)
+		out->pop_back();
+
+	if (out->size() < 3 || twice_area(*out) == 0)
+	{
+		out->clear();
+		return 0;
+	}
+
+	out->push_back(out->front());
+	return (int)out->size();
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "BBox.h"
+#include "Pair.h"
+
+#include <vector>
+
+// Whether part of @box lies outside @target, so a polygon with bounding box @box needs clipping
+bool clip_needed(const gds_bbox* box, const gds_bbox* target);
+
+/*
+	Clip the closed polygon @pairs (the last vertex equal to the first) to @target and store the
+	closed result in @out, in the orientation of the input. @scratch is working space.
+
+	An axis-parallel rectangle is cut to the overlap of the boxes. Other polygons are clipped against
+	the four edges of @target one after the other (Sutherland-Hodgman). The vertices where an edge of
+	a Manhattan polygon crosses the target are exact, those on other edges are rounded to the nearest
+	database unit. A concave polygon cut into several pieces stays one polygon, with the pieces joined
+	by edges running along the target border.
+
+	@return: number of vertices in @out, 0 when no area is left
+ */
+int clip_polygon(const gds_pair* pairs, int npairs, const gds_bbox* target, std::vector<gds_pair>* out,
+	std::vector<gds_pair>* scratch);
@@ -30,7 +30,9 @@ typedef enum {
 	ERR_ILLEGAL_WIDTH,
 	ERR_ILLEGAL_STRNAME,
 	ERR_CELL_NAME_NOT_FOUND,
-	ERR_MAX_POLYS,
-	ERR_NO_POLYS_FOUND
+	ERR_MAX_POLYS, // No longer returned, polygon sets have no maximum size
+	ERR_NO_POLYS_FOUND,
+	ERR_OUT_OF_MEMORY,
+	ERR_FILE_WRITE
 } gds_error;
 
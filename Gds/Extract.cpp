@@ -1,4 +1,9 @@
 #include "gds.h"
+#include "Clip.h"
+#include "FlatCache.h"
+#include "Index.h"
+#include "Parallel.h"
+#include "Reference.h"
 
 #include <assert.h>
 #include <stdio.h>
@@ -6,72 +11,730 @@
 #include <inttypes.h>
 #include <string.h>
 
-#define GDS_MAX_POLYS 1000000
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// A parallel extraction stops handing out new tasks while a thread has this many tasks waiting
+#define EXTRACT_MAX_QUEUED 16
+
+// AREFs with at least this many instances in the target are split over tasks, also of small cells
+#define EXTRACT_MIN_AREF_TASK 16
+
+struct ExtractionPool;
+struct ExtractionTask;
 
 typedef struct ExtractionInfo
 {
 	gds_polyset* pset;
 	gds_bbox target;
 	int64_t resolution;
+	const gds_layer_selection* layers; // NULL for all layers
 	int64_t nskipped;
 	char* error;
+
+	// Set on an error or when the visitor asks to stop, ends the walk
+	bool stopped;
+
+	// Counters of the walk, handed out when the options ask for statistics
+	gds_extract_stats counts;
+
+	// Receives the vertices of boundaries of compact cells
+	std::vector<gds_pair> scratch;
+
+	// Visitor extraction only (@pset is NULL then): the visitor, the polygons handed to it and the
+	// buffer for the transformed vertices
+	gds_polygon_visitor visitor;
+	void* user;
+	int64_t nvisited;
+	std::vector<gds_pair> vertices;
+
+	// Multi-tile extraction only (router is NULL otherwise): every polygon goes to the tiles it
+	// overlaps, into their polygon sets or to the tile visitor. @nvisited counts the polygons of all
+	// tiles then.
+	const gds_tile_router* router;
+	gds_polyset* tile_psets;
+	gds_tile_visitor tile_visitor;
+	std::vector<uint32_t> tile_hits;
+
+	gds_flat_cache* cache; // NULL when cells are always walked
+
+	// Clip the polygons to the target, or to every tile of a multi-tile extraction, into @clipped
+	bool clip;
+	std::vector<gds_pair> clipped, clip_scratch;
+
+	// Parallel extraction only (pool is NULL otherwise): thread of this info, the task it runs and
+	// the first polygon in @pset that is not part of a finished run of that task
+	ExtractionPool* pool;
+	int worker;
+	ExtractionTask* task;
+	size_t part_begin;
 } ExtractionInfo;
 
+// Part of the output of a task: a run of polygons in the buffer of a thread or all output of a child task
+struct ExtractionPart
+{
+	int worker;
+	size_t begin, end;
+	ExtractionTask* child;
+};
+
+// Subtree of the reference tree extracted by a single thread: a cell or a range of AREF instances
+struct ExtractionTask
+{
+	gds_cell* cell; // NULL for a range of AREF instances
+	gds_aref* aref;
+	gds_aref_range range;
+
+	gds_transform transform;
+	int level;
+
+	// The output in the order of a single threaded extraction
+	std::vector<ExtractionPart> parts;
+};
+
+// State shared by the threads of a parallel extraction
+struct ExtractionPool
+{
+	gds_task_pool* tasks;
+
+	std::vector<ExtractionInfo> infos; // One per thread, each with its own polygon buffer
+	gds_polyset* buffers;
+
+	std::atomic<bool> stopped; // Set when a visitor asked to stop or on an error
+};
+
 static
-void add_poly(gds_polyset* pset, gds_pair* pairs, int npairs, uint16_t layer, gds_bbox* box, gds_transform* tra)
+bool add_poly(gds_polyset* pset, const gds_pair* pairs, int npairs, uint16_t layer, uint16_t datatype, gds_bbox* box,
+	gds_transform* tra)
 {
-	//gds_polygon* poly = (gds_polygon *) malloc(sizeof(gds_polygon));
+	// Transform straight into the storage of the polygon set
+	gds_pair* transformed_pairs = gds_polyset_add(pset, npairs, layer, datatype, box);
+	if (transformed_pairs == NULL)
+		return false;
 
-	//gds_pair* pairs = (gds_pair*)malloc(npairs * sizeof(gds_pair));
-	gds_pair* transformed_pairs = new gds_pair[npairs];
 	transform_pairs(transformed_pairs, pairs, npairs, tra, false);
 
-	gds_polygon* poly = new gds_polygon(transformed_pairs, npairs, *box, layer);
+	return true;
+}
+
+static
+void visit_poly(ExtractionInfo* info, const gds_pair* pairs, int npairs, uint16_t layer, uint16_t datatype,
+	const gds_bbox* box)
+{
+	// Hand a transformed polygon to the visitor
+
+	info->nvisited++;
+	info->counts.elements_accepted++;
+
+	if (!info->visitor(info->user, pairs, npairs, layer, datatype, box))
+	{
+		info->stopped = true;
 
-	pset->push_back(poly);
+		if (info->pool != NULL)
+			info->pool->stopped = true;
+	}
 }
 
 static
-void extract(ExtractionInfo* info, gds_cell* cell, gds_transform transform, int level)
+void route_poly(ExtractionInfo* info, const gds_pair* pairs, int npairs, uint16_t layer, uint16_t datatype,
+	const gds_bbox* box)
 {
-	for (gds_boundary* b : *cell->boundaries)
+	// Hand a transformed polygon to every tile it overlaps
+
+	tile_route(info->router, box, &info->tile_hits);
+
+	for (uint32_t tile : info->tile_hits)
 	{
-		gds_bbox b_bbox = bbox_transform(&b->bbox, &transform, false);
+		const gds_pair* tile_pairs = pairs;
+		int tile_npairs = npairs;
+		gds_bbox tile_bbox = *box;
 
-		if (bbox_check_overlap(&b_bbox, &info->target))
+		if (info->clip)
 		{
-			// The boundary element after transformation overlaps with the target bounding box
+			gds_bbox tile_box = gds_tile_box(info->router->tiles, (int)tile);
 
-			// Check if its size is larger than the minimum (resolution)
-			int64_t box_size = bbox_size(&b_bbox);
+			if (clip_needed(box, &tile_box))
+			{
+				tile_npairs = clip_polygon(pairs, npairs, &tile_box, &info->clipped, &info->clip_scratch);
+				if (tile_npairs == 0)
+					continue;
 
-			if (box_size < info->resolution)
+				tile_pairs = info->clipped.data();
+
+				bbox_init(&tile_bbox);
+				bbox_fit_points(&tile_bbox, tile_pairs, tile_npairs);
+			}
+		}
+
+		info->nvisited++;
+
+		if (info->tile_visitor != NULL)
+		{
+			if (!info->tile_visitor(info->user, (int)tile, tile_pairs, tile_npairs, layer, datatype, &tile_bbox))
 			{
-				info->nskipped++;
+				info->stopped = true;
+
+				if (info->pool != NULL)
+					info->pool->stopped = true;
+
+				return;
+			}
+
+			continue;
+		}
+
+		gds_pair* dest = gds_polyset_add(&info->tile_psets[tile], tile_npairs, layer, datatype, &tile_bbox);
+
+		if (dest == NULL)
+		{
+			info->error = (char*)"Out of memory for the extracted polygons";
+			info->stopped = true;
+			return;
+		}
+
+		memcpy(dest, tile_pairs, tile_npairs * sizeof(gds_pair));
+	}
+}
+
+static
+void add_poly(ExtractionInfo* info, const gds_pair* pairs, int npairs, uint16_t layer, uint16_t datatype, gds_bbox* box,
+	gds_transform* tra)
+{
+	bool clip = info->clip && info->router == NULL && clip_needed(box, &info->target);
+
+	if (info->router == NULL && info->visitor == NULL && !clip)
+	{
+		if (!add_poly(info->pset, pairs, npairs, layer, datatype, box, tra))
+		{
+			info->error = (char*)"Out of memory for the extracted polygons";
+			info->stopped = true;
+
+			if (info->pool != NULL)
+				info->pool->stopped = true;
+
+			return;
+		}
+
+		info->counts.elements_accepted++;
+		return;
+	}
+
+	// Once a visitor asked to stop, the other threads of a parallel extraction do not call it anymore
+	if (info->pool != NULL && info->pool->stopped)
+	{
+		info->stopped = true;
+		return;
+	}
+
+	// Transformed once, also for all tiles
+	if ((int)info->vertices.size() < npairs)
+		info->vertices.resize(npairs);
+
+	transform_pairs(info->vertices.data(), pairs, npairs, tra, false);
+
+	const gds_pair* out_pairs = info->vertices.data();
+	int out_npairs = npairs;
+	gds_bbox out_bbox = *box;
+
+	if (clip)
+	{
+		out_npairs = clip_polygon(out_pairs, npairs, &info->target, &info->clipped, &info->clip_scratch);
+		if (out_npairs == 0)
+			return;
+
+		out_pairs = info->clipped.data();
+
+		bbox_init(&out_bbox);
+		bbox_fit_points(&out_bbox, out_pairs, out_npairs);
+	}
+
+	if (info->router != NULL)
+	{
+		info->counts.elements_accepted++;
+		route_poly(info, out_pairs, out_npairs, layer, datatype, &out_bbox);
+		return;
+	}
+
+	if (info->visitor != NULL)
+	{
+		visit_poly(info, out_pairs, out_npairs, layer, datatype, &out_bbox);
+		return;
+	}
+
+	gds_pair* dest = gds_polyset_add(info->pset, out_npairs, layer, datatype, &out_bbox);
+	if (dest == NULL)
+	{
+		info->error = (char*)"Out of memory for the extracted polygons";
+		info->stopped = true;
+
+		if (info->pool != NULL)
+			info->pool->stopped = true;
+
+		return;
+	}
+
+	memcpy(dest, out_pairs, out_npairs * sizeof(gds_pair));
+	info->counts.elements_accepted++;
+}
+
+static
+void extract(ExtractionInfo* info, gds_cell* cell, gds_transform transform, int level);
+
+static
+void extract_aref_range(ExtractionInfo* info, gds_aref* aref, gds_transform* transform, int level,
+	const gds_aref_range* range);
+
+static
+void close_part(ExtractionInfo* info)
+{
+	// End the current run of polygons of the task
+	size_t end = info->pset->size();
+
+	if (end > info->part_begin)
+		info->task->parts.push_back({info->worker, info->part_begin, end, NULL});
+
+	info->part_begin = end;
+}
+
+static
+void run_task(ExtractionPool* pool, ExtractionTask* task, int worker)
+{
+	ExtractionInfo* info = &pool->infos[worker];
+
+	if (pool->stopped)
+		return;
+
+	info->task = task;
+	info->part_begin = info->pset->size();
+
+	if (task->cell != NULL)
+		extract(info, task->cell, task->transform, task->level);
+	else
+		extract_aref_range(info, task->aref, &task->transform, task->level, &task->range);
+
+	close_part(info);
+}
+
+static
+bool spawn_allowed(ExtractionInfo* info)
+{
+	return info->pool != NULL && info->pool->tasks->queued(info->worker) < EXTRACT_MAX_QUEUED;
+}
+
+static
+bool task_sized(const gds_cell* cell)
+{
+	// Cells without references and index are extracted right away, a task costs more than that
+	return !cell->srefs.empty() || !cell->arefs.empty() || cell->index != NULL;
+}
+
+static
+void spawn(ExtractionInfo* info, ExtractionTask* task)
+{
+	// The output of the task follows the polygons found so far
+	close_part(info);
+	info->task->parts.push_back({0, 0, 0, task});
+
+	ExtractionPool* pool = info->pool;
+	info->counts.tasks++;
+
+	pool->tasks->spawn(info->worker, [pool, task](int worker) {
+		run_task(pool, task, worker);
+	});
+}
+
+static
+bool subtree_selected(const ExtractionInfo* info, const gds_cell* cell)
+{
+	// Whether the subtree of @cell can have elements on the selected layers
+	return info->layers == NULL || layer_mask_overlap(&cell->layers, &info->layers->mask);
+}
+
+static
+void extract_boundary(ExtractionInfo* info, gds_cell* cell, int i, gds_transform* transform)
+{
+	if (info->layers != NULL &&
+		!gds_layer_selected(info->layers, cell_boundary_layer(cell, i), cell_boundary_datatype(cell, i)))
+	{
+		info->counts.elements_filtered++;
+		return;
+	}
+
+	info->counts.elements_tested++;
+
+	// Only the bounding box is looked at for boundaries outside the target
+	gds_bbox local_bbox = cell_boundary_bbox(cell, i);
+	gds_bbox b_bbox = bbox_transform(&local_bbox, transform, false);
+
+	if (bbox_check_overlap(&b_bbox, &info->target))
+	{
+		// The boundary element after transformation overlaps with the target bounding box
+
+		// Check if its size is larger than the minimum (resolution)
+		int64_t box_size = bbox_size(&b_bbox);
+
+		if (box_size < info->resolution)
+		{
+			info->nskipped++;
+		} else
+		{
+			gds_boundary b;
+			cell_boundary(cell, i, &b, &info->scratch);
+
+			add_poly(info, b.pairs, b.npairs, b.layer, b.datatype, &b_bbox, transform);
+		}
+	}
+}
+
+static
+void extract_path(ExtractionInfo* info, gds_path* p, gds_transform* transform)
+{
+	if (info->layers != NULL && !gds_layer_selected(info->layers, p->layer, p->datatype))
+	{
+		info->counts.elements_filtered++;
+		return;
+	}
+
+	info->counts.elements_tested++;
+
+	gds_bbox bbox = bbox_transform(&p->bbox, transform, false);
+
+	if (bbox_check_overlap(&bbox, &info->target))
+	{
+		// The boundary element after transformation overlaps with the target bounding box
+
+		// Check if its size is larger than the minimum (resolution)
+		int64_t box_size = bbox_size(&bbox);
+
+		if (box_size < info->resolution)
+		{
+			info->nskipped++;
+		} else
+		{
+			add_poly(info, p->pairs, p->npairs, p->layer, p->datatype, &bbox, transform);
+		}
+	}
+}
+
+static
+void extract_sref(ExtractionInfo* info, gds_sref* sref, gds_transform* transform, int level)
+{
+	if (!subtree_selected(info, sref->cell))
+	{
+		info->counts.subtrees_pruned++;
+		return;
+	}
+
+	gds_transform local = reference_transform(sref->origin, sref->mag, sref->angle, sref->strans);
+	gds_transform acc = transform_compose(transform, &local);
+
+	info->counts.transforms++;
+	info->counts.references_tested++;
+
+	// Transform the bounding box of the SREF element
+	gds_bbox sref_box = bbox_transform(&sref->cell->bbox, &acc, false);
+
+	// Recurse further only if the sref bounding overlaps with the target bounding box
+	if (bbox_check_overlap(&sref_box, &info->target))
+	{
+		if (task_sized(sref->cell) && spawn_allowed(info))
+		{
+			ExtractionTask* task = new ExtractionTask;
+			task->cell = sref->cell;
+			task->aref = NULL;
+			task->transform = acc;
+			task->level = level + 1;
+
+			spawn(info, task);
+		} else
+		{
+			extract(info, sref->cell, acc, level + 1);
+		}
+	}
+}
+
+static
+gds_bbox local_target(const ExtractionInfo* info, const gds_transform* transform)
+{
+	// The target transformed back into the cell. The inverse transformation rounds, so the target
+	// is grown by a few database units of the cell.
+
+	gds_bbox local = bbox_transform(&info->target, transform, true);
+
+	int64_t margin = 2 + (int64_t)(2.0 / transform->magnification);
+	local.xmin -= margin;
+	local.ymin -= margin;
+	local.xmax += margin;
+	local.ymax += margin;
+
+	return local;
+}
+
+static
+void extract_aref(ExtractionInfo* info, gds_aref* aref, gds_transform* transform, int level)
+{
+	if (!subtree_selected(info, aref->cell))
+	{
+		info->counts.subtrees_pruned++;
+		return;
+	}
+
+	// Solve which columns and rows can reach the target instead of testing every instance
+
+	gds_bbox local = local_target(info, transform);
+
+	if (transform->quarters < 0)
+	{
+		// Under other rotations an instance box can reach the target with a corner outside the
+		// local target. Grow it by (more than) the diagonal of the rotated instance box.
+
+		const gds_bbox* b = &aref->cell->bbox;
+		int64_t grow = (int64_t)(2 * aref->mag * ((b->xmax - b->xmin) + (b->ymax - b->ymin)));
+
+		local.xmin -= grow;
+		local.ymin -= grow;
+		local.xmax += grow;
+		local.ymax += grow;
+	}
+
+	int64_t total = aref->ncols * (int64_t)aref->nrows;
+
+	gds_aref_range range;
+	if (!aref_range(aref, &local, &range))
+	{
+		info->counts.aref_instances_skipped += total;
+		return;
+	}
+
+	int ncols = range.c1 - range.c0 + 1;
+	int nrows = range.r1 - range.r0 + 1;
+	int64_t ninstances = ncols * (int64_t)nrows;
+
+	info->counts.aref_instances_skipped += total - ninstances;
+
+	if (ninstances > 1 && (ninstances >= EXTRACT_MIN_AREF_TASK || task_sized(aref->cell)) && spawn_allowed(info))
+	{
+		// Split the instances over tasks by columns (or rows for a single column), which keeps them
+		// in the order of a single threaded extraction
+		bool by_cols = ncols > 1;
+		int n = by_cols ? ncols : nrows;
+		int nchunks = std::min(n, 4 * info->pool->tasks->size());
+
+		for (int i = 0; i < nchunks; i++)
+		{
+			int first = (int)((int64_t)n * i / nchunks);
+			int last = (int)((int64_t)n * (i + 1) / nchunks) - 1;
+
+			ExtractionTask* task = new ExtractionTask;
+			task->cell = NULL;
+			task->aref = aref;
+			task->range = range;
+			task->transform = *transform;
+			task->level = level;
+
+			if (by_cols)
+			{
+				task->range.c0 = range.c0 + first;
+				task->range.c1 = range.c0 + last;
 			} else
 			{
-				add_poly(info->pset, b->pairs, b->npairs, b->layer, &b_bbox, &transform);
+				task->range.r0 = range.r0 + first;
+				task->range.r1 = range.r0 + last;
 			}
 
-			// Check if the number of polygons is overflowing
-			if (info->pset->size() >= GDS_MAX_POLYS)
+			spawn(info, task);
+		}
+
+		return;
+	}
+
+	extract_aref_range(info, aref, transform, level, &range);
+}
+
+static
+void extract_aref_range(ExtractionInfo* info, gds_aref* aref, gds_transform* transform, int level,
+	const gds_aref_range* range)
+{
+	// The instances only differ in their translation
+	gds_transform local = reference_transform({0, 0}, aref->mag, aref->angle, aref->strans);
+	gds_transform acc = transform_compose(transform, &local);
+
+	info->counts.transforms++;
+
+	for (int c = range->c0; c <= range->c1; c++)
+	{
+		for (int r = range->r0; r <= range->r1; r++)
+		{
+			// Position of the sub structure cell being referenced
+			acc.translation = transform_pair(aref_origin(aref, c, r), transform, false);
+
+			info->counts.references_tested++;
+
+			// Transform the bounding box of the aref element
+			gds_bbox aref_box = bbox_transform(&aref->cell->bbox, &acc, false);
+
+			// Recurse further only if the aref bounding overlaps with the target bounding box
+			if (bbox_check_overlap(&aref_box, &info->target))
 			{
-				info->error = (char*)"Reached maximum allowed number of polygons";
-				return;
+				extract(info, aref->cell, acc, level + 1);
+
+				if (info->stopped)
+					return; // Collapse recursion
 			}
 		}
 	}
+}
 
-	for (gds_path* p : *cell->paths)
+static
+void extract_indexed(ExtractionInfo* info, gds_cell* cell, gds_transform* transform, int level)
+{
+	// Visit only the elements whose local bounding box comes near the target
+	gds_bbox local = local_target(info, transform);
+
+	std::vector<uint32_t> hits;
+	index_query(cell->index, &local, &hits);
+
+	for (uint32_t hit : hits)
 	{
-		//gds_path* p = (gds_path*)cell->paths[i];
-		gds_bbox bbox = bbox_transform(&p->bbox, &transform, false);
+		uint32_t i = INDEX_HIT_ELEMENT(hit);
 
-		if (bbox_check_overlap(&bbox, &info->target))
+		switch (INDEX_HIT_KIND(hit))
 		{
-			// The boundary element after transformation overlaps with the target bounding box
+			case INDEX_BOUNDARY:
+				extract_boundary(info, cell, i, transform);
+				break;
+			case INDEX_PATH:
+				extract_path(info, cell->paths[i], transform);
+				break;
+			case INDEX_SREF:
+				extract_sref(info, cell->srefs[i], transform, level);
+				break;
+			case INDEX_AREF:
+				extract_aref(info, cell->arefs[i], transform, level);
+				break;
+		}
+
+		if (info->stopped)
+			return; // Collapse recursion
+	}
+}
+
+// Collects the polygons of a cell being flattened for the cache
+struct FlattenState
+{
+	gds_flat_cell* flat;
+	size_t max_bytes;
+	bool failed; // Out of memory or too large to cache
+};
+
+static
+bool flatten_poly(void* user, const gds_pair* pairs, int npairs, uint16_t layer, uint16_t datatype,
+	const gds_bbox* bbox)
+{
+	FlattenState* f = (FlattenState*)user;
+
+	gds_pair* flat_pairs = gds_polyset_add(&f->flat->polygons, npairs, layer, datatype, bbox);
+	if (flat_pairs == NULL)
+	{
+		f->failed = true;
+		return false;
+	}
+
+	memcpy(flat_pairs, pairs, npairs * sizeof(gds_pair));
+
+	f->flat->bytes += npairs * sizeof(gds_pair) + sizeof(gds_polygon);
+
+	if (f->flat->bytes > f->max_bytes)
+	{
+		f->failed = true;
+		return false;
+	}
+
+	return true;
+}
+
+static
+std::shared_ptr<const gds_flat_cell> flatten_cell(gds_flat_cache* cache, gds_cell* cell, int level)
+{
+	// Extract all polygons of @cell in its own coordinates, in the order of a single threaded walk,
+	// and add them to the cache
+
+	std::shared_ptr<gds_flat_cell> flat = std::make_shared<gds_flat_cell>();
+	flat->cell = cell;
+	flat->bytes = 0;
+
+	FlattenState f;
+	f.flat = flat.get();
+	f.max_bytes = flat_cache_max_bytes(cache);
+	f.failed = false;
+
+	ExtractionInfo sub;
+
+	// Everything in the cell overlaps its bounding box grown by one
+	sub.target = cell->bbox;
+	sub.target.xmin--;
+	sub.target.ymin--;
+	sub.target.xmax++;
+	sub.target.ymax++;
+
+	sub.pset = NULL;
+	sub.resolution = 0;
+	sub.layers = NULL;
+	sub.nskipped = 0;
+	sub.error = NULL;
+	sub.stopped = false;
+	sub.visitor = flatten_poly;
+	sub.user = &f;
+	sub.nvisited = 0;
+	sub.router = NULL;
+	sub.tile_psets = NULL;
+	sub.tile_visitor = NULL;
+	sub.cache = NULL;
+	sub.clip = false;
+	sub.pool = NULL;
+	sub.worker = 0;
+	sub.task = NULL;
+	sub.part_begin = 0;
+
+	gds_transform identity;
+	transform_init(&identity);
+
+	extract(&sub, cell, identity, level);
+
+	if (f.failed)
+	{
+		flat_cache_reject(cache, cell);
+		return NULL;
+	}
+
+	flat_cache_add(cache, flat);
+
+	return flat;
+}
+
+static
+void extract_flat(ExtractionInfo* info, const gds_flat_cell* flat, gds_transform* transform)
+{
+	// Place the cached polygons of a cell, testing each like extract_boundary tests a boundary
+
+	const gds_polyset* p = &flat->polygons;
+
+	for (size_t i = 0; i < p->size(); i++)
+	{
+		if (info->layers != NULL && !gds_layer_selected(info->layers, p->layers[i], p->datatypes[i]))
+		{
+			info->counts.elements_filtered++;
+			continue;
+		}
 
-			// Check if its size is larger than the minimum (resolution)
+		info->counts.elements_tested++;
+
+		gds_bbox bbox = bbox_transform(&p->bboxes[i], transform, false);
+
+		if (bbox_check_overlap(&bbox, &info->target))
+		{
 			int64_t box_size = bbox_size(&bbox);
 
 			if (box_size < info->resolution)
@@ -79,95 +742,201 @@ void extract(ExtractionInfo* info, gds_cell* cell, gds_transform transform, int
 				info->nskipped++;
 			} else
 			{
-				add_poly(info->pset, p->pairs, p->npairs, p->layer, &bbox, &transform);
-			}
+				add_poly(info, p->pairs[i], p->npairs[i], p->layers[i], p->datatypes[i], &bbox, transform);
 
-			// Check if the number of polygons is overflowing
-			if (info->pset->size() >= GDS_MAX_POLYS)
-			{
-				info->error = (char *) "Reached maximum allowed number of polygons";
-				return;
+				if (info->stopped)
+					return;
 			}
 		}
 	}
+}
+
+static
+bool extract_cached(ExtractionInfo* info, gds_cell* cell, gds_transform* transform, int level)
+{
+	// Serve a placed cell from the cache. Only cells with references gain from it, and only exact
+	// placements give the same vertices as walking the cell: they map the integer vertices of the
+	// flattened cell exactly where the composed transformations put them.
+
+	if (level <= 1 || !transform->exact || (cell->srefs.empty() && cell->arefs.empty()))
+		return false;
+
+	bool flatten;
+	std::shared_ptr<const gds_flat_cell> flat = flat_cache_find(info->cache, cell, &flatten);
+
+	if (flat == NULL && flatten)
+		flat = flatten_cell(info->cache, cell, level);
+
+	if (flat == NULL)
+		return false;
+
+	extract_flat(info, flat.get(), transform);
+
+	return true;
+}
+
+static
+void extract(ExtractionInfo* info, gds_cell* cell, gds_transform transform, int level)
+{
+	info->counts.cells_visited++;
+
+	if (info->cache != NULL && extract_cached(info, cell, &transform, level))
+		return;
+
+	// The index is queried with the local target, which only covers all elements passing the
+	// bounding box test when the transformation maps boxes onto boxes
+	if (cell->index != NULL && transform.quarters >= 0)
+	{
+		extract_indexed(info, cell, &transform, level);
+		return;
+	}
+
+	int nboundaries = cell_boundary_count(cell);
+
+	for (int i = 0; i < nboundaries; i++)
+	{
+		extract_boundary(info, cell, i, &transform);
+
+		if (info->stopped)
+			return;
+	}
+
+	for (gds_path* p : cell->paths)
+	{
+		extract_path(info, p, &transform);
+
+		if (info->stopped)
+			return;
+	}
 
 	// Scan through the SREF elements
-	for (gds_sref* sref : *cell->srefs)
+	for (gds_sref* sref : cell->srefs)
 	{
-		gds_transform acc;
-		acc.translation = transform_pair(sref->origin, &transform, false);
-		acc.magnification = transform.magnification * sref->mag;
-		acc.angle = transform.angle + sref->angle;
-		acc.mirror = transform.mirror ^ (sref->strans & 0x8000);
+		extract_sref(info, sref, &transform, level);
 
-		// Transform the bounding box of the SREF element
-		gds_bbox sref_box = bbox_transform(&sref->cell->bbox, &acc, false);
+		if (info->stopped)
+			return; // Collapse recursion
+	}
 
-		// Recurse further only if the sref bounding overlaps with the target bounding box
-		if (bbox_check_overlap(&sref_box, &info->target))
-		{
-			extract(info, sref->cell, acc, level + 1);
+	// Scan through the AREF elements
+	for (gds_aref* aref : cell->arefs)
+	{
+		extract_aref(info, aref, &transform, level);
 
-			if (info->error != NULL)
-				return; // Collapse recursion
+		if (info->stopped)
+			return; // Collapse recursion
+	}
+}
+
+static
+void gather_task(ExtractionPool* pool, ExtractionTask* task, gds_polyset* pset)
+{
+	// Append the output of a task and its children in order to @pset (if given) and free them
+
+	for (ExtractionPart& part : task->parts)
+	{
+		if (part.child != NULL)
+		{
+			gather_task(pool, part.child, pset);
+		} else if (pset != NULL)
+		{
+			gds_polyset_append(pset, &pool->buffers[part.worker], part.begin, part.end);
 		}
 	}
 
-	// Scan through the AREF elements
-	for (gds_aref* aref : *cell->arefs)
+	delete task;
+}
+
+static
+void extract_parallel(ExtractionInfo* info, gds_cell* top, gds_transform transform, const gds_extract_options* options)
+{
+	// The threads of an earlier extraction are used again
+	gds_task_pool* tasks = parallel_pool_acquire(options->nthreads);
+
+	ExtractionPool pool;
+	pool.tasks = tasks;
+	pool.stopped = false;
+	pool.infos.resize(tasks->size());
+	pool.buffers = new gds_polyset[tasks->size()];
+
+	for (int w = 0; w < tasks->size(); w++)
 	{
-		double v_col_x, v_col_y, v_row_x, v_row_y;
+		ExtractionInfo* t = &pool.infos[w];
 
-		int64_t x1 = aref->vectors[0].x;
-		int64_t y1 = aref->vectors[0].y;
-		int64_t x2 = aref->vectors[1].x;
-		int64_t y2 = aref->vectors[1].y;
-		int64_t x3 = aref->vectors[2].x;
-		int64_t y3 = aref->vectors[2].y;
+		t->pset = &pool.buffers[w];
+		t->target = info->target;
+		t->resolution = info->resolution;
+		t->layers = info->layers;
+		t->nskipped = 0;
+		t->error = NULL;
+		t->stopped = false;
+		t->visitor = info->visitor;
+		t->user = info->user;
+		t->nvisited = 0;
+		t->router = info->router;
+		t->tile_psets = info->tile_psets;
+		t->tile_visitor = info->tile_visitor;
+		t->cache = info->cache;
+		t->clip = info->clip;
+		t->pool = &pool;
+		t->worker = w;
+		t->task = NULL;
+		t->part_begin = 0;
+	}
 
-		// (v_col_x, v_col_y) vector pair column direction
-		v_col_x = ((double)(x2 - x1)) / aref->ncols;
-		v_col_y = ((double)(y2 - y1)) / aref->ncols;
+	ExtractionTask* root = new ExtractionTask;
+	root->cell = top;
+	root->aref = NULL;
+	root->transform = transform;
+	root->level = 1;
 
-		// (v_row_x, v_row_y) vector pair row direction
-		v_row_x = ((double)(x3 - x1)) / aref->nrows;
-		v_row_y = ((double)(y3 - y1)) / aref->nrows;
+	tasks->run([&](int worker) {
+		run_task(&pool, root, worker);
+	});
 
-		// Loop through the array and recurse each
-		for (int c = 0; c < aref->ncols; c++)
-		{
-			for (int r = 0; r < aref->nrows; r++)
-			{
-				// Position of the sub structure cell being referenced
+	// Merge the thread buffers
+	if (info->pset == NULL)
+	{
+		gather_task(&pool, root, NULL);
+	} else if (options->deterministic)
+	{
+		gather_task(&pool, root, info->pset);
+	} else
+	{
+		gather_task(&pool, root, NULL);
 
-				int64_t x_ref = (int64_t)(x1 + c * v_col_x + r * v_row_x);
-				int64_t y_ref = (int64_t)(y1 + c * v_col_y + r * v_row_y);
+		for (int w = 0; w < tasks->size(); w++)
+			gds_polyset_append(info->pset, &pool.buffers[w], 0, pool.buffers[w].size());
+	}
 
-				gds_transform acc;
-				acc.translation = transform_pair({ x_ref, y_ref }, & transform, false);
-				acc.magnification = transform.magnification * aref->mag;
-				acc.angle = transform.angle + aref->angle;
-				acc.mirror = transform.mirror ^ (aref->strans & 0x8000);
+	// The merged polygons keep pointing into the chunks of the thread buffers
+	if (info->pset != NULL)
+	{
+		for (int w = 0; w < tasks->size(); w++)
+			gds_polyset_take(info->pset, &pool.buffers[w]);
+	}
 
-				// Transform the bounding box of the aref element
-				gds_bbox aref_box = bbox_transform(&aref->cell->bbox, &acc, false);
+	delete[] pool.buffers;
+	parallel_pool_release(tasks);
 
-				// Recurse further only if the aref bounding overlaps with the target bounding box
-				if (bbox_check_overlap(&aref_box, &info->target))
-				{
-					extract(info, aref->cell, acc, level + 1);
+	for (ExtractionInfo& t : pool.infos)
+	{
+		info->nskipped += t.nskipped;
+		info->nvisited += t.nvisited;
+		extract_stats_add(&info->counts, &t.counts);
 
-					if (info->error != NULL)
-						return; // Collapse recursion
-				}
-			}
-		}
+		if (t.error != NULL)
+			info->error = t.error;
 	}
 }
 
-int gds_extract(gds_db* db, const char* cell_name, gds_bbox target, int64_t resolution, gds_polyset* pset,
-	int64_t* nskipped)
+static
+int extract_top(gds_db* db, const char* cell_name, ExtractionInfo* info, const gds_extract_options* options)
 {
+	gds_extract_options defaults;
+	if (options == NULL)
+		options = &defaults;
+
 	// Find the pointer to the structure to expand
 	gds_cell* top = find_cell(db, cell_name);
 
@@ -179,11 +948,63 @@ int gds_extract(gds_db* db, const char* cell_name, gds_bbox target, int64_t reso
 		return ERR_CELL_NAME_NOT_FOUND;
 	}
 
+	// Parse the cells below the top cell and determine their size when not done yet
+	int result = gds_prepare_cell(db, top);
+	if (result != ERR_SUCCESS)
+		return result;
+
+	info->layers = options->layers;
+	info->cache = options->cache;
+	info->clip = options->clip;
+	info->nskipped = 0;
+	info->error = NULL;
+	info->stopped = false;
+	info->nvisited = 0;
+	info->pool = NULL;
+	info->counts = gds_extract_stats();
+
+	auto start = std::chrono::steady_clock::now();
+	size_t nblocks = info->pset != NULL ? info->pset->chunks->blocks.size() : 0;
+
+	// Initial transformation
+
+	gds_transform transfrom;
+	transform_init(&transfrom);
+
+	if (parallel_threads(options->nthreads) > 1)
+		extract_parallel(info, top, transfrom, options);
+	else
+		extract(info, top, transfrom, 1);
+
+	if (options->stats != NULL)
+	{
+		if (info->pset != NULL)
+			info->counts.allocations = info->pset->chunks->blocks.size() - nblocks;
+
+		info->counts.seconds = stats_seconds_since(start);
+		*options->stats = info->counts;
+	}
+
+	if (info->error != NULL)
+	{
+		printf("--> %s\n", info->error);
+		return ERR_OUT_OF_MEMORY;
+	}
+
+	return ERR_SUCCESS;
+}
+
+int gds_extract(gds_db* db, const char* cell_name, gds_bbox target, int64_t resolution, gds_polyset* pset,
+	int64_t* nskipped, const gds_extract_options* options)
+{
 	ExtractionInfo info;
 
 	info.pset = pset;
-	info.nskipped = 0;
-	info.error = NULL;
+	info.visitor = NULL;
+	info.user = NULL;
+	info.router = NULL;
+	info.tile_psets = NULL;
+	info.tile_visitor = NULL;
 
 	//double dbunit_in_um = 1E6 * db->dbunit_in_meter;
 
@@ -193,29 +1014,158 @@ int gds_extract(gds_db* db, const char* cell_name, gds_bbox target, int64_t reso
 	// Convert the target resolution from micron to data base units
 	info.resolution = resolution;
 
-	// Initial transformation
+	int result = extract_top(db, cell_name, &info, options);
+	if (result != ERR_SUCCESS)
+		return result;
 
-	gds_transform transfrom;
-	transfrom.translation = {0, 0};
-	transfrom.magnification = 1.f;
-	transfrom.angle = 0.f;
-	transfrom.mirror = 0x0000;
+	if (info.pset->size() == 0)
+	{
+		printf("--> No polygons found\n");
+		return ERR_NO_POLYS_FOUND;
+	} else
+	{
+		printf("--> Found %lld polygons\n", (long long)info.pset->size());
+	}
 
-	extract(&info, top, transfrom, 1);
+	*nskipped = info.nskipped;
 
-	if (info.error != NULL)
+	return ERR_SUCCESS;
+}
+
+int gds_extract_visit(gds_db* db, const char* cell_name, gds_bbox target, int64_t resolution,
+	gds_polygon_visitor visitor, void* user, int64_t* nskipped, const gds_extract_options* options)
+{
+	ExtractionInfo info;
+
+	info.pset = NULL;
+	info.visitor = visitor;
+	info.user = user;
+	info.router = NULL;
+	info.tile_psets = NULL;
+	info.tile_visitor = NULL;
+	info.target = target;
+	info.resolution = resolution;
+
+	int result = extract_top(db, cell_name, &info, options);
+	if (result != ERR_SUCCESS)
+		return result;
+
+	if (info.nvisited == 0)
+	{
+		printf("--> No polygons found\n");
+		return ERR_NO_POLYS_FOUND;
+	} else
 	{
-		printf("--> %s\n", info.error);
-		return ERR_MAX_POLYS;
+		printf("--> Visited %lld polygons\n", (long long)info.nvisited);
 	}
 
-	if (info.pset->size() == 0)
+	*nskipped = info.nskipped;
+
+	return ERR_SUCCESS;
+}
+
+int gds_extract_tiles(gds_db* db, const char* cell_name, const gds_tiles* tiles, int64_t resolution,
+	gds_polyset* psets, int64_t* nskipped, const gds_extract_options* options)
+{
+	gds_tile_router router;
+	if (!tile_router_init(&router, tiles))
+		return ERR_PARAM;
+
+	ExtractionInfo info;
+
+	info.pset = NULL;
+	info.visitor = NULL;
+	info.user = NULL;
+	info.router = &router;
+	info.tile_psets = psets;
+	info.tile_visitor = NULL;
+
+	// One walk over the hierarchy for all tiles together
+	info.target = router.bounds;
+	info.resolution = resolution;
+
+	// The thread buffers of a parallel extraction hold polygons of all tiles. They are gathered in
+	// one set first and routed to the tiles after. Gathering without a router would clip to the
+	// bounds of all tiles, so the polygons are gathered whole and clipped when routed.
+	gds_polyset gathered;
+	gds_extract_options gather_options;
+	if (options != NULL)
+		gather_options = *options;
+
+	bool parallel = parallel_threads(gather_options.nthreads) > 1;
+
+	if (parallel)
+	{
+		info.pset = &gathered;
+		info.router = NULL;
+		gather_options.clip = false;
+	}
+
+	int result = extract_top(db, cell_name, &info, &gather_options);
+	if (result != ERR_SUCCESS)
+		return result;
+
+	if (parallel)
+	{
+		info.router = &router;
+		info.clip = options->clip;
+
+		for (size_t i = 0; i < gathered.size() && !info.stopped; i++)
+		{
+			gds_polygon p = gathered[i];
+			route_poly(&info, p.pairs, p.npairs, p.layer, p.datatype, &p.bbox);
+		}
+
+		if (info.error != NULL)
+		{
+			printf("--> %s\n", info.error);
+			return ERR_OUT_OF_MEMORY;
+		}
+	}
+
+	if (info.nvisited == 0)
+	{
+		printf("--> No polygons found\n");
+		return ERR_NO_POLYS_FOUND;
+	} else
+	{
+		printf("--> Found %lld polygons in %d tiles\n", (long long)info.nvisited, gds_tile_count(tiles));
+	}
+
+	*nskipped = info.nskipped;
+
+	return ERR_SUCCESS;
+}
+
+int gds_extract_tiles_visit(gds_db* db, const char* cell_name, const gds_tiles* tiles, int64_t resolution,
+	gds_tile_visitor visitor, void* user, int64_t* nskipped, const gds_extract_options* options)
+{
+	gds_tile_router router;
+	if (!tile_router_init(&router, tiles))
+		return ERR_PARAM;
+
+	ExtractionInfo info;
+
+	info.pset = NULL;
+	info.visitor = NULL;
+	info.user = user;
+	info.router = &router;
+	info.tile_psets = NULL;
+	info.tile_visitor = visitor;
+	info.target = router.bounds;
+	info.resolution = resolution;
+
+	int result = extract_top(db, cell_name, &info, options);
+	if (result != ERR_SUCCESS)
+		return result;
+
+	if (info.nvisited == 0)
 	{
 		printf("--> No polygons found\n");
 		return ERR_NO_POLYS_FOUND;
 	} else
 	{
-		printf("--> Found %lld polygons\n", info.pset->size());
+		printf("--> Visited %lld polygons in %d tiles\n", (long long)info.nvisited, gds_tile_count(tiles));
 	}
 
 	*nskipped = info.nskipped;
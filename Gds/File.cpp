@@ -0,0 +1,220 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "File.h"
+
+#include "Errors.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+static
+char* narrow_name(const wchar_t* file)
+{
+	// Convert a wide file name to a multibyte string (caller frees the result)
+
+	size_t len = wcstombs(NULL, file, 0);
+	if (len == (size_t)-1)
+		return NULL;
+
+	char* name = (char*)malloc(len + 1);
+	if (name)
+		wcstombs(name, file, len + 1);
+
+	return name;
+}
+#endif
+
+FILE* gds_fopen(const wchar_t* file, const wchar_t* mode)
+{
+	FILE* fp = NULL;
+
+#ifdef _WIN32
+	_wfopen_s(&fp, file, mode);
+#else
+	char* name = narrow_name(file);
+	char* m = narrow_name(mode);
+
+	if (name && m)
+		fp = fopen(name, m);
+
+	free(name);
+	free(m);
+#endif
+
+	return fp;
+}
+
+int mapped_file_open(gds_mapped_file* self, const wchar_t* file, gds_mapped_access access)
+{
+	self->data = NULL;
+	self->size = 0;
+
+#ifdef _WIN32
+	self->map_handle = NULL;
+	DWORD flags = FILE_ATTRIBUTE_NORMAL;
+	if (access == MAPPED_SEQUENTIAL)
+		flags |= FILE_FLAG_SEQUENTIAL_SCAN;
+
+	self->file_handle = CreateFileW(file, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, flags, NULL);
+
+	if (self->file_handle == INVALID_HANDLE_VALUE)
+	{
+		self->file_handle = NULL;
+		return ERR_FILE_OPEN;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(self->file_handle, &size) || size.QuadPart == 0 ||
+		(uint64_t)size.QuadPart > SIZE_MAX)
+	{
+		mapped_file_close(self);
+		return ERR_FILE_OPEN;
+	}
+
+	self->map_handle = CreateFileMappingW(self->file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (self->map_handle == NULL)
+	{
+		mapped_file_close(self);
+		return ERR_FILE_OPEN;
+	}
+
+	self->data = (const uint8_t*)MapViewOfFile(self->map_handle, FILE_MAP_READ, 0, 0, 0);
+	if (self->data == NULL)
+	{
+		mapped_file_close(self);
+		return ERR_FILE_OPEN;
+	}
+
+	self->size = (uint64_t)size.QuadPart;
+#else
+	char* name = narrow_name(file);
+	self->fd = name ? open(name, O_RDONLY) : -1;
+	free(name);
+
+	if (self->fd < 0)
+		return ERR_FILE_OPEN;
+
+	struct stat st;
+	if (fstat(self->fd, &st) != 0 || st.st_size == 0 || (uint64_t)st.st_size > SIZE_MAX)
+	{
+		mapped_file_close(self);
+		return ERR_FILE_OPEN;
+	}
+
+	void* p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, self->fd, 0);
+	if (p == MAP_FAILED)
+	{
+		mapped_file_close(self);
+		return ERR_FILE_OPEN;
+	}
+
+	// The records of a complete load are walked front to back exactly once
+	if (access == MAPPED_SEQUENTIAL)
+		madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+	self->data = (const uint8_t*)p;
+	self->size = (uint64_t)st.st_size;
+#endif
+
+	return ERR_SUCCESS;
+}
+
+void mapped_file_close(gds_mapped_file* self)
+{
+#ifdef _WIN32
+	if (self->data)
+		UnmapViewOfFile(self->data);
+
+	if (self->map_handle)
+		CloseHandle(self->map_handle);
+
+	if (self->file_handle)
+		CloseHandle(self->file_handle);
+
+	self->map_handle = NULL;
+	self->file_handle = NULL;
+#else
+	if (self->data)
+		munmap((void*)self->data, (size_t)self->size);
+
+	if (self->fd >= 0)
+		close(self->fd);
+
+	self->fd = -1;
+#endif
+
+	self->data = NULL;
+	self->size = 0;
+}
+
+int gds_file_info(const wchar_t* file, uint64_t* size, int64_t* mtime)
+{
+	// The modification time in whole seconds misses a rewrite within the same second
+
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExW(file, GetFileExInfoStandard, &data))
+		return ERR_FILE_OPEN;
+
+	*size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+
+	// 100 ns ticks since 1601
+	int64_t ticks = (int64_t)(((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime);
+	*mtime = (ticks - 116444736000000000ll) * 100;
+#else
+	char* name = narrow_name(file);
+
+	struct stat st;
+	int result = name ? stat(name, &st) : -1;
+	free(name);
+
+	if (result != 0)
+		return ERR_FILE_OPEN;
+
+	*size = (uint64_t)st.st_size;
+
+#ifdef __APPLE__
+	*mtime = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+	*mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+#endif
+
+	return ERR_SUCCESS;
+}
+
+int gds_rename(const wchar_t* from, const wchar_t* to)
+{
+#ifdef _WIN32
+	if (!MoveFileExW(from, to, MOVEFILE_REPLACE_EXISTING))
+		return ERR_FILE_WRITE;
+#else
+	char* name_from = narrow_name(from);
+	char* name_to = narrow_name(to);
+
+	int result = name_from && name_to ? rename(name_from, name_to) : -1;
+
+	free(name_from);
+	free(name_to);
+
+	if (result != 0)
+		return ERR_FILE_WRITE;
+#endif
+
+	return ERR_SUCCESS;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// A read-only view of a complete file mapped into the address space
+struct gds_mapped_file
+{
+	const uint8_t* data;
+	uint64_t size;
+
+#ifdef _WIN32
+	void* file_handle;
+	void* map_handle;
+#else
+	int fd;
+#endif
+};
+
+/*
+	Open a file with a wide character file name (_wfopen_s on Windows, fopen on other platforms)
+
+	@return: the file pointer or NULL on failure
+ */
+FILE* gds_fopen(const wchar_t* file, const wchar_t* mode);
+
+// How a mapping is read, passed on to the operating system to choose its read-ahead
+typedef enum {
+	MAPPED_SEQUENTIAL, // Front to back once, like a complete load
+	MAPPED_ON_DEMAND // Parts when they are needed, for as long as a lazily loaded database or a snapshot is open
+} gds_mapped_access;
+
+/*
+	Map the complete contents of a file read-only into memory. A sequential mapping reads far ahead
+	and drops pages behind; one read on demand gets the default read-ahead of the system.
+
+	@return: ERR_SUCCESS or ERR_FILE_OPEN if the file could not be opened or mapped
+ */
+int mapped_file_open(gds_mapped_file* self, const wchar_t* file, gds_mapped_access access);
+
+void mapped_file_close(gds_mapped_file* self);
+
+/*
+	Size in bytes and last modification time (nanoseconds since the epoch, in steps of 100 ns on
+	Windows) of a file
+
+	@return: ERR_SUCCESS or ERR_FILE_OPEN if the file does not exist
+ */
+int gds_file_info(const wchar_t* file, uint64_t* size, int64_t* mtime);
+
+/*
+	Rename @from to @to, replacing an existing file @to
+
+	@return: ERR_SUCCESS or ERR_FILE_WRITE
+ */
+int gds_rename(const wchar_t* from, const wchar_t* to);
@@ -4,10 +4,10 @@ gds_cell* find_cell(gds_db* db, const char* name)
 {
 	// Returns pointer cell with name @name in gds database @db or NULL if not found
 
-	for (gds_cell* cell : db->cell_list) {
-		if (strcmp(cell->name, name) == 0)
-			return cell;
-	}
+	auto it = db->cell_index.find(name);
 
-	return NULL;
-}
\ No newline at end of file
+	if (it == db->cell_index.end())
+		return NULL;
+
+	return it->second;
+}
@@ -0,0 +1,88 @@
+#include "FlatCache.h"
+
+gds_flat_cache::gds_flat_cache(size_t budget)
+{
+	this->budget = budget;
+	used = 0;
+
+	hits = 0;
+	misses = 0;
+	evictions = 0;
+}
+
+std::shared_ptr<const gds_flat_cell> flat_cache_find(gds_flat_cache* self, const gds_cell* cell, bool* flatten)
+{
+	std::lock_guard<std::mutex> lock(self->mutex);
+
+	auto it = self->cells.find(cell);
+
+	if (it != self->cells.end())
+	{
+		self->hits++;
+
+		// Move to the front of the LRU list
+		self->lru.splice(self->lru.begin(), self->lru, it->second);
+
+		*flatten = false;
+		return *it->second;
+	}
+
+	self->misses++;
+
+	// A cell placed once is not worth flattening, nor is a cell found too large before. A cell that
+	// was dropped is flattened again on its next miss.
+	int& count = self->seen[cell];
+
+	if (count >= 0)
+		count++;
+
+	*flatten = count >= 2;
+
+	return NULL;
+}
+
+void flat_cache_add(gds_flat_cache* self, std::shared_ptr<const gds_flat_cell> flat)
+{
+	std::lock_guard<std::mutex> lock(self->mutex);
+
+	// Another thread may have flattened the same cell at the same time
+	if (self->cells.count(flat->cell) != 0)
+		return;
+
+	while (!self->lru.empty() && self->used + flat->bytes > self->budget)
+	{
+		const gds_flat_cell* last = self->lru.back().get();
+
+		self->used -= last->bytes;
+		self->cells.erase(last->cell);
+		self->lru.pop_back();
+
+		self->evictions++;
+	}
+
+	self->lru.push_front(flat);
+	self->cells[flat->cell] = self->lru.begin();
+	self->used += flat->bytes;
+}
+
+void flat_cache_reject(gds_flat_cache* self, const gds_cell* cell)
+{
+	std::lock_guard<std::mutex> lock(self->mutex);
+
+	self->seen[cell] = -1;
+}
+
+size_t flat_cache_max_bytes(const gds_flat_cache* self)
+{
+	return self->budget / GDS_FLAT_CACHE_MAX_SHARE;
+}
+
+void gds_flat_cache_clear(gds_flat_cache* self)
+{
+	std::lock_guard<std::mutex> lock(self->mutex);
+
+	self->lru.clear();
+	self->cells.clear();
+	self->seen.clear();
+	self->used = 0;
+}
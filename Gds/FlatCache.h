@@ -0,0 +1,79 @@
+#pragma once
+
+#include "Polyset.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+// Default memory budget of a gds_flat_cache in bytes
+#define GDS_FLAT_CACHE_BUDGET ((size_t)256 << 20)
+
+// A single cell may take at most this part of the budget, larger cells are walked every time
+#define GDS_FLAT_CACHE_MAX_SHARE 16
+
+struct gds_cell;
+
+// All polygons of a cell and the cells below it, in the coordinates of the cell
+struct gds_flat_cell
+{
+	const gds_cell* cell;
+	gds_polyset polygons;
+	size_t bytes; // Memory taken by @polygons
+};
+
+/*
+	Cache of flattened cells for gds_extract_options::cache. A cell with references that is placed
+	more than once is flattened on its second placement, and later placements only transform the
+	cached polygons. The least recently used cells are dropped to stay within the budget.
+
+	The cells are looked up by address, so a cache belongs to one database: clear it before the
+	database is destructed. It may be shared by concurrent extractions of that database.
+ */
+class gds_flat_cache
+{
+public:
+	gds_flat_cache(size_t budget = GDS_FLAT_CACHE_BUDGET);
+
+	gds_flat_cache(const gds_flat_cache&) = delete;
+	gds_flat_cache& operator=(const gds_flat_cache&) = delete;
+
+	size_t budget; // Bytes the cached polygons may take
+	size_t used; // Bytes the cached polygons take now
+
+	// Placements served from the cache, placements of cells not cached (yet) and cells dropped
+	int64_t hits, misses, evictions;
+
+	std::mutex mutex; // Guards all members
+
+	// The cached cells, the most recently used first
+	std::list<std::shared_ptr<const gds_flat_cell>> lru;
+	std::unordered_map<const gds_cell*, std::list<std::shared_ptr<const gds_flat_cell>>::iterator> cells;
+
+	// Number of misses of every cell seen so far, or -1 for a cell too large to cache
+	std::unordered_map<const gds_cell*, int> seen;
+};
+
+/*
+	Look up @cell. On a miss @flatten tells whether the caller should flatten the cell and add it with
+	flat_cache_add. The entry stays valid while the returned pointer is held, also when it is dropped.
+
+	@return: the flattened cell or NULL on a miss
+ */
+std::shared_ptr<const gds_flat_cell> flat_cache_find(gds_flat_cache* self, const gds_cell* cell, bool* flatten);
+
+// Add a flattened cell, dropping the least recently used cells to make room
+void flat_cache_add(gds_flat_cache* self, std::shared_ptr<const gds_flat_cell> flat);
+
+// Remember that @cell is too large to cache
+void flat_cache_reject(gds_flat_cache* self, const gds_cell* cell);
+
+// Largest number of bytes a single flattened cell may take
+size_t flat_cache_max_bytes(const gds_flat_cache* self);
+
+// Drop all cells and forget the cells seen, the counters are kept
+void gds_flat_cache_clear(gds_flat_cache* self);
@@ -1,7 +1,11 @@
 #define _CRT_SECURE_NO_WARNINGS
 
 #include "Gds.h"
+#include "File.h"
+#include "Parallel.h"
 #include "Records.h"
+#include "Simd.h"
+#include "Snapshot.h"
 
 #define _USE_MATH_DEFINES
 #include <math.h>
@@ -10,8 +14,13 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <unordered_set>
+
 static
-double buffer_to_double(unsigned char* p)
+double buffer_to_double(const unsigned char* p)
 {
 	int i, sign, exp;
 	double fraction;
@@ -110,475 +119,913 @@ void double_to_buffer(double value, uint8_t* buf)
 	}
 }
 
-static
-int read_cells(gds_db* db, const wchar_t* file)
+enum ElemType { EL_NONE = 0, EL_BOUNDARY, EL_PATH, EL_SREF, EL_AREF, EL_TEXT, EL_NODE, EL_BOX };
+
+// We keep track of path warnings given to avoid repeat, also when cells are parsed on several threads
+typedef struct ReadWarnings
 {
-	FILE* fp;
-	_wfopen_s(&fp, file, L"rb");
-	if (!fp)
-		return ERR_FILE_OPEN;
+	std::atomic<bool> pathtype1_given;
+	std::atomic<bool> pathtype4_given;
+} ReadWarnings;
+
+// The byte range of one structure from its BGNSTR up to and including its ENDSTR record
+typedef struct CellRange
+{
+	uint64_t begin, end;
 
-	enum ElemType { EL_NONE = 0, EL_BOUNDARY, EL_PATH, EL_SREF, EL_AREF, EL_TEXT, EL_NODE, EL_BOX };
+	// Only recorded for the table of contents of a lazily loaded database
+	std::string name;
+	std::vector<std::string> snames;
+} CellRange;
 
-	// We keep track of path warnings given to avoid repeat
-	bool pathtype1_warning_given = false;
-	bool pathtype4_warning_given = false;
+// The state of the record parser carried from one record to the next
+typedef struct ReadState
+{
+	gds_db* db;
+
+	ReadWarnings* warnings;
+
+	// Cell filled by the next BGNSTR. When NULL a new cell is created and added to the database.
+	gds_cell* preset_cell;
 
 	// Pointers to the active cell (cell being read) and active element (element being read)
-	gds_cell* active_cell = NULL;
-	void* active_elem = NULL;
+	gds_cell* active_cell;
+	void* active_elem;
 
 	// Variable to track the type of element currently being read
-	enum ElemType curElem = EL_NONE;
+	enum ElemType curElem;
+
+	// A boundary read into the compact layout is collected here and in the coordinate pool of the
+	// cell starting at vertex @compact_offset
+	gds_boundary compact_boundary;
+	uint32_t compact_offset;
 
 	// Variable to track if the ENDLIB record was read
-	bool endlib = false; 
+	bool endlib;
 
-	uint64_t bytes_read = 0; // Number of bytes read from file
-	uint8_t header[4];
+	// Counts the records when statistics are collected, NULL otherwise
+	gds_load_stats* stats;
+} ReadState;
 
-	while (endlib == false && fread(header, 1, 4, fp) == 4)
-	{
-		uint16_t buf_size, record_len, record_type;
+static
+void read_state_init(ReadState* s, gds_db* db, ReadWarnings* warnings)
+{
+	s->db = db;
+	s->warnings = warnings;
+	s->preset_cell = NULL;
+	s->active_cell = NULL;
+	s->active_elem = NULL;
+	s->curElem = EL_NONE;
+	s->endlib = false;
+	s->stats = db->options.stats ? &db->stats : NULL;
+}
 
-		bytes_read += 4;
+static
+void compact_add_xy(ReadState* s, const unsigned char* buf, int count)
+{
+	// Decode the vertices of a boundary straight into the 32 bit coordinate pool of the cell
 
-		// First 2 bytes: record length; second 2 bytes record type and data type
-		record_len = (header[0] << 8) | header[1];
-		record_type = header[2] << 8 | header[3];
+	std::vector<int32_t>& coords = s->active_cell->compact->coords;
 
-		if (record_len < 4)
-			return ERR_RECORD_LENGTH;
+	size_t first = coords.size();
+	coords.resize(first + 2 * (size_t)count);
 
-		// The size of the payload
-		buf_size = record_len - 4;
+	int32_t* p = &coords[first];
 
-		// Read the data (buf_size == 0 means a zero payload record)
-		unsigned char* buf = NULL;
-		if (buf_size > 0)
+	for (int i = 0; i < 2 * count; i++)
+		p[i] = buf[4 * i] << 24 | buf[4 * i + 1] << 16 | buf[4 * i + 2] << 8 | buf[4 * i + 3];
+
+	s->compact_offset = (uint32_t)(first / 2);
+	s->compact_boundary.npairs = count;
+}
+
+static
+void compact_end_boundary(ReadState* s)
+{
+	// Add the boundary collected in the read state to the compact arrays of the cell
+
+	gds_compact_boundaries* c = s->active_cell->compact;
+	const gds_boundary* b = &s->compact_boundary;
+
+	gds_bbox32 box = {INT32_MAX, INT32_MAX, INT32_MIN, INT32_MIN};
+
+	if (b->npairs > 0)
+		simd_kernels()->fit_points32(&box, &c->coords[2 * (size_t)s->compact_offset], b->npairs);
+
+	c->offset.push_back(s->compact_offset);
+	c->count.push_back((uint32_t)b->npairs);
+	c->layer.push_back(b->layer);
+	c->datatype.push_back(b->datatype);
+	c->bbox.push_back(box);
+}
+
+static
+int parse_record(ReadState* s, uint16_t record_type, const unsigned char* buf, uint16_t buf_size)
+{
+	// Handle a single GDS record. The payload @buf of @buf_size bytes is only read during the call
+	// so it may point straight into a file mapping.
+
+	if (s->stats != NULL)
+	{
+		s->stats->records[record_type >> 8]++;
+		s->stats->bytes[record_type >> 8] += buf_size + 4;
+	}
+
+	switch (record_type)
+	{
+		case HEADER:
 		{
-			buf = (unsigned char*) malloc(buf_size * sizeof(*buf));
-			bytes_read += fread(buf, 1, buf_size, fp);
+			s->db->version = buf[0] << 8 | buf[1];
+			break;
 		}
-
-		// Handle the different GDS records
-		switch (record_type)
+		case BGNLIB:
+			break;
+		case ENDLIB:
 		{
-			case HEADER:
-			{
-				db->version = buf[0] << 8 | buf[1];
-				break;
-			}
-			case BGNLIB:
-				break;
-			case ENDLIB:
+			s->endlib = true;
+			break;
+		}
+		case LIBNAME:
+			break;
+		case BGNSTR:
+		{
+			// Needs to have a prior ENDSTR (or the first BGNSTR in the file)
+			if (s->active_cell != NULL)
+				return ERR_ILLEGAL_BGNSTR;
+
+			if (s->preset_cell != NULL)
 			{
-				endlib = true;
-				break;
-			}
-			case LIBNAME:
-				break;
-			case BGNSTR:
+				// The cell was already registered by the parallel or lazy loader
+				s->active_cell = s->preset_cell;
+				s->preset_cell = NULL;
+			} else
 			{
-				// Needs to have a prior ENDSTR (or the first BGNSTR in the file)
-				if (active_cell != NULL)
-					return ERR_ILLEGAL_BGNSTR;
-
-				active_cell = new gds_cell;
+				s->active_cell = new gds_cell;
 
 				// Ensure the pointer to the cell is registered already so no memory leaks when
 				// an error is found
-				db->cell_list.push_back(active_cell);
-
-				break;
+				s->db->cell_list.push_back(s->active_cell);
 			}
-			case ENDSTR:
-			{
-				// Needs to have a prior BGNSTR
-				if (active_cell == NULL)
-					return ERR_ILLEGAL_ENDSTR;
 
-				active_cell = NULL;
+			if (s->db->options.compact && s->active_cell->compact == NULL)
+				s->active_cell->compact = new gds_compact_boundaries;
 
-				break;
-			}
-			case UNITS:
+			break;
+		}
+		case ENDSTR:
+		{
+			// Needs to have a prior BGNSTR
+			if (s->active_cell == NULL)
+				return ERR_ILLEGAL_ENDSTR;
+
+			// The pools of a compact cell do not grow any more
+			gds_compact_boundaries* c = s->active_cell->compact;
+			if (c != NULL)
 			{
-				db->dbunit_in_uu = buffer_to_double(buf);
-				db->dbunit_in_meter = buffer_to_double(buf + 8);
+				c->coords.shrink_to_fit();
+				c->offset.shrink_to_fit();
+				c->count.shrink_to_fit();
+				c->layer.shrink_to_fit();
+				c->datatype.shrink_to_fit();
+				c->bbox.shrink_to_fit();
+			}
 
-				if (db->dbunit_in_uu <= 0. || db->dbunit_in_meter <= 0)
-					return ERR_DBU;
+			s->active_cell = NULL;
 
-				break;
-			}
-			case STRNAME:
-			{
-				if (active_cell == NULL || buf_size > GDS_MAX_CELL_NAME)
-					return ERR_ILLEGAL_STRNAME;
+			break;
+		}
+		case UNITS:
+		{
+			s->db->dbunit_in_uu = buffer_to_double(buf);
+			s->db->dbunit_in_meter = buffer_to_double(buf + 8);
 
-				strncpy(active_cell->name, (char*) buf, buf_size);
-				active_cell->name[buf_size] = '\0';
+			if (s->db->dbunit_in_uu <= 0. || s->db->dbunit_in_meter <= 0)
+				return ERR_DBU;
 
-				break;
-			}
-			case BOUNDARY:
-			{
-				if (active_elem != NULL || active_cell == NULL)
-					return ERR_ILLEGAL_BOUNDARY;
+			break;
+		}
+		case STRNAME:
+		{
+			if (s->active_cell == NULL || buf_size > GDS_MAX_CELL_NAME)
+				return ERR_ILLEGAL_STRNAME;
 
-				active_elem = calloc(1, sizeof(gds_boundary));
+			strncpy(s->active_cell->name, (const char*) buf, buf_size);
+			s->active_cell->name[buf_size] = '\0';
 
-				active_cell->boundaries->push_back((gds_boundary*)active_elem);
+			break;
+		}
+		case BOUNDARY:
+		{
+			if (s->active_elem != NULL || s->active_cell == NULL)
+				return ERR_ILLEGAL_BOUNDARY;
 
-				curElem = EL_BOUNDARY;
+			if (s->active_cell->compact != NULL)
+			{
+				// Collected in the read state and added to the compact arrays at ENDEL
+				memset(&s->compact_boundary, 0, sizeof(s->compact_boundary));
+				s->compact_offset = 0;
+				s->active_elem = &s->compact_boundary;
+			} else
+			{
+				s->active_elem = arena_alloc(&s->active_cell->arena, sizeof(gds_boundary));
+				if (s->active_elem == NULL)
+					return ERR_OUT_OF_MEMORY;
 
-				break;
+				s->active_cell->boundaries.push_back((gds_boundary*)s->active_elem);
 			}
-			case PATH:
-			{
-				if (active_elem != NULL || active_cell == NULL)
-					return ERR_ILLEGAL_PATH;
 
-				active_elem = calloc(1, sizeof(gds_path));
+			s->curElem = EL_BOUNDARY;
 
-				active_cell->paths->push_back((gds_path*)active_elem);
+			break;
+		}
+		case PATH:
+		{
+			if (s->active_elem != NULL || s->active_cell == NULL)
+				return ERR_ILLEGAL_PATH;
 
-				curElem = EL_PATH;
+			s->active_elem = arena_alloc(&s->active_cell->arena, sizeof(gds_path));
+			if (s->active_elem == NULL)
+				return ERR_OUT_OF_MEMORY;
 
-				break;
-			}
-			case SREF:
-			{
-				if (active_elem != NULL || active_cell == NULL)
-					return ERR_ILLEGAL_SREF;
+			s->active_cell->paths.push_back((gds_path*)s->active_elem);
 
-				active_elem = calloc(1, sizeof(gds_sref));
+			s->curElem = EL_PATH;
 
-				active_cell->srefs->push_back((gds_sref*)active_elem);
+			break;
+		}
+		case SREF:
+		{
+			if (s->active_elem != NULL || s->active_cell == NULL)
+				return ERR_ILLEGAL_SREF;
 
-				gds_sref* tmp = (gds_sref*)active_elem;
-				tmp->mag = 1.0f;
+			s->active_elem = arena_alloc(&s->active_cell->arena, sizeof(gds_sref));
+			if (s->active_elem == NULL)
+				return ERR_OUT_OF_MEMORY;
 
-				curElem = EL_SREF;
+			s->active_cell->srefs.push_back((gds_sref*)s->active_elem);
 
-				break;
-			}
-			case AREF:
-			{
-				if (active_elem != NULL || active_cell == NULL)
-					return ERR_ILLEGAL_AREF;
+			gds_sref* tmp = (gds_sref*)s->active_elem;
+			tmp->mag = 1.0f;
 
-				active_elem = calloc(1, sizeof(gds_aref));
+			s->curElem = EL_SREF;
 
-				active_cell->arefs->push_back((gds_aref*)active_elem);
+			break;
+		}
+		case AREF:
+		{
+			if (s->active_elem != NULL || s->active_cell == NULL)
+				return ERR_ILLEGAL_AREF;
 
-				gds_aref* tmp = (gds_aref*)active_elem;
-				tmp->mag = 1.0f;
+			s->active_elem = arena_alloc(&s->active_cell->arena, sizeof(gds_aref));
+			if (s->active_elem == NULL)
+				return ERR_OUT_OF_MEMORY;
 
-				curElem = EL_AREF;
+			s->active_cell->arefs.push_back((gds_aref*)s->active_elem);
 
-				break;
-			}
-			case TEXT:
-				curElem = EL_TEXT;
-				break;
-			case NODE:
-				curElem = EL_NODE;
-				break;
-			case BOX:
-				curElem = EL_BOX;
-				break;
-			case ENDEL:
-			{
-				if (active_cell == NULL)
-					return ERR_ILLEGAL_ENDEL;
+			gds_aref* tmp = (gds_aref*)s->active_elem;
+			tmp->mag = 1.0f;
 
-				switch (curElem)
+			s->curElem = EL_AREF;
+
+			break;
+		}
+		case TEXT:
+			s->curElem = EL_TEXT;
+			break;
+		case NODE:
+			s->curElem = EL_NODE;
+			break;
+		case BOX:
+			s->curElem = EL_BOX;
+			break;
+		case ENDEL:
+		{
+			if (s->active_cell == NULL)
+				return ERR_ILLEGAL_ENDEL;
+
+			switch (s->curElem)
+			{
+				case EL_BOUNDARY:
 				{
-					case EL_BOUNDARY:
+					if (s->active_cell->compact != NULL)
 					{
-						// Calculate the boundary box
-						gds_boundary* b = (gds_boundary*)active_elem;
-						bbox_init(&b->bbox);
-						bbox_fit_points(&b->bbox, b->pairs, b->npairs);
-
+						compact_end_boundary(s);
 						break;
 					}
-					case EL_PATH:
-					{
-						// For a path element we calculate the associated expanded polygon and its
-						// boundary box
 
-						gds_path* p = (gds_path*)active_elem;
+					// Calculate the boundary box
+					gds_boundary* b = (gds_boundary*)s->active_elem;
+					bbox_init(&b->bbox);
+					bbox_fit_points(&b->bbox, b->pairs, b->npairs);
 
-						p->nepairs = 2 * p->npairs + 1;
-						p->epairs = (gds_pair*) malloc(p->nepairs * sizeof(gds_pair));
+					break;
+				}
+				case EL_PATH:
+				{
+					// For a path element we calculate the associated expanded polygon and its
+					// boundary box
 
-						int result = gds_expand_path(p->epairs, p->pairs, p->npairs, p->width,
-							p->pathtype);
+					gds_path* p = (gds_path*)s->active_elem;
 
-						if (result == EXIT_FAILURE)
-							return ERR_PATH_EXPANSION;
+					p->nepairs = 2 * p->npairs + 1;
+					p->epairs =
+						(gds_pair*) arena_alloc(&s->active_cell->arena, p->nepairs * sizeof(gds_pair));
 
-						bbox_init(&p->bbox);
-						bbox_fit_points(&p->bbox, p->epairs, p->nepairs);
+					if (p->epairs == NULL)
+						return ERR_OUT_OF_MEMORY;
 
-						break;
-					}
-				}
+					int result = gds_expand_path(p->epairs, p->pairs, p->npairs, p->width,
+						p->pathtype);
 
-				active_elem = NULL;
-				curElem = EL_NONE;
+					if (result == EXIT_FAILURE)
+						return ERR_PATH_EXPANSION;
 
-				break;
+					bbox_init(&p->bbox);
+					bbox_fit_points(&p->bbox, p->epairs, p->nepairs);
+
+					break;
+				}
 			}
-			case SNAME: // SREF, AREF
-			{
-				if (active_cell == NULL || buf_size > GDS_MAX_CELL_NAME)
-					return ERR_ILLEGAL_STRNAME;
 
-				switch (curElem)
+			s->active_elem = NULL;
+			s->curElem = EL_NONE;
+
+			break;
+		}
+		case SNAME: // SREF, AREF
+		{
+			if (s->active_cell == NULL || buf_size > GDS_MAX_CELL_NAME)
+				return ERR_ILLEGAL_STRNAME;
+
+			switch (s->curElem)
+			{
+				case EL_SREF:
 				{
-					case EL_SREF:
-					{
-						strncpy(((gds_sref*)active_elem)->sname, (char*) buf, buf_size);
-						((gds_sref*)active_elem)->sname[buf_size] = '\0';
-						break;
-					}
-					case EL_AREF:
-					{
-						strncpy(((gds_aref*)active_elem)->sname, (char*) buf, buf_size);
-						((gds_aref*)active_elem)->sname[buf_size] = '\0';
-						break;
-					}
-					default:
-						return ERR_ILLEGAL_SNAME;
+					strncpy(((gds_sref*)s->active_elem)->sname, (const char*) buf, buf_size);
+					((gds_sref*)s->active_elem)->sname[buf_size] = '\0';
+					break;
 				}
-
-				break;
+				case EL_AREF:
+				{
+					strncpy(((gds_aref*)s->active_elem)->sname, (const char*) buf, buf_size);
+					((gds_aref*)s->active_elem)->sname[buf_size] = '\0';
+					break;
+				}
+				default:
+					return ERR_ILLEGAL_SNAME;
 			}
-			case COLROW: // AREF
-			{
-				if (curElem != EL_AREF)
-					return ERR_ILLEGAL_COLROW;
 
-				((gds_aref*)active_elem)->ncols = buf[0] << 8 | buf[1];
-				((gds_aref*)active_elem)->nrows = buf[2] << 8 | buf[3];
+			break;
+		}
+		case COLROW: // AREF
+		{
+			if (s->curElem != EL_AREF)
+				return ERR_ILLEGAL_COLROW;
 
-				break;
-			}
-			case PATHTYPE:
-			{
-				if (curElem != EL_PATH)
-					return ERR_ILLEGAL_PATHTYPE;
+			((gds_aref*)s->active_elem)->ncols = buf[0] << 8 | buf[1];
+			((gds_aref*)s->active_elem)->nrows = buf[2] << 8 | buf[3];
 
-				gds_path* path = (gds_path*)active_elem;
+			break;
+		}
+		case PATHTYPE:
+		{
+			if (s->curElem != EL_PATH)
+				return ERR_ILLEGAL_PATHTYPE;
 
-				path->pathtype = buf[0] << 8 | buf[1];
+			gds_path* path = (gds_path*)s->active_elem;
 
-				// Only path types 0 and 2 are supported. Type 1 and 4 are converted to type 2 with
-				// a warning.
+			path->pathtype = buf[0] << 8 | buf[1];
 
-				if (!pathtype1_warning_given && path->pathtype == 1)
-				{
+			// Only path types 0 and 2 are supported. Type 1 and 4 are converted to type 2 with
+			// a warning (given once).
+
+			if (path->pathtype == 1)
+			{
+				if (!s->warnings->pathtype1_given.exchange(true))
 					printf("WARNING: path type 1 (round ended) will be converted to type 2\n");
-					path->pathtype = 2;
-					pathtype1_warning_given = true;
-				}
 
-				if (!pathtype4_warning_given && ((gds_path*)active_elem)->pathtype == 4)
-				{
+				path->pathtype = 2;
+			}
+
+			if (path->pathtype == 4)
+			{
+				if (!s->warnings->pathtype4_given.exchange(true))
 					printf("WARNING: path type 4 (var length) will be converted to type 2\n");
-					path->pathtype = 2;
-					pathtype4_warning_given = true;
-				}
 
-				break;
+				path->pathtype = 2;
 			}
-			case STRANS: // SREF, AREF, TEXT
+
+			break;
+		}
+		case STRANS: // SREF, AREF, TEXT
+		{
+			switch (s->curElem)
 			{
-				switch (curElem)
-				{
-					case EL_SREF:
-						((gds_sref*)active_elem)->strans = buf[0] << 8 | buf[1];
-						break;
-					case EL_AREF:
-						((gds_aref*)active_elem)->strans = buf[0] << 8 | buf[1];
-						break;
-				}
-				break;
+				case EL_SREF:
+					((gds_sref*)s->active_elem)->strans = buf[0] << 8 | buf[1];
+					break;
+				case EL_AREF:
+					((gds_aref*)s->active_elem)->strans = buf[0] << 8 | buf[1];
+					break;
 			}
-			case ANGLE: // SREF, AREF, TEXT
+			break;
+		}
+		case ANGLE: // SREF, AREF, TEXT
+		{
+			switch (s->curElem)
 			{
-				switch (curElem)
+				case EL_SREF:
 				{
-					case EL_SREF:
-					{
-						((gds_sref*)active_elem)->angle = (float)(M_PI * buffer_to_double(buf) / 180.0);
-						break;
-					}
-					case EL_AREF:
-					{
-						((gds_aref*)active_elem)->angle = (float)(M_PI * buffer_to_double(buf) / 180.0);
-						break;
-					}
+					((gds_sref*)s->active_elem)->angle = M_PI * buffer_to_double(buf) / 180.0;
+					break;
 				}
+				case EL_AREF:
+				{
+					((gds_aref*)s->active_elem)->angle = M_PI * buffer_to_double(buf) / 180.0;
+					break;
+				}
+			}
+			break;
+		}
+		case MAG: // SREF, AREF, TEXT
+		{
+			switch (s->curElem)
+			{
+				case EL_SREF:
+					((gds_sref*)s->active_elem)->mag = (float)buffer_to_double(buf);
+					break;
+				case EL_AREF:
+					((gds_aref*)s->active_elem)->mag = (float)buffer_to_double(buf);
+					break;
+			}
+			break;
+		}
+		case XY:
+		{
+			// Number of pairs
+			int count = buf_size / 8;
+
+			if (s->curElem == EL_BOUNDARY && s->active_cell->compact != NULL)
+			{
+				compact_add_xy(s, buf, count);
 				break;
 			}
-			case MAG: // SREF, AREF, TEXT
+
+			switch (s->curElem)
 			{
-				switch (curElem)
+				case EL_BOUNDARY:
 				{
-					case EL_SREF:
-						((gds_sref*)active_elem)->mag = (float)buffer_to_double(buf);
-						break;
-					case EL_AREF:
-						((gds_aref*)active_elem)->mag = (float)buffer_to_double(buf);
-						break;
+					((gds_boundary*)s->active_elem)->pairs =
+						(gds_pair*) arena_alloc(&s->active_cell->arena, count * sizeof(gds_pair));
+
+					if (((gds_boundary*)s->active_elem)->pairs == NULL)
+						return ERR_OUT_OF_MEMORY;
+
+					((gds_boundary*)s->active_elem)->npairs = count;
+					break;
 				}
-				break;
+				case EL_PATH:
+				{
+					((gds_path*)s->active_elem)->pairs =
+						(gds_pair*) arena_alloc(&s->active_cell->arena, count * sizeof(gds_pair));
+
+					if (((gds_path*)s->active_elem)->pairs == NULL)
+						return ERR_OUT_OF_MEMORY;
+
+					((gds_path*)s->active_elem)->npairs = count;
+					break;
+				}
+				case EL_SREF:
+					assert(count == 1);
+					break;
+				case EL_AREF:
+					assert(count == 3);
+					break;
 			}
-			case XY:
+
+			for (int n = 0; n < count; n++)
 			{
-				// Number of pairs
-				int count = buf_size / 8;
+				int i = 8 * n;
 
-				switch (curElem)
+				int x = buf[i] << 24 | buf[i + 1] << 16 | buf[i + 2] << 8 | buf[i + 3];
+				int y = buf[i + 4] << 24 | buf[i + 5] << 16 | buf[i + 6] << 8 | buf[i + 7];
+
+				switch (s->curElem)
 				{
 					case EL_BOUNDARY:
-					{
-						((gds_boundary*)active_elem)->pairs = (gds_pair*) malloc(count * sizeof(gds_pair));
-						((gds_boundary*)active_elem)->npairs = count;
+						((gds_boundary*)s->active_elem)->pairs[n] = {x, y};
 						break;
-					}
 					case EL_PATH:
-					{
-						((gds_path*)active_elem)->pairs = (gds_pair*) malloc(count * sizeof(gds_pair));
-						((gds_path*)active_elem)->npairs = count;
+						((gds_path*)s->active_elem)->pairs[n] = {x, y};
 						break;
-					}
 					case EL_SREF:
-						assert(count == 1);
+						((gds_sref*)s->active_elem)->origin = {x, y};
 						break;
 					case EL_AREF:
-						assert(count == 3);
+						((gds_aref*)s->active_elem)->vectors[n] = {x, y};
 						break;
 				}
+			}
+			break;
+		}
+		case LAYER: // BOUNDARY, PATH, TEXT, NODE, BOX
+		{
+			switch (s->curElem)
+			{
+				case EL_BOUNDARY:
+					((gds_boundary*)s->active_elem)->layer = buf[0] << 8 | buf[1];
+					break;
+				case EL_PATH:
+					((gds_path*)s->active_elem)->layer = buf[0] << 8 | buf[1];
+					break;
+			}
+			break;
+		}
+		case WIDTH: // PATH, TEXT
+			if (s->curElem == EL_PATH)
+				((gds_path*)s->active_elem)->width = buf[0] << 24 | buf[1] << 16 | buf[2] << 8 | buf[3];
+			break;
+		case DATATYPE: // BOUNDARY, PATH
+		{
+			switch (s->curElem)
+			{
+				case EL_BOUNDARY:
+					((gds_boundary*)s->active_elem)->datatype = buf[0] << 8 | buf[1];
+					break;
+				case EL_PATH:
+					((gds_path*)s->active_elem)->datatype = buf[0] << 8 | buf[1];
+					break;
+			}
+			break;
+		}
+		case TEXTNODE:
+			break;
+		case TEXTTYPE:
+			break;
+		case PRESENTATION:
+			break;
+		case STRING:
+			break;
+		case REFLIBS:
+			break;
+		case FONTS:
+			break;
+		case ATTRTABLE:
+			break;
+		case ELFLAGS:
+			break;
+		case PROPATTR:
+			break;
+		case PROPVALUE:
+			break;
+		case BOXTYPE:
+			break;
+		case PLEX:
+			break;
+		case BGNEXTN:
+			break;
+		case ENDEXTN:
+			break;
+		case FORMAT:
+			break;
+		default:
+			break;
+	}
 
-				for (int n = 0; n < count; n++)
-				{
-					int i = 8 * n;
+	return ERR_SUCCESS;
+}
 
-					int x = buf[i] << 24 | buf[i + 1] << 16 | buf[i + 2] << 8 | buf[i + 3];
-					int y = buf[i + 4] << 24 | buf[i + 5] << 16 | buf[i + 6] << 8 | buf[i + 7];
+static
+int read_cells_stdio(ReadState* s, const wchar_t* file)
+{
+	// Read the records one by one from a stdio stream (fallback when the file can not be mapped)
+
+	FILE* fp = gds_fopen(file, L"rb");
+	if (!fp)
+		return ERR_FILE_OPEN;
+
+	// A record length is 16 bits so one buffer of 64 kB fits every payload
+	unsigned char* buf = (unsigned char*)malloc(UINT16_MAX);
+	uint8_t header[4];
+
+	int result = ERR_SUCCESS;
+
+	while (result == ERR_SUCCESS && s->endlib == false && fread(header, 1, 4, fp) == 4)
+	{
+		uint16_t buf_size, record_len, record_type;
+
+		// First 2 bytes: record length; second 2 bytes record type and data type
+		record_len = (header[0] << 8) | header[1];
+		record_type = header[2] << 8 | header[3];
+
+		if (record_len < 4)
+		{
+			result = ERR_RECORD_LENGTH;
+			break;
+		}
+
+		// The size of the payload (buf_size == 0 means a zero payload record)
+		buf_size = record_len - 4;
+
+		if (buf_size > 0 && fread(buf, 1, buf_size, fp) != buf_size)
+		{
+			result = ERR_RECORD_LENGTH;
+			break;
+		}
+
+		result = parse_record(s, record_type, buf, buf_size);
+	}
+
+	free(buf);
+	fclose(fp);
+
+	return result;
+}
+
+static
+int read_cells_mapped(ReadState* s, const uint8_t* data, uint64_t size)
+{
+	// Walk the records in place in a memory mapped file
+
+	uint64_t pos = 0;
+
+	while (s->endlib == false && pos + 4 <= size)
+	{
+		const uint8_t* header = data + pos;
+
+		uint16_t record_len = (header[0] << 8) | header[1];
+		uint16_t record_type = header[2] << 8 | header[3];
+
+		if (record_len < 4 || pos + record_len > size)
+			return ERR_RECORD_LENGTH;
+
+		int result = parse_record(s, record_type, header + 4, record_len - 4);
+		if (result != ERR_SUCCESS)
+			return result;
+
+		pos += record_len;
+	}
+
+	return ERR_SUCCESS;
+}
+
+static
+int scan_cells(ReadState* s, const uint8_t* data, uint64_t size, std::vector<CellRange>* ranges, bool toc)
+{
+	// First phase of the parallel and lazy loaders: only look at the record headers to find the byte
+	// range of every structure. Library records outside the structures are parsed right away. With
+	// @toc also the structure name and the referenced names are recorded.
+
+	uint64_t pos = 0;
+	bool in_cell = false;
+
+	CellRange range;
+
+	while (s->endlib == false && pos + 4 <= size)
+	{
+		const uint8_t* header = data + pos;
+
+		uint16_t record_len = (header[0] << 8) | header[1];
+		uint16_t record_type = header[2] << 8 | header[3];
+
+		if (record_len < 4 || pos + record_len > size)
+			return ERR_RECORD_LENGTH;
+
+		switch (record_type)
+		{
+			case BGNSTR:
+			{
+				if (in_cell)
+					return ERR_ILLEGAL_BGNSTR;
+
+				in_cell = true;
+				range.begin = pos;
 
-					switch (curElem)
-					{
-						case EL_BOUNDARY:
-							((gds_boundary*)active_elem)->pairs[n] = {x, y};
-							break;
-						case EL_PATH:
-							((gds_path*)active_elem)->pairs[n] = {x, y};
-							break;
-						case EL_SREF:
-							((gds_sref*)active_elem)->origin = {x, y};
-							break;
-						case EL_AREF:
-							((gds_aref*)active_elem)->vectors[n] = {x, y};
-							break;
-					}
-				}
 				break;
 			}
-			case LAYER: // BOUNDARY, PATH, TEXT, NODE, BOX
+			case ENDSTR:
 			{
-				switch (curElem)
+				if (!in_cell)
+					return ERR_ILLEGAL_ENDSTR;
+
+				in_cell = false;
+				range.end = pos + record_len;
+
+				if (toc)
 				{
-					case EL_BOUNDARY:
-						((gds_boundary*)active_elem)->layer = buf[0] << 8 | buf[1];
-						break;
-					case EL_PATH:
-						((gds_path*)active_elem)->layer = buf[0] << 8 | buf[1];
-						break;
+					std::sort(range.snames.begin(), range.snames.end());
+					range.snames.erase(std::unique(range.snames.begin(), range.snames.end()),
+						range.snames.end());
 				}
+
+				ranges->push_back(std::move(range));
+				range = CellRange();
+
 				break;
 			}
-			case WIDTH: // PATH, TEXT
-				if (curElem == EL_PATH)
-					((gds_path*)active_elem)->width = buf[0] << 24 | buf[1] << 16 | buf[2] << 8 | buf[3];
-				break;
-			case DATATYPE:
-				break;
-			case TEXTNODE:
-				break;
-			case TEXTTYPE:
-				break;
-			case PRESENTATION:
-				break;
-			case STRING:
-				break;
-			case REFLIBS:
-				break;
-			case FONTS:
-				break;
-			case ATTRTABLE:
-				break;
-			case ELFLAGS:
-				break;
-			case PROPATTR:
-				break;
-			case PROPVALUE:
-				break;
-			case BOXTYPE:
-				break;
-			case PLEX:
-				break;
-			case BGNEXTN:
-				break;
-			case ENDEXTN:
-				break;
-			case FORMAT:
+			case STRNAME:
+			case SNAME:
+			{
+				if (!in_cell)
+					return record_type == SNAME ? ERR_ILLEGAL_SNAME : ERR_ILLEGAL_STRNAME;
+
+				if (toc)
+				{
+					if (record_len - 4 > GDS_MAX_CELL_NAME)
+						return ERR_ILLEGAL_STRNAME;
+
+					// The payload may be padded with a zero byte
+					const char* name = (const char*)header + 4;
+					std::string str(name, strnlen(name, record_len - 4));
+
+					if (record_type == STRNAME)
+						range.name = str;
+					else
+						range.snames.push_back(str);
+				}
+
 				break;
+			}
 			default:
+			{
+				if (!in_cell)
+				{
+					int result = parse_record(s, record_type, header + 4, record_len - 4);
+					if (result != ERR_SUCCESS)
+						return result;
+				}
+
 				break;
+			}
 		}
 
-		free(buf);
+		pos += record_len;
 	}
 
-	fclose(fp);
+	// A structure without ENDSTR at the end of the file is kept like the serial reader does
+	if (in_cell)
+	{
+		range.end = pos;
+		ranges->push_back(std::move(range));
+	}
 
-	//
-	// Make sure all referenced cell names exist and assign cell pointers
-	//
+	return ERR_SUCCESS;
+}
+
+static
+int read_cells_parallel(ReadState* s, const uint8_t* data, uint64_t size, int nthreads)
+{
+	// Two phase loader: find the structure ranges and then parse every structure into its own
+	// gds_cell on a pool of threads
+
+	std::vector<CellRange> ranges;
+
+	int result = scan_cells(s, data, size, &ranges, false);
+	if (result != ERR_SUCCESS)
+		return result;
+
+	// All cells are registered up front in file order so no memory leaks when an error is found
+	gds_db* db = s->db;
+	size_t first = db->cell_list.size();
+
+	for (size_t i = 0; i < ranges.size(); i++)
+		db->cell_list.push_back(new gds_cell);
+
+	std::vector<int> results(ranges.size(), ERR_SUCCESS);
+
+	// The records of each structure are counted apart and added to the database statistics after
+	std::mutex stats_mutex;
+
+	parallel_for((int)ranges.size(), nthreads, [&](int i) {
+		ReadState cs;
+		read_state_init(&cs, db, s->warnings);
+		cs.preset_cell = db->cell_list[first + i];
+
+		gds_load_stats stats;
+		if (s->stats != NULL)
+			cs.stats = &stats;
+
+		results[i] = read_cells_mapped(&cs, data + ranges[i].begin, ranges[i].end - ranges[i].begin);
+
+		if (s->stats != NULL)
+		{
+			std::lock_guard<std::mutex> lock(stats_mutex);
+			load_stats_add(s->stats, &stats);
+		}
+	});
+
+	// Report the first error in file order
+	for (int r : results)
+	{
+		if (r != ERR_SUCCESS)
+			return r;
+	}
+
+	return ERR_SUCCESS;
+}
+
+static
+void index_cells(gds_db* db)
+{
+	// Build the name index used by find_cell. Like a linear search the first cell with a given
+	// name wins when names are duplicated.
+
+	db->cell_index.clear();
+	db->cell_index.reserve(db->cell_list.size());
 
 	for (gds_cell* cell : db->cell_list)
+		db->cell_index.emplace(cell->name, cell);
+}
+
+static
+int link_cell(gds_db* db, gds_cell* cell)
+{
+	// Make sure all cell names referenced by @cell exist and assign cell pointers
+
+	for (gds_sref* sref : cell->srefs)
 	{
-		//gds_cell* cell = db->cell_list[i];
+		// Continue if this reference already has the cell pointer determined
+		if (sref->cell != NULL)
+			continue;
 
-		for (gds_sref* sref : *cell->srefs)
-		{
-			// Continue if this reference already has the cell pointer determined
-			if (sref->cell != NULL)
-				continue;
+		sref->cell = find_cell(db, sref->sname);
 
-			sref->cell = (gds_cell*)find_cell(db, sref->sname);
+		if (sref->cell == NULL)
+			return ERR_CELL_NAME_NOT_FOUND;
+	}
 
-			if (sref->cell ==  NULL)
-				return ERR_CELL_NAME_NOT_FOUND;
-		}
+	for (gds_aref* aref : cell->arefs)
+	{
+		// Continue if this reference already has the cell pointer determined
+		if (aref->cell)
+			continue;
 
-		for (gds_aref* aref : *cell->arefs)
-		{
+		aref->cell = find_cell(db, aref->sname);
 
-			// Continue if this reference already has the cell pointer determined
-			if (aref->cell)
-				continue;
+		if (!aref->cell)
+			return ERR_CELL_NAME_NOT_FOUND;
+	}
+
+	return ERR_SUCCESS;
+}
+
+static
+int link_cells(gds_db* db, int nthreads)
+{
+	index_cells(db);
+
+	// The index is only read from here on so the cells can be linked concurrently
+	std::vector<int> results(db->cell_list.size(), ERR_SUCCESS);
 
-			aref->cell = (gds_cell*)find_cell(db, aref->sname);
+	parallel_for((int)db->cell_list.size(), nthreads, [&](int i) {
+		results[i] = link_cell(db, db->cell_list[i]);
+	});
 
-			if (!aref->cell)
+	for (int r : results)
+	{
+		if (r != ERR_SUCCESS)
+			return r;
+	}
+
+	return ERR_SUCCESS;
+}
+
+static
+int read_toc(ReadState* s, const uint8_t* data, uint64_t size)
+{
+	// First pass of the lazy loader: register every cell with its table of contents entry but do
+	// not parse its elements
+
+	std::vector<CellRange> ranges;
+
+	int result = scan_cells(s, data, size, &ranges, true);
+	if (result != ERR_SUCCESS)
+		return result;
+
+	gds_db* db = s->db;
+
+	for (CellRange& range : ranges)
+	{
+		gds_cell* cell = new gds_cell;
+		db->cell_list.push_back(cell);
+
+		strcpy(cell->name, range.name.c_str());
+
+		cell->loaded = false;
+		cell->toc = new gds_toc_entry;
+		cell->toc->offset = range.begin;
+		cell->toc->length = range.end - range.begin;
+		cell->toc->snames = std::move(range.snames);
+	}
+
+	index_cells(db);
+
+	// Referenced cells are checked up front as the eager loader does when linking
+	for (gds_cell* cell : db->cell_list)
+	{
+		for (const std::string& sname : cell->toc->snames)
+		{
+			if (find_cell(db, sname.c_str()) == NULL)
 				return ERR_CELL_NAME_NOT_FOUND;
 		}
 	}
@@ -586,16 +1033,184 @@ int read_cells(gds_db* db, const wchar_t* file)
 	return ERR_SUCCESS;
 }
 
+static
+int load_cell(gds_db* db, gds_cell* cell, ReadWarnings* warnings)
+{
+	// Parse the elements of a cell registered by read_toc
+
+	ReadState s;
+	read_state_init(&s, db, warnings);
+	s.preset_cell = cell;
+
+	// Also on failure the cell counts as loaded so its elements are never added twice
+	cell->loaded = true;
+
+	auto start = std::chrono::steady_clock::now();
+
+	int result = read_cells_mapped(&s, db->map.data + cell->toc->offset, cell->toc->length);
+
+	if (s.stats != NULL)
+	{
+		s.stats->cells++;
+		s.stats->allocations += cell->arena.blocks.size();
+		s.stats->parse_seconds += stats_seconds_since(start);
+	}
+
+	if (result != ERR_SUCCESS)
+		return result;
+
+	return link_cell(db, cell);
+}
 
-gds_db::gds_db(const wchar_t* file, int* error)
+static
+int load_subtree(gds_db* db, gds_cell* cell, ReadWarnings* warnings,
+	std::unordered_set<gds_cell*>* visited)
 {
+	if (!visited->insert(cell).second)
+		return ERR_SUCCESS;
+
+	if (!cell->loaded)
+	{
+		int result = load_cell(db, cell, warnings);
+		if (result != ERR_SUCCESS)
+			return result;
+	}
+
+	for (const std::string& sname : cell->toc->snames)
+	{
+		// Also reported when the cell was loaded before, by the linking of its references
+		gds_cell* child = find_cell(db, sname.c_str());
+		if (child == NULL)
+			return ERR_CELL_NAME_NOT_FOUND;
+
+		int result = load_subtree(db, child, warnings, visited);
+		if (result != ERR_SUCCESS)
+			return result;
+	}
+
+	return ERR_SUCCESS;
+}
+
+int gds_load_subtree(gds_db* db, gds_cell* cell)
+{
+	if (!db->lazy)
+		return ERR_SUCCESS;
+
+	ReadWarnings warnings;
+	warnings.pathtype1_given = false;
+	warnings.pathtype4_given = false;
+
+	std::unordered_set<gds_cell*> visited;
+
+	return load_subtree(db, cell, &warnings, &visited);
+}
+
+static
+int read_cells(gds_db* db, const wchar_t* file, const gds_load_options* options)
+{
+	ReadWarnings warnings;
+	warnings.pathtype1_given = false;
+	warnings.pathtype4_given = false;
+
+	ReadState s;
+	read_state_init(&s, db, &warnings);
+
+	int result;
+
+	auto start = std::chrono::steady_clock::now();
+
+	if (options->lazy && mapped_file_open(&db->map, file, MAPPED_ON_DEMAND) == ERR_SUCCESS)
+	{
+		// The mapping stays open for the lifetime of the database
+		db->lazy = true;
+
+		result = read_toc(&s, db->map.data, db->map.size);
+
+		if (s.stats != NULL)
+			s.stats->parse_seconds += stats_seconds_since(start);
+
+		return result;
+	}
+
+	gds_mapped_file map;
+	if (options->use_mmap && mapped_file_open(&map, file, MAPPED_SEQUENTIAL) == ERR_SUCCESS)
+	{
+		if (parallel_threads(options->nthreads) > 1)
+			result = read_cells_parallel(&s, map.data, map.size, options->nthreads);
+		else
+			result = read_cells_mapped(&s, map.data, map.size);
+
+		mapped_file_close(&map);
+	} else
+	{
+		result = read_cells_stdio(&s, file);
+	}
+
+	if (s.stats != NULL)
+	{
+		s.stats->cells += db->cell_list.size();
+
+		for (gds_cell* cell : db->cell_list)
+			s.stats->allocations += cell->arena.blocks.size();
+
+		s.stats->parse_seconds += stats_seconds_since(start);
+	}
+
+	if (result != ERR_SUCCESS)
+		return result;
+
+	start = std::chrono::steady_clock::now();
+
+	result = link_cells(db, options->nthreads);
+
+	if (s.stats != NULL)
+		s.stats->link_seconds += stats_seconds_since(start);
+
+	return result;
+}
+
+
+gds_db::gds_db(const wchar_t* file, int* error, const gds_load_options* options)
+{
+	gds_load_options defaults;
+	if (options == NULL)
+		options = &defaults;
+
+	this->options = *options;
+
 	dbunit_in_meter = 0.;
 	dbunit_in_uu = 0.;
 	version = 0;
-	*error = read_cells(this, file);
+	lazy = false;
+	map.data = NULL;
+
+	// A snapshot of the same file replaces parsing it
+	gds_source_key key;
+	bool keyed = options->snapshot != NULL && snapshot_source_key(file, options->snapshot_hash_all, &key) == ERR_SUCCESS;
+
+	auto start = std::chrono::steady_clock::now();
+
+	if (keyed && snapshot_open(this, options->snapshot, &key) == ERR_SUCCESS)
+	{
+		if (options->stats)
+		{
+			stats.cells += cell_list.size();
+			stats.parse_seconds += stats_seconds_since(start);
+		}
+
+		*error = ERR_SUCCESS;
+		return;
+	}
 
-	// Determine the size of each cell
-	gds_cell_sizes(this);
+	*error = read_cells(this, file, options);
+
+	// Determine the size of each cell (a lazily loaded database does this on first use of a cell)
+	if (!lazy && *error == ERR_SUCCESS)
+		gds_cell_sizes(this);
+
+	// Failing to write the snapshot does not fail the load
+	if (keyed && *error == ERR_SUCCESS)
+		snapshot_write(options->snapshot, this, &key);
 }
 
 gds_db::~gds_db()
@@ -605,4 +1220,7 @@ gds_db::~gds_db()
 		delete cell;
 		cell = NULL;
 	}
+
+	if (map.data != NULL)
+		mapped_file_close(&map);
 }
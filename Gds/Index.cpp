@@ -0,0 +1,203 @@
+#include "Index.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <utility>
+
+static
+int32_t clamp32(int64_t v)
+{
+	if (v < INT32_MIN)
+		return INT32_MIN;
+
+	if (v > INT32_MAX)
+		return INT32_MAX;
+
+	return (int32_t)v;
+}
+
+static
+uint32_t hilbert_d(uint32_t x, uint32_t y)
+{
+	// Distance along a Hilbert curve filling a 65536 x 65536 grid of the point (@x, @y)
+
+	uint32_t d = 0;
+
+	for (uint32_t s = 1 << 15; s > 0; s >>= 1)
+	{
+		uint32_t rx = (x & s) > 0;
+		uint32_t ry = (y & s) > 0;
+
+		d += s * s * ((3 * rx) ^ ry);
+
+		// Rotate the quadrant
+		if (ry == 0)
+		{
+			if (rx == 1)
+			{
+				x = s - 1 - x;
+				y = s - 1 - y;
+			}
+
+			std::swap(x, y);
+		}
+	}
+
+	return d;
+}
+
+static
+void fit_entry(gds_index_entry* self, const gds_index_entry* other)
+{
+	self->xmin = std::min(self->xmin, other->xmin);
+	self->ymin = std::min(self->ymin, other->ymin);
+	self->xmax = std::max(self->xmax, other->xmax);
+	self->ymax = std::max(self->ymax, other->ymax);
+}
+
+static
+bool entry_touches(const gds_index_entry* e, const gds_bbox* box)
+{
+	return e->xmin <= box->xmax && e->xmax >= box->xmin && e->ymin <= box->ymax && e->ymax >= box->ymin;
+}
+
+void index_add(gds_index* self, const gds_bbox* bbox, gds_index_kind kind, uint32_t i)
+{
+	// A larger position would run into the bits of the kind
+	assert(i < INDEX_MAX_ELEMENTS);
+
+	gds_index_entry e;
+
+	e.xmin = clamp32(bbox->xmin);
+	e.ymin = clamp32(bbox->ymin);
+	e.xmax = clamp32(bbox->xmax);
+	e.ymax = clamp32(bbox->ymax);
+	e.hit = INDEX_HIT(kind, i);
+
+	self->entries.push_back(e);
+}
+
+void index_build(gds_index* self)
+{
+	std::vector<gds_index_entry>& entries = self->entries;
+
+	self->nodes.clear();
+	self->levels.clear();
+
+	if (entries.empty())
+		return;
+
+	// Sort the entries by the Hilbert distance of their centers within the extent of all entries
+
+	gds_index_entry extent = entries[0];
+	for (const gds_index_entry& e : entries)
+		fit_entry(&extent, &e);
+
+	double sx = 65535.0 / std::max<int64_t>(1, (int64_t)extent.xmax - extent.xmin);
+	double sy = 65535.0 / std::max<int64_t>(1, (int64_t)extent.ymax - extent.ymin);
+
+	std::vector<std::pair<uint32_t, uint32_t>> order(entries.size());
+
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		const gds_index_entry& e = entries[i];
+
+		double cx = 0.5 * ((double)e.xmin + e.xmax) - extent.xmin;
+		double cy = 0.5 * ((double)e.ymin + e.ymax) - extent.ymin;
+
+		order[i] = {hilbert_d((uint32_t)(cx * sx), (uint32_t)(cy * sy)), (uint32_t)i};
+	}
+
+	std::sort(order.begin(), order.end());
+
+	std::vector<gds_index_entry> sorted(entries.size());
+	for (size_t i = 0; i < order.size(); i++)
+		sorted[i] = entries[order[i].second];
+
+	entries.swap(sorted);
+	entries.shrink_to_fit();
+
+	// Group the entries (and then the nodes of each level) into parent nodes up to a single root
+
+	size_t nchildren = entries.size();
+	size_t child_first = 0;
+	bool leaves = true;
+
+	for (;;)
+	{
+		size_t first = self->nodes.size();
+		self->levels.push_back(first);
+
+		for (size_t i = 0; i < nchildren; i += INDEX_NODE_SIZE)
+		{
+			const gds_index_entry* children = leaves ? &entries[0] : &self->nodes[child_first];
+
+			gds_index_entry node = children[i];
+
+			size_t end = std::min(nchildren, i + INDEX_NODE_SIZE);
+			for (size_t j = i + 1; j < end; j++)
+				fit_entry(&node, &children[j]);
+
+			self->nodes.push_back(node);
+		}
+
+		nchildren = self->nodes.size() - first;
+		child_first = first;
+		leaves = false;
+
+		if (nchildren == 1)
+			break;
+	}
+
+	self->levels.push_back(self->nodes.size());
+}
+
+void index_query(const gds_index* self, const gds_bbox* box, std::vector<uint32_t>* hits)
+{
+	if (self->entries.empty())
+		return;
+
+	size_t first_hit = hits->size();
+
+	// Stack of (level, node number within the level) pairs still to visit
+	std::pair<int, size_t> stack[64 * INDEX_NODE_SIZE];
+	int top = 0;
+
+	int root_level = (int)self->levels.size() - 2;
+	stack[top++] = {root_level, 0};
+
+	while (top > 0)
+	{
+		std::pair<int, size_t> item = stack[--top];
+
+		int level = item.first;
+		const gds_index_entry* node = &self->nodes[self->levels[level] + item.second];
+
+		if (!entry_touches(node, box))
+			continue;
+
+		size_t begin = item.second * INDEX_NODE_SIZE;
+
+		if (level == 0)
+		{
+			size_t end = std::min(self->entries.size(), begin + INDEX_NODE_SIZE);
+
+			for (size_t i = begin; i < end; i++)
+			{
+				if (entry_touches(&self->entries[i], box))
+					hits->push_back(self->entries[i].hit);
+			}
+		} else
+		{
+			size_t count = self->levels[level] - self->levels[level - 1];
+			size_t end = std::min(count, begin + INDEX_NODE_SIZE);
+
+			for (size_t i = begin; i < end; i++)
+				stack[top++] = {level - 1, i};
+		}
+	}
+
+	// Back to the order of the element lists so extraction results do not depend on the index
+	std::sort(hits->begin() + first_hit, hits->end());
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "BBox.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// Cells with fewer elements than this are scanned linearly and get no index
+#define INDEX_MIN_ELEMENTS 64
+
+// Number of children of a node of the index tree
+#define INDEX_NODE_SIZE 16
+
+// Kinds of elements stored in an index. The kind is kept in the top two bits of a hit.
+enum gds_index_kind { INDEX_BOUNDARY = 0, INDEX_PATH, INDEX_SREF, INDEX_AREF };
+
+// Elements of one kind an index holds, their positions need to fit below the kind in a hit
+#define INDEX_MAX_ELEMENTS ((size_t)1 << 30)
+
+#define INDEX_HIT(kind, i) (((uint32_t)(kind) << 30) | (uint32_t)(i))
+#define INDEX_HIT_KIND(hit) ((hit) >> 30)
+#define INDEX_HIT_ELEMENT(hit) ((hit) & 0x3FFFFFFF)
+
+struct gds_index_entry
+{
+	int32_t xmin, ymin, xmax, ymax; // Bounding box of the element in cell coordinates
+	uint32_t hit; // Kind and position of the element in its cell list (see INDEX_HIT)
+};
+
+/*
+	Static packed Hilbert R-tree over the element bounding boxes of one cell. The entries are sorted
+	along a Hilbert curve and grouped by INDEX_NODE_SIZE into the leaves, which are grouped the same
+	way level by level up to a single root.
+ */
+struct gds_index
+{
+	std::vector<gds_index_entry> entries;
+
+	// Bounding boxes of the nodes, the lowest level first and the root last
+	std::vector<gds_index_entry> nodes;
+
+	// Position of the first node of each level in @nodes plus one past the root
+	std::vector<size_t> levels;
+};
+
+// Add an element to an index that is not built yet, @i is below INDEX_MAX_ELEMENTS
+void index_add(gds_index* self, const gds_bbox* bbox, gds_index_kind kind, uint32_t i);
+
+// Sort the entries added so far and build the tree
+void index_build(gds_index* self);
+
+/*
+	Append to @hits all elements whose bounding box overlaps or touches @box. The hits are sorted so
+	they come in the order of the element lists of the cell (boundaries, paths, SREFs, AREFs).
+ */
+void index_query(const gds_index* self, const gds_bbox* box, std::vector<uint32_t>* hits);
@@ -0,0 +1,41 @@
+#include "Layers.h"
+
+#include <algorithm>
+
+gds_layer_selection::gds_layer_selection()
+{
+	layer_mask_clear(&mask);
+}
+
+void gds_select_layer(gds_layer_selection* self, uint16_t layer)
+{
+	// Kept sorted for the binary search in gds_layer_selected
+	auto it = std::lower_bound(self->layers.begin(), self->layers.end(), layer);
+	if (it == self->layers.end() || *it != layer)
+		self->layers.insert(it, layer);
+
+	layer_mask_add(&self->mask, layer);
+}
+
+void gds_select_layer(gds_layer_selection* self, uint16_t layer, uint16_t datatype)
+{
+	uint32_t key = (uint32_t)layer << 16 | datatype;
+
+	auto it = std::lower_bound(self->datatypes.begin(), self->datatypes.end(), key);
+	if (it == self->datatypes.end() || *it != key)
+		self->datatypes.insert(it, key);
+
+	layer_mask_add(&self->mask, layer);
+}
+
+bool gds_layer_selected(const gds_layer_selection* self, uint16_t layer, uint16_t datatype)
+{
+	// Most elements are on layers that are not selected and fail the mask test
+	if (!layer_mask_test(&self->mask, layer))
+		return false;
+
+	if (std::binary_search(self->layers.begin(), self->layers.end(), layer))
+		return true;
+
+	return std::binary_search(self->datatypes.begin(), self->datatypes.end(), (uint32_t)layer << 16 | datatype);
+}
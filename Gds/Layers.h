@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <vector>
+
+/*
+	Set of layer numbers in 256 bits. Layer numbers above 255 share the bit of their number modulo
+	256, so a clear bit means the layer is absent but a set bit only means it may be present.
+ */
+struct gds_layer_mask
+{
+	uint64_t bits[4];
+};
+
+inline void layer_mask_clear(gds_layer_mask* self)
+{
+	self->bits[0] = self->bits[1] = self->bits[2] = self->bits[3] = 0;
+}
+
+inline void layer_mask_add(gds_layer_mask* self, uint16_t layer)
+{
+	self->bits[(layer >> 6) & 3] |= (uint64_t)1 << (layer & 63);
+}
+
+inline bool layer_mask_test(const gds_layer_mask* self, uint16_t layer)
+{
+	return (self->bits[(layer >> 6) & 3] >> (layer & 63)) & 1;
+}
+
+// Add all layers of @other to @self
+inline void layer_mask_merge(gds_layer_mask* self, const gds_layer_mask* other)
+{
+	for (int i = 0; i < 4; i++)
+		self->bits[i] |= other->bits[i];
+}
+
+inline bool layer_mask_overlap(const gds_layer_mask* a, const gds_layer_mask* b)
+{
+	return ((a->bits[0] & b->bits[0]) | (a->bits[1] & b->bits[1]) |
+		(a->bits[2] & b->bits[2]) | (a->bits[3] & b->bits[3])) != 0;
+}
+
+/*
+	Layers and datatypes to extract. A layer is selected with all its datatypes or with single
+	datatypes.
+ */
+struct gds_layer_selection
+{
+	gds_layer_selection();
+
+	gds_layer_mask mask; // All selected layers
+
+	std::vector<uint16_t> layers; // Layers selected with all datatypes
+	std::vector<uint32_t> datatypes; // Layer and datatype pairs selected as layer << 16 | datatype
+};
+
+// Select @layer with all its datatypes
+void gds_select_layer(gds_layer_selection* self, uint16_t layer);
+
+// Select only @datatype of @layer
+void gds_select_layer(gds_layer_selection* self, uint16_t layer, uint16_t datatype);
+
+// Whether elements on @layer with @datatype are selected
+bool gds_layer_selected(const gds_layer_selection* self, uint16_t layer, uint16_t datatype);
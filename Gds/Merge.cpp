@@ -0,0 +1,531 @@
+#include "gds.h"
+#include "Parallel.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+// Slopes of polygon edges, from cheapest to most expensive to intersect with a scanline
+enum MergeEdgeKind
+{
+	EDGE_VERTICAL,
+	EDGE_DIAGONAL, // 45 degrees
+	EDGE_SLANTED
+};
+
+// A non-horizontal polygon edge, from bottom to top
+struct MergeEdge
+{
+	int64_t x0, y0, x1, y1;
+	int winding; // +1 when the edge goes up in its polygon turned counterclockwise, -1 when it goes down
+	int kind;
+};
+
+// The edges of the polygons of one layer and datatype
+struct MergeLayer
+{
+	uint16_t layer, datatype;
+
+	std::vector<MergeEdge> edges; // Sorted by y0
+	bool manhattan; // Only vertical edges
+};
+
+// Horizontal strip of a layer swept by one thread
+struct MergeStrip
+{
+	MergeLayer* layer;
+	int64_t y0, y1;
+
+	// The edges starting in the strip, and those starting below it and reaching into it
+	size_t begin, end;
+	std::vector<uint32_t> carried;
+
+	gds_polyset out;
+	bool failed; // Out of memory
+};
+
+// An edge crossing the current band of the sweep, with its x at the bottom and top of the band
+struct ActiveEdge
+{
+	uint32_t edge;
+	int64_t xa, xb;
+};
+
+// A trapezoid of the output, still growing upwards while the next band continues its sides
+struct MergeTrapezoid
+{
+	int64_t y0, y1;
+	int64_t xl0, xr0; // Bottom side
+	int64_t xl1, xr1; // Top side
+};
+
+static
+int64_t edge_x(const MergeEdge* e, int64_t y)
+{
+	// The x of edge @e at height @y, rounded to the nearest database unit for slanted edges
+
+	switch (e->kind)
+	{
+	case EDGE_VERTICAL:
+		return e->x0;
+	case EDGE_DIAGONAL:
+		return e->x1 > e->x0 ? e->x0 + (y - e->y0) : e->x0 - (y - e->y0);
+	default:
+		if (y == e->y0)
+			return e->x0;
+
+		if (y == e->y1)
+			return e->x1;
+
+		return e->x0 + llround((double)(e->x1 - e->x0) * (double)(y - e->y0) / (double)(e->y1 - e->y0));
+	}
+}
+
+static
+bool active_less(const ActiveEdge& a, const ActiveEdge& b)
+{
+	return a.xa < b.xa || (a.xa == b.xa && a.xb < b.xb);
+}
+
+static
+void add_edges(MergeLayer* layer, const gds_polygon* p)
+{
+	// Add the edges of polygon @p, turned counterclockwise so every polygon counts +1 inside
+
+	int n = p->npairs;
+	if (n > 1 && p->pairs[0].x == p->pairs[n - 1].x && p->pairs[0].y == p->pairs[n - 1].y)
+		n--;
+
+	if (n < 3)
+		return;
+
+	double area = 0;
+	for (int i = 0, j = n - 1; i < n; j = i++)
+		area += (double)p->pairs[j].x * (double)p->pairs[i].y - (double)p->pairs[i].x * (double)p->pairs[j].y;
+
+	if (area == 0)
+		return;
+
+	int orientation = area > 0 ? 1 : -1;
+
+	for (int i = 0; i < n; i++)
+	{
+		gds_pair a = p->pairs[i];
+		gds_pair b = p->pairs[i + 1 < n ? i + 1 : 0];
+
+		if (a.y == b.y)
+			continue;
+
+		MergeEdge e;
+		e.winding = b.y > a.y ? orientation : -orientation;
+
+		if (a.y > b.y)
+			std::swap(a, b);
+
+		e.x0 = a.x;
+		e.y0 = a.y;
+		e.x1 = b.x;
+		e.y1 = b.y;
+
+		int64_t dx = b.x - a.x;
+
+		if (dx == 0)
+			e.kind = EDGE_VERTICAL;
+		else if (dx == b.y - a.y || -dx == b.y - a.y)
+			e.kind = EDGE_DIAGONAL;
+		else
+			e.kind = EDGE_SLANTED;
+
+		if (e.kind != EDGE_VERTICAL)
+			layer->manhattan = false;
+
+		layer->edges.push_back(e);
+	}
+}
+
+static
+bool collinear(int64_t ax0, int64_t ax1, int64_t ah, int64_t bx0, int64_t bx1, int64_t bh)
+{
+	// Whether the side from ax0 to ax1 over height @ah continues with the same slope from bx0 to bx1
+	// over height @bh
+
+	int64_t adx = ax1 - ax0;
+	int64_t bdx = bx1 - bx0;
+
+	if (adx == 0 || bdx == 0)
+		return adx == bdx;
+
+	if ((adx < 0) != (bdx < 0))
+		return false;
+
+	double p = (double)adx * (double)ah;
+	double q = (double)bdx * (double)bh;
+
+	// Not exact in a double beyond 2^53, those sides are left apart
+	if (fabs(p) > 9007199254740992.0 || fabs(q) > 9007199254740992.0)
+		return false;
+
+	return p == q;
+}
+
+static
+void emit_trapezoid(MergeStrip* strip, const MergeTrapezoid* t)
+{
+	// Store the trapezoid counterclockwise, as a triangle when a side has no width
+
+	gds_pair corners[5];
+	int n = 0;
+
+	corners[n++] = {t->xl0, t->y0};
+	if (t->xr0 != t->xl0)
+		corners[n++] = {t->xr0, t->y0};
+
+	corners[n++] = {t->xr1, t->y1};
+	if (t->xl1 != t->xr1)
+		corners[n++] = {t->xl1, t->y1};
+
+	corners[n++] = corners[0];
+
+	gds_bbox bbox;
+	bbox_init(&bbox);
+	bbox_fit_points(&bbox, corners, n);
+
+	gds_pair* pairs = gds_polyset_add(&strip->out, n, strip->layer->layer, strip->layer->datatype, &bbox);
+	if (pairs == NULL)
+	{
+		strip->failed = true;
+		return;
+	}
+
+	memcpy(pairs, corners, n * sizeof(gds_pair));
+}
+
+static
+void close_trapezoids(MergeStrip* strip, std::vector<MergeTrapezoid>* open)
+{
+	for (const MergeTrapezoid& t : *open)
+		emit_trapezoid(strip, &t);
+
+	open->clear();
+}
+
+static
+void merge_strip(MergeStrip* strip)
+{
+	// Sweep a scanline up through the strip. Between two heights where edges start, end or cross,
+	// the covered parts of the band are trapezoids between pairs of edges; each continues the
+	// trapezoid of the band below when both its sides go on straight.
+
+	const MergeLayer* layer = strip->layer;
+	const MergeEdge* edges = layer->edges.data();
+
+	std::vector<ActiveEdge> active, entering;
+	std::vector<MergeTrapezoid> open, band;
+
+	size_t next = strip->begin;
+	int64_t y = strip->y0;
+
+	for (uint32_t e : strip->carried)
+		entering.push_back({e, 0, 0});
+
+	while (y < strip->y1 && !strip->failed)
+	{
+		// Edges ending here leave the sweep, edges starting here join it
+		active.erase(std::remove_if(active.begin(), active.end(), [&](const ActiveEdge& a) {
+			return edges[a.edge].y1 <= y;
+		}), active.end());
+
+		while (next < strip->end && edges[next].y0 == y)
+			entering.push_back({(uint32_t)next++, 0, 0});
+
+		if (active.empty() && entering.empty())
+		{
+			close_trapezoids(strip, &open);
+
+			y = next < strip->end ? edges[next].y0 : strip->y1;
+			continue;
+		}
+
+		// Top of the band: the next height where an edge starts or ends
+		int64_t top = strip->y1;
+
+		if (next < strip->end)
+			top = std::min(top, edges[next].y0);
+
+		for (const ActiveEdge& a : active)
+			top = std::min(top, edges[a.edge].y1);
+
+		for (const ActiveEdge& a : entering)
+			top = std::min(top, edges[a.edge].y1);
+
+		// Order the edges by their x at the bottom of the band. The order of the active edges only
+		// changes where slanted edges cross, which the band below ended at.
+		for (ActiveEdge& a : active)
+			a.xa = edge_x(&edges[a.edge], y);
+
+		for (ActiveEdge& a : entering)
+			a.xa = edge_x(&edges[a.edge], y);
+
+		if (layer->manhattan)
+		{
+			for (ActiveEdge& a : active)
+				a.xb = a.xa;
+
+			for (ActiveEdge& a : entering)
+				a.xb = a.xa;
+		} else
+		{
+			for (ActiveEdge& a : active)
+				a.xb = edge_x(&edges[a.edge], top);
+
+			for (ActiveEdge& a : entering)
+				a.xb = edge_x(&edges[a.edge], top);
+
+			for (size_t i = 1; i < active.size(); i++)
+			{
+				for (size_t j = i; j > 0 && active_less(active[j], active[j - 1]); j--)
+					std::swap(active[j], active[j - 1]);
+			}
+		}
+
+		std::sort(entering.begin(), entering.end(), active_less);
+
+		size_t nactive = active.size();
+		active.insert(active.end(), entering.begin(), entering.end());
+		std::inplace_merge(active.begin(), active.begin() + nactive, active.end(), active_less);
+		entering.clear();
+
+		if (!layer->manhattan)
+		{
+			// End the band below the first crossing of neighbouring edges, so the edges keep their
+			// order within it. A crossing less than one unit above the band bottom is kept in a band
+			// of height one.
+			for (;;)
+			{
+				int64_t cut = top;
+
+				for (size_t i = 1; i < active.size(); i++)
+				{
+					const ActiveEdge& a = active[i - 1];
+					const ActiveEdge& b = active[i];
+
+					if (a.xb <= b.xb)
+						continue;
+
+					double da = (double)(b.xa - a.xa);
+					double db = (double)(a.xb - b.xb);
+					int64_t at = y + (int64_t)floor((double)(top - y) * da / (da + db));
+
+					cut = std::min(cut, std::max(at, y + 1));
+				}
+
+				if (cut >= top)
+					break;
+
+				top = cut;
+
+				for (ActiveEdge& a : active)
+					a.xb = edge_x(&edges[a.edge], top);
+			}
+		}
+
+		// Covered parts of the band, where the winding of all polygons is not zero. Edges on top of
+		// each other count together, so polygons touching along an edge are joined.
+		band.clear();
+
+		int winding = 0;
+		int64_t left_xa = 0, left_xb = 0;
+
+		for (size_t i = 0; i < active.size();)
+		{
+			int64_t xa = active[i].xa;
+			int64_t xb = active[i].xb;
+			int change = 0;
+
+			for (; i < active.size() && active[i].xa == xa && active[i].xb == xb; i++)
+				change += edges[active[i].edge].winding;
+
+			int before = winding;
+			winding += change;
+
+			if (before == 0 && winding != 0)
+			{
+				left_xa = xa;
+				left_xb = xb;
+			} else if (before != 0 && winding == 0)
+			{
+				MergeTrapezoid t;
+				t.y0 = y;
+				t.y1 = top;
+				t.xl0 = left_xa;
+				t.xr0 = xa;
+				t.xl1 = left_xb;
+				t.xr1 = xb;
+
+				// Sides crossing within a band of height one are cut where they cross
+				if (!band.empty())
+					t.xl1 = std::max(t.xl1, band.back().xr1);
+
+				t.xr1 = std::max(t.xr1, t.xl1);
+
+				if (t.xl0 != t.xr0 || t.xl1 != t.xr1)
+					band.push_back(t);
+			}
+		}
+
+		// Grow the trapezoids of the band below that continue in this band, close the others
+		size_t k = 0;
+
+		for (MergeTrapezoid& t : band)
+		{
+			while (k < open.size() && open[k].xl1 < t.xl0)
+				emit_trapezoid(strip, &open[k++]);
+
+			if (k < open.size() && open[k].xl1 == t.xl0 && open[k].xr1 == t.xr0 &&
+				collinear(open[k].xl0, open[k].xl1, open[k].y1 - open[k].y0, t.xl0, t.xl1, t.y1 - t.y0) &&
+				collinear(open[k].xr0, open[k].xr1, open[k].y1 - open[k].y0, t.xr0, t.xr1, t.y1 - t.y0))
+			{
+				t.y0 = open[k].y0;
+				t.xl0 = open[k].xl0;
+				t.xr0 = open[k].xr0;
+				k++;
+			}
+		}
+
+		for (; k < open.size(); k++)
+			emit_trapezoid(strip, &open[k]);
+
+		open.swap(band);
+
+		y = top;
+	}
+
+	close_trapezoids(strip, &open);
+}
+
+static
+void split_layer(MergeLayer* layer, int strip_edges, std::vector<MergeStrip*>* strips)
+{
+	// Split the layer at the starts of every @strip_edges-th edge into strips of about as many edges
+
+	const std::vector<MergeEdge>& edges = layer->edges;
+
+	int64_t ymax = edges[0].y1;
+	for (const MergeEdge& e : edges)
+		ymax = std::max(ymax, e.y1);
+
+	std::vector<int64_t> bounds;
+	bounds.push_back(edges[0].y0);
+
+	if (strip_edges > 0)
+	{
+		for (size_t i = strip_edges; i < edges.size(); i += strip_edges)
+		{
+			if (edges[i].y0 > bounds.back())
+				bounds.push_back(edges[i].y0);
+		}
+	}
+
+	bounds.push_back(ymax);
+
+	size_t first = strips->size();
+
+	for (size_t s = 0; s + 1 < bounds.size(); s++)
+	{
+		MergeStrip* strip = new MergeStrip;
+		strip->layer = layer;
+		strip->y0 = bounds[s];
+		strip->y1 = bounds[s + 1];
+		strip->failed = false;
+
+		auto by_start = [](const MergeEdge& e, int64_t y) { return e.y0 < y; };
+		strip->begin = std::lower_bound(edges.begin(), edges.end(), strip->y0, by_start) - edges.begin();
+		strip->end = std::lower_bound(edges.begin(), edges.end(), strip->y1, by_start) - edges.begin();
+
+		strips->push_back(strip);
+	}
+
+	// Edges reaching over strip borders join the sweep of the strips above at their bottom
+	for (size_t s = first; s < strips->size(); s++)
+	{
+		for (size_t i = (*strips)[s]->begin; i < (*strips)[s]->end; i++)
+		{
+			for (size_t t = s + 1; t < strips->size() && edges[i].y1 > (*strips)[t]->y0; t++)
+				(*strips)[t]->carried.push_back((uint32_t)i);
+		}
+	}
+}
+
+int gds_merge(const gds_polyset* pset, gds_polyset* merged, const gds_merge_options* options)
+{
+	gds_merge_options defaults;
+	if (options == NULL)
+		options = &defaults;
+
+	// Collect the edges by layer and datatype
+	std::vector<MergeLayer*> layers;
+	std::unordered_map<uint32_t, MergeLayer*> by_key;
+
+	for (size_t i = 0; i < pset->size(); i++)
+	{
+		gds_polygon p = (*pset)[i];
+
+		MergeLayer*& layer = by_key[(uint32_t)p.layer << 16 | p.datatype];
+
+		if (layer == NULL)
+		{
+			layer = new MergeLayer;
+			layer->layer = p.layer;
+			layer->datatype = p.datatype;
+			layer->manhattan = true;
+
+			layers.push_back(layer);
+		}
+
+		add_edges(layer, &p);
+	}
+
+	std::sort(layers.begin(), layers.end(), [](const MergeLayer* a, const MergeLayer* b) {
+		return a->layer < b->layer || (a->layer == b->layer && a->datatype < b->datatype);
+	});
+
+	std::vector<MergeStrip*> strips;
+
+	for (MergeLayer* layer : layers)
+	{
+		if (layer->edges.empty())
+			continue;
+
+		std::sort(layer->edges.begin(), layer->edges.end(), [](const MergeEdge& a, const MergeEdge& b) {
+			return a.y0 < b.y0;
+		});
+
+		split_layer(layer, options->strip_edges, &strips);
+	}
+
+	parallel_for((int)strips.size(), options->nthreads, [&](int i) {
+		merge_strip(strips[i]);
+	});
+
+	int result = ERR_SUCCESS;
+
+	for (MergeStrip* strip : strips)
+	{
+		if (strip->failed)
+			result = ERR_OUT_OF_MEMORY;
+
+		gds_polyset_append(merged, &strip->out, 0, strip->out.size());
+		gds_polyset_take(merged, &strip->out);
+
+		delete strip;
+	}
+
+	for (MergeLayer* layer : layers)
+		delete layer;
+
+	return result;
+}
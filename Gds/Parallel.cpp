@@ -0,0 +1,272 @@
+#include "Parallel.h"
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+int parallel_threads(int nthreads)
+{
+	if (nthreads > 0)
+		return nthreads;
+
+	int n = (int)std::thread::hardware_concurrency();
+
+	return n > 0 ? n : 1;
+}
+
+void parallel_for(int n, int nthreads, const std::function<void(int)>& fn)
+{
+	nthreads = parallel_threads(nthreads);
+
+	if (nthreads > n)
+		nthreads = n;
+
+	if (nthreads <= 1)
+	{
+		for (int i = 0; i < n; i++)
+			fn(i);
+
+		return;
+	}
+
+	std::atomic<int> next(0);
+
+	auto worker = [&]() {
+		for (int i = next++; i < n; i = next++)
+			fn(i);
+	};
+
+	std::vector<std::thread> threads;
+	for (int t = 1; t < nthreads; t++)
+		threads.emplace_back(worker);
+
+	worker();
+
+	for (std::thread& t : threads)
+		t.join();
+}
+
+struct gds_task_pool::queue
+{
+	std::mutex mutex;
+	std::deque<task> tasks;
+};
+
+gds_task_pool::gds_task_pool(int nthreads)
+	: nthreads(parallel_threads(nthreads)), pending(0), nqueued(0), nparked(0), generation(0), nserving(0),
+	stopping(false)
+{
+	queues = new queue[this->nthreads];
+
+	for (int t = 1; t < this->nthreads; t++)
+		threads.emplace_back(&gds_task_pool::work, this, t);
+}
+
+gds_task_pool::~gds_task_pool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+
+	wake.notify_all();
+
+	for (std::thread& t : threads)
+		t.join();
+
+	delete[] queues;
+}
+
+int gds_task_pool::size() const
+{
+	return nthreads;
+}
+
+void gds_task_pool::spawn(int worker, task fn)
+{
+	pending++;
+
+	{
+		std::lock_guard<std::mutex> lock(queues[worker].mutex);
+		queues[worker].tasks.push_back(std::move(fn));
+	}
+
+	nqueued++;
+
+	// A thread that found no task before the count went up is woken. Taking the lock orders the
+	// notification after its check.
+	if (nparked > 0)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+		}
+
+		wake.notify_one();
+	}
+}
+
+int gds_task_pool::queued(int worker)
+{
+	std::lock_guard<std::mutex> lock(queues[worker].mutex);
+
+	return (int)queues[worker].tasks.size();
+}
+
+bool gds_task_pool::take(int worker, task* fn)
+{
+	// The newest own task first, its data is most likely still in the cache
+	{
+		std::lock_guard<std::mutex> lock(queues[worker].mutex);
+
+		if (!queues[worker].tasks.empty())
+		{
+			*fn = std::move(queues[worker].tasks.back());
+			queues[worker].tasks.pop_back();
+			nqueued--;
+			return true;
+		}
+	}
+
+	// Then the oldest task of another thread, which tends to be the largest
+	for (int i = 1; i < nthreads; i++)
+	{
+		queue& victim = queues[(worker + i) % nthreads];
+
+		std::lock_guard<std::mutex> lock(victim.mutex);
+
+		if (!victim.tasks.empty())
+		{
+			*fn = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			nqueued--;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void gds_task_pool::serve(int worker)
+{
+	// Run tasks until all tasks of the run finished, waiting while there is none to take
+
+	task fn;
+
+	while (pending > 0)
+	{
+		if (take(worker, &fn))
+		{
+			fn(worker);
+			fn = nullptr;
+
+			if (--pending == 0)
+			{
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+				}
+
+				wake.notify_all();
+			}
+		} else
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+
+			nparked++;
+			wake.wait(lock, [this] { return nqueued > 0 || pending == 0; });
+			nparked--;
+		}
+	}
+}
+
+void gds_task_pool::work(int worker)
+{
+	// Thread @worker of the pool: serve every run until the pool stops
+
+	uint64_t seen = 0;
+
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+
+			wake.wait(lock, [&] { return stopping || generation != seen; });
+			if (stopping)
+				return;
+
+			seen = generation;
+		}
+
+		serve(worker);
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if (--nserving == 0)
+			finished.notify_all();
+	}
+}
+
+void gds_task_pool::run(task root)
+{
+	// The root task counts as pending until it returned, so no thread leaves the run before
+	pending = 1;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		nserving = nthreads - 1;
+		generation++;
+	}
+
+	wake.notify_all();
+
+	root(0);
+
+	if (--pending == 0)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+		}
+
+		wake.notify_all();
+	}
+
+	serve(0);
+
+	// The threads may still be on their way out of the run, wait for them before the next one
+	std::unique_lock<std::mutex> lock(mutex);
+	finished.wait(lock, [this] { return nserving == 0; });
+}
+
+// Pools given back for later runs
+static std::mutex shared_mutex;
+static std::vector<gds_task_pool*> shared_pools;
+
+gds_task_pool* parallel_pool_acquire(int nthreads)
+{
+	nthreads = parallel_threads(nthreads);
+
+	{
+		std::lock_guard<std::mutex> lock(shared_mutex);
+
+		for (size_t i = 0; i < shared_pools.size(); i++)
+		{
+			gds_task_pool* pool = shared_pools[i];
+
+			if (pool->size() == nthreads)
+			{
+				shared_pools.erase(shared_pools.begin() + i);
+				return pool;
+			}
+		}
+	}
+
+	return new gds_task_pool(nthreads);
+}
+
+void parallel_pool_release(gds_task_pool* pool)
+{
+	std::lock_guard<std::mutex> lock(shared_mutex);
+
+	shared_pools.push_back(pool);
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+	Resolve a requested thread count: 0 (or less) means one thread per hardware thread
+ */
+int parallel_threads(int nthreads);
+
+/*
+	Call @fn(i) for every i in [0, @n) on up to @nthreads threads (0 uses all hardware threads).
+	Indices are handed out one at a time so uneven work is balanced. The calling thread takes part
+	in the work and the function returns when all calls have finished.
+ */
+void parallel_for(int n, int nthreads, const std::function<void(int)>& fn);
+
+/*
+	Work-stealing pool for recursive tasks. Every thread owns a queue of tasks: it takes its own
+	tasks from the back and, when it runs out, steals the oldest task of another thread. Tasks are
+	never suspended, so a task runs from start to end on the thread that took it.
+
+	The threads are started by the constructor and kept for every run. A thread without a task to
+	take waits until one is spawned or the run finishes, so idle threads do not take a core.
+ */
+class gds_task_pool
+{
+public:
+	// A task receives the number of the thread running it
+	typedef std::function<void(int)> task;
+
+	gds_task_pool(int nthreads);
+	~gds_task_pool();
+
+	// Number of threads (0 uses all hardware threads in the constructor)
+	int size() const;
+
+	// Queue a task from within a task running on thread @worker
+	void spawn(int worker, task fn);
+
+	// Number of tasks waiting in the queue of thread @worker
+	int queued(int worker);
+
+	// Run @root on the calling thread (number 0) and return when it and all tasks it spawned finished
+	void run(task root);
+
+private:
+	struct queue;
+
+	bool take(int worker, task* fn);
+	void serve(int worker);
+	void work(int worker);
+
+	int nthreads;
+	queue* queues;
+	std::vector<std::thread> threads;
+
+	std::atomic<int64_t> pending; // Tasks of the run not finished yet, the root included
+	std::atomic<int64_t> nqueued; // Tasks waiting in the queues
+	std::atomic<int> nparked; // Threads waiting for a task
+
+	std::mutex mutex;
+	std::condition_variable wake; // A task was spawned, a run started or finished, or the pool stops
+	std::condition_variable finished; // The last thread left a run
+	uint64_t generation; // Number of runs started
+	int nserving; // Threads still in the current run
+	bool stopping;
+};
+
+/*
+	Take a pool of @nthreads threads (0 uses all hardware threads) that was used before, or construct
+	one. Pools given back with parallel_pool_release are kept for the lifetime of the process, so an
+	extraction does not start its threads again. Extractions running at the same time each take
+	their own pool.
+ */
+gds_task_pool* parallel_pool_acquire(int nthreads);
+
+// Give back a pool taken with parallel_pool_acquire after its run returned
+void parallel_pool_release(gds_task_pool* pool);
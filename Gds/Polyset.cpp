@@ -1,25 +1,76 @@
 #include "Polyset.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 
-gds_polygon::gds_polygon(gds_pair* pairs, int npairs, gds_bbox box, uint16_t layer)
+gds_polyset::gds_polyset()
 {
-	this->pairs = pairs; // Is allocated by the caller and needs to be destructed in the destructor
-	this->npairs = npairs;
-	this->bbox = box;
-	this->layer = layer;
+	chunks = new gds_arena;
+	nvertices = 0;
 }
 
-gds_polygon::~gds_polygon()
+gds_polyset::~gds_polyset()
 {
-	delete[] pairs;
+	delete chunks;
+}
+
+gds_polygon gds_polyset::operator[](size_t i) const
+{
+	return {pairs[i], npairs[i], layers[i], datatypes[i], bboxes[i]};
+}
+
+gds_pair* gds_polyset_add(gds_polyset* pset, int npairs, uint16_t layer, uint16_t datatype, const gds_bbox* bbox)
+{
+	gds_pair* pairs = (gds_pair*)arena_alloc(pset->chunks, npairs * sizeof(gds_pair));
+	if (pairs == NULL)
+		return NULL;
+
+	pset->pairs.push_back(pairs);
+	pset->npairs.push_back(npairs);
+	pset->layers.push_back(layer);
+	pset->datatypes.push_back(datatype);
+	pset->bboxes.push_back(*bbox);
+	pset->nvertices += npairs;
+
+	return pairs;
+}
+
+void gds_polyset_append(gds_polyset* pset, const gds_polyset* other, size_t first, size_t last)
+{
+	pset->pairs.insert(pset->pairs.end(), other->pairs.begin() + first, other->pairs.begin() + last);
+	pset->npairs.insert(pset->npairs.end(), other->npairs.begin() + first, other->npairs.begin() + last);
+	pset->layers.insert(pset->layers.end(), other->layers.begin() + first, other->layers.begin() + last);
+	pset->datatypes.insert(pset->datatypes.end(), other->datatypes.begin() + first, other->datatypes.begin() + last);
+	pset->bboxes.insert(pset->bboxes.end(), other->bboxes.begin() + first, other->bboxes.begin() + last);
+
+	for (size_t i = first; i < last; i++)
+		pset->nvertices += other->npairs[i];
+}
+
+void gds_polyset_take(gds_polyset* pset, gds_polyset* other)
+{
+	arena_take(pset->chunks, other->chunks);
+
+	other->pairs.clear();
+	other->npairs.clear();
+	other->layers.clear();
+	other->datatypes.clear();
+	other->bboxes.clear();
+	other->nvertices = 0;
 }
 
 void gds_polyset_clear(gds_polyset* pset)
 {
-	for (gds_polygon* p : *pset) {
-		delete p;
-	}
+	delete pset->chunks;
+	pset->chunks = new gds_arena;
+
+	// Release the tables as well, they can be large
+	std::vector<gds_pair*>().swap(pset->pairs);
+	std::vector<int>().swap(pset->npairs);
+	std::vector<uint16_t>().swap(pset->layers);
+	std::vector<uint16_t>().swap(pset->datatypes);
+	std::vector<gds_bbox>().swap(pset->bboxes);
+	pset->nvertices = 0;
 }
 
 
@@ -30,13 +81,15 @@ void gds_print_polyset(gds_polyset* pset)
 	if (pset->size() == 0)
 		printf("--> List is empty\n");
 
-	for (gds_polygon* poly : *pset)
+	for (size_t i = 0; i < pset->size(); i++)
 	{
-		printf("\nLayer %d polygon with %d vertices:\n", poly->layer, poly->npairs - 1);
-		for (int j = 0; j < poly->npairs; j++)
+		gds_polygon poly = (*pset)[i];
+
+		printf("\nLayer %d datatype %d polygon with %d vertices:\n", poly.layer, poly.datatype, poly.npairs - 1);
+		for (int j = 0; j < poly.npairs; j++)
 		{
-			gds_pair pair = poly->pairs[j];
+			gds_pair pair = poly.pairs[j];
 			printf("\t(%lld, %lld)\n", pair.x, pair.y);
 		}
 	}
-}
\ No newline at end of file
+}
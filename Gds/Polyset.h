@@ -1,35 +1,80 @@
 #pragma once
 
+#include "Arena.h"
 #include "BBox.h"
 #include "Pair.h"
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include <vector>
 
-class gds_polygon {
+/*
+	A polygon of a polygon set. The vertices are owned by the set and stay valid until it is cleared.
+ */
+struct gds_polygon
+{
+	const gds_pair* pairs; // Coordinates of vertices in database units
+	int npairs; // Number of coordinates (note GDSII polygons are closed polygons)
+
+	uint16_t layer; // Layer in the GDSII database to which the polygon belongs
+	uint16_t datatype; // Datatype of the element the polygon comes from
+
+	gds_bbox bbox; // Bounding box of the polygon
+};
+
+/*
+	Result of an extraction. The vertices of all polygons are stored back to back in a few large
+	chunks, next to a table with the start of the vertices and the number of vertices, the layer and
+	the bounding box of each polygon. Adding a polygon is a bump allocation and clearing the set
+	frees the chunks at once.
+ */
+class gds_polyset
+{
 public:
+	gds_polyset();
+	~gds_polyset();
 
-	// The constructor requires an already memory allocated array of type gds_pair
-	gds_polygon(gds_pair* pairs, int npairs, gds_bbox box, uint16_t layer);
+	gds_polyset(const gds_polyset&) = delete;
+	gds_polyset& operator=(const gds_polyset&) = delete;
 
-	// The destructor takes care of deleting the allocated memory in member pairs
-	~gds_polygon();
+	size_t size() const { return npairs.size(); }
 
-	gds_pair* pairs; // Coordinates of vertices in database units
-	int npairs; // Number of coordinates (note GDSII polygons are closed polygons)
+	// Polygon @i (0 <= @i < size())
+	gds_polygon operator[](size_t i) const;
 
-	uint16_t layer; // Layer in the GDSII database to which the polygon belongs
+	gds_arena* chunks; // Vertices of all polygons
 
-	gds_bbox bbox; // Bounding box of the polygon
+	// One entry per polygon
+	std::vector<gds_pair*> pairs;
+	std::vector<int> npairs;
+	std::vector<uint16_t> layers;
+	std::vector<uint16_t> datatypes;
+	std::vector<gds_bbox> bboxes;
+
+	int64_t nvertices; // Total number of vertices
 };
 
-typedef std::vector<gds_polygon*> gds_polyset;
+/*
+	Add a polygon of @npairs vertices and return the place to store them, or NULL when out of memory
+ */
+gds_pair* gds_polyset_add(gds_polyset* pset, int npairs, uint16_t layer, uint16_t datatype, const gds_bbox* bbox);
 
+/*
+	Append the polygons @first up to @last of @other to @pset. Their vertices are not copied, so
+	@pset needs to take the chunks of @other (with gds_polyset_take) before @other is cleared.
+ */
+void gds_polyset_append(gds_polyset* pset, const gds_polyset* other, size_t first, size_t last);
 
-void gds_polyset_clear(gds_polyset* pset);
+/*
+	Move the vertex chunks of @other to @pset. The polygons of @other are removed.
+ */
+void gds_polyset_take(gds_polyset* pset, gds_polyset* other);
 
-void gds_print_polyset(gds_polyset* pset);
+/*
+	Remove all polygons and free their memory
+ */
+void gds_polyset_clear(gds_polyset* pset);
 
 /*
 	Print to stdout all polygons elements of a polygon set
@@ -0,0 +1,147 @@
+#include "Reference.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+// Slack in database units around the origins solved for, as instance origins are truncated
+#define AREF_SLACK 2
+
+gds_transform reference_transform(gds_pair origin, double mag, double angle, uint16_t strans)
+{
+	return transform_make(origin, mag, angle, (strans & 0x8000) != 0);
+}
+
+gds_pair aref_origin(const gds_aref* aref, int c, int r)
+{
+	int64_t x1 = aref->vectors[0].x;
+	int64_t y1 = aref->vectors[0].y;
+
+	// (v_col_x, v_col_y) vector pair column direction
+	double v_col_x = ((double)(aref->vectors[1].x - x1)) / aref->ncols;
+	double v_col_y = ((double)(aref->vectors[1].y - y1)) / aref->ncols;
+
+	// (v_row_x, v_row_y) vector pair row direction
+	double v_row_x = ((double)(aref->vectors[2].x - x1)) / aref->nrows;
+	double v_row_y = ((double)(aref->vectors[2].y - y1)) / aref->nrows;
+
+	int64_t x_ref = (int64_t)(x1 + c * v_col_x + r * v_row_x);
+	int64_t y_ref = (int64_t)(y1 + c * v_col_y + r * v_row_y);
+
+	return {x_ref, y_ref};
+}
+
+gds_bbox aref_extent(const gds_aref* aref)
+{
+	gds_bbox box;
+	bbox_init(&box);
+
+	// Visit column 0 and ncols - 1 and row 0 and nrows - 1 (each once for a single column or row)
+	for (int c = 0; c < aref->ncols; c += std::max(1, aref->ncols - 1)) {
+		for (int r = 0; r < aref->nrows; r += std::max(1, aref->nrows - 1)) {
+			gds_transform t = reference_transform(aref_origin(aref, c, r), aref->mag, aref->angle, aref->strans);
+
+			gds_bbox tmp = bbox_transform(&aref->cell->bbox, &t, false);
+			bbox_fit_bbox(&box, &tmp);
+		}
+	}
+
+	return box;
+}
+
+static
+void project_range(double dx[4], double dy[4], double vx, double vy, double* tmin, double* tmax)
+{
+	// Range of the lattice parameter t of the points (@dx, @dy) projected on the vector (@vx, @vy).
+	// Lattice points t * v inside the box spanned by the points lie within that range.
+
+	double len2 = vx * vx + vy * vy;
+
+	*tmin = HUGE_VAL;
+	*tmax = -HUGE_VAL;
+
+	for (int i = 0; i < 4; i++) {
+		double t = (dx[i] * vx + dy[i] * vy) / len2;
+
+		*tmin = std::min(*tmin, t);
+		*tmax = std::max(*tmax, t);
+	}
+}
+
+static
+bool clamp_range(double tmin, double tmax, int n, int* first, int* last)
+{
+	tmin = std::max(0.0, floor(tmin));
+	tmax = std::min((double)(n - 1), ceil(tmax));
+
+	if (tmin > tmax)
+		return false;
+
+	*first = (int)tmin;
+	*last = (int)tmax;
+
+	return true;
+}
+
+bool aref_range(const gds_aref* aref, const gds_bbox* target, gds_aref_range* range)
+{
+	*range = {0, aref->ncols - 1, 0, aref->nrows - 1};
+
+	// Bounding box of an instance relative to its origin (the same for all instances)
+	gds_transform t = reference_transform({0, 0}, aref->mag, aref->angle, aref->strans);
+	gds_bbox inst = bbox_transform(&aref->cell->bbox, &t, false);
+
+	// An instance can only overlap the target when its origin lies in the target shrunk by the
+	// instance box (the Minkowski difference). Take its corners relative to the lattice origin.
+
+	double xmin = (double)(target->xmin - inst.xmax - AREF_SLACK - aref->vectors[0].x);
+	double ymin = (double)(target->ymin - inst.ymax - AREF_SLACK - aref->vectors[0].y);
+	double xmax = (double)(target->xmax - inst.xmin + AREF_SLACK - aref->vectors[0].x);
+	double ymax = (double)(target->ymax - inst.ymin + AREF_SLACK - aref->vectors[0].y);
+
+	double dx[4] = {xmin, xmin, xmax, xmax};
+	double dy[4] = {ymin, ymax, ymax, ymin};
+
+	double v_col_x = ((double)(aref->vectors[1].x - aref->vectors[0].x)) / aref->ncols;
+	double v_col_y = ((double)(aref->vectors[1].y - aref->vectors[0].y)) / aref->ncols;
+	double v_row_x = ((double)(aref->vectors[2].x - aref->vectors[0].x)) / aref->nrows;
+	double v_row_y = ((double)(aref->vectors[2].y - aref->vectors[0].y)) / aref->nrows;
+
+	double det = v_col_x * v_row_y - v_col_y * v_row_x;
+
+	double cmin, cmax, rmin, rmax;
+
+	if (fabs(det) > 1e-9) {
+		// Map the corners into lattice coordinates with the inverse of the lattice matrix
+		cmin = rmin = HUGE_VAL;
+		cmax = rmax = -HUGE_VAL;
+
+		for (int i = 0; i < 4; i++) {
+			double c = (dx[i] * v_row_y - dy[i] * v_row_x) / det;
+			double r = (v_col_x * dy[i] - v_col_y * dx[i]) / det;
+
+			cmin = std::min(cmin, c);
+			cmax = std::max(cmax, c);
+			rmin = std::min(rmin, r);
+			rmax = std::max(rmax, r);
+		}
+
+		return clamp_range(cmin, cmax, aref->ncols, &range->c0, &range->c1) &&
+			clamp_range(rmin, rmax, aref->nrows, &range->r0, &range->r1);
+	}
+
+	// A degenerate lattice can still be solved along its only direction when the AREF is a single
+	// column or row. Otherwise all instances are left to be tested one by one.
+
+	if (aref->ncols == 1 && (v_row_x != 0 || v_row_y != 0)) {
+		project_range(dx, dy, v_row_x, v_row_y, &rmin, &rmax);
+		return clamp_range(rmin, rmax, aref->nrows, &range->r0, &range->r1);
+	}
+
+	if (aref->nrows == 1 && (v_col_x != 0 || v_col_y != 0)) {
+		project_range(dx, dy, v_col_x, v_col_y, &cmin, &cmax);
+		return clamp_range(cmin, cmax, aref->ncols, &range->c0, &range->c1);
+	}
+
+	return true;
+}
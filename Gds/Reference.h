@@ -0,0 +1,40 @@
+#pragma once
+
+#include "BBox.h"
+#include "Cell.h"
+#include "Transform.h"
+
+#include <stdint.h>
+
+// Range of columns and rows of an AREF (both ends included)
+struct gds_aref_range
+{
+	int c0, c1;
+	int r0, r1;
+};
+
+/*
+	Transformation of a reference relative to the cell containing it
+ */
+gds_transform reference_transform(gds_pair origin, double mag, double angle, uint16_t strans);
+
+/*
+	Origin of the instance in column @c and row @r of an AREF in the coordinates of the cell
+	containing it
+ */
+gds_pair aref_origin(const gds_aref* aref, int c, int r);
+
+/*
+	Bounding box of all instances of an AREF in the coordinates of the cell containing it. The
+	instances lie on a lattice so only the (up to) four corner instances are transformed.
+ */
+gds_bbox aref_extent(const gds_aref* aref);
+
+/*
+	Find the columns and rows of an AREF whose instances can overlap @target, which is given in the
+	coordinates of the cell containing the AREF. The range is solved from the lattice vectors and the
+	bounding box of the referenced cell and may hold a few instances too many, never too few.
+
+	@return: false if no instance can overlap the target
+ */
+bool aref_range(const gds_aref* aref, const gds_bbox* target, gds_aref_range* range);
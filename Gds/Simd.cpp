@@ -0,0 +1,438 @@
+#include "Simd.h"
+
+#if !defined(GDS_NO_SIMD) && (defined(_M_X64) || defined(__x86_64__))
+#define SIMD_X86 1
+#endif
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SIMD_TARGET(isa)
+#else
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+// Doubles convert exactly to and from 64 bit integers below this magnitude with the magic number trick
+#define SIMD_EXACT_LIMIT 2251799813685248.0 // 2^51
+
+//
+// Scalar kernels
+//
+
+static
+void scalar_transform_pairs(gds_pair* out, const gds_pair* in, int npairs, const gds_transform* transform)
+{
+	for (int i = 0; i < npairs; ++i)
+		out[i] = transform_pair(in[i], transform, false);
+}
+
+static
+void scalar_fit_points(gds_bbox* self, const gds_pair* pairs, int npairs)
+{
+	for (int i = 0; i < npairs; ++i)
+		bbox_fit_point(self, pairs[i]);
+}
+
+static
+void scalar_fit_points32(gds_bbox32* self, const int32_t* xy, int npairs)
+{
+	for (int i = 0; i < npairs; i++)
+	{
+		int32_t x = xy[2 * i], y = xy[2 * i + 1];
+
+		if (x < self->xmin) self->xmin = x;
+		if (x > self->xmax) self->xmax = x;
+		if (y < self->ymin) self->ymin = y;
+		if (y > self->ymax) self->ymax = y;
+	}
+}
+
+static const gds_simd_kernels scalar_kernels = {
+	"scalar", scalar_transform_pairs, scalar_fit_points, scalar_fit_points32
+};
+
+#ifdef SIMD_X86
+
+static
+void exact_orientation(const gds_transform* t, bool* swap, int64_t* negate_x, int64_t* negate_y)
+{
+	// A Manhattan orientation at magnification 1 maps (x, y) onto (a * x, b * y) or, with @swap set,
+	// onto (a * y, b * x). The negate masks are -1 where the sign a or b is negative.
+
+	bool m = t->mirror != 0;
+
+	switch (t->quarters)
+	{
+		case 0:
+			*swap = false; *negate_x = 0; *negate_y = m ? -1 : 0;
+			break;
+		case 1:
+			*swap = true; *negate_x = m ? 0 : -1; *negate_y = 0;
+			break;
+		case 2:
+			*swap = false; *negate_x = -1; *negate_y = m ? 0 : -1;
+			break;
+		default:
+			*swap = true; *negate_x = m ? -1 : 0; *negate_y = -1;
+			break;
+	}
+}
+
+//
+// SSE4.2 kernels (one pair per register)
+//
+
+SIMD_TARGET("sse4.2")
+static inline
+__m128d sse_to_double(__m128i v, __m128i magic)
+{
+	return _mm_sub_pd(_mm_castsi128_pd(_mm_add_epi64(v, magic)), _mm_castsi128_pd(magic));
+}
+
+SIMD_TARGET("sse4.2")
+static inline
+__m128i sse_to_int(__m128d v, __m128i magic)
+{
+	return _mm_sub_epi64(_mm_castpd_si128(_mm_add_pd(v, _mm_castsi128_pd(magic))), magic);
+}
+
+SIMD_TARGET("sse4.2")
+static
+void sse_transform_pairs(gds_pair* out, const gds_pair* in, int npairs, const gds_transform* t)
+{
+	__m128i translation = _mm_set_epi64x(t->translation.y, t->translation.x);
+
+	if (t->exact)
+	{
+		bool swap;
+		int64_t nx, ny;
+		exact_orientation(t, &swap, &nx, &ny);
+
+		__m128i negate = _mm_set_epi64x(ny, nx);
+
+		for (int i = 0; i < npairs; i++)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)&in[i]);
+
+			if (swap)
+				v = _mm_shuffle_epi32(v, 0x4E);
+
+			v = _mm_sub_epi64(_mm_xor_si128(v, negate), negate);
+
+			_mm_storeu_si128((__m128i*)&out[i], _mm_add_epi64(v, translation));
+		}
+
+		return;
+	}
+
+	// x' = m0 * x + m1 * y and y' = m3 * y + m2 * x, the same products and sums as the scalar code
+	const double* m = t->m;
+	__m128d direct = _mm_set_pd(m[3], m[0]);
+	__m128d cross = _mm_set_pd(m[2], m[1]);
+
+	__m128i magic = _mm_set1_epi64x(0x4338000000000000LL); // 2^52 + 2^51
+	__m128i bias = _mm_set1_epi64x(1LL << 51);
+	__m128i span = _mm_set1_epi64x((1LL << 52) - 1);
+	__m128d limit = _mm_set1_pd(SIMD_EXACT_LIMIT);
+	__m128d abs_mask = _mm_castsi128_pd(_mm_set1_epi64x(0x7FFFFFFFFFFFFFFFLL));
+
+	for (int i = 0; i < npairs; i++)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)&in[i]);
+
+		// Coordinates beyond 2^51 do not survive the conversion, leave those to the scalar code
+		__m128i biased = _mm_add_epi64(v, bias);
+		__m128i outside = _mm_or_si128(_mm_cmpgt_epi64(_mm_setzero_si128(), biased), _mm_cmpgt_epi64(biased, span));
+
+		__m128d d = sse_to_double(v, magic);
+		__m128d r = _mm_add_pd(_mm_mul_pd(d, direct), _mm_mul_pd(_mm_shuffle_pd(d, d, 1), cross));
+		r = _mm_round_pd(r, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+
+		if (!_mm_testz_si128(outside, outside) || _mm_movemask_pd(_mm_cmplt_pd(_mm_and_pd(r, abs_mask), limit)) != 3)
+		{
+			out[i] = transform_pair(in[i], t, false);
+			continue;
+		}
+
+		_mm_storeu_si128((__m128i*)&out[i], _mm_add_epi64(sse_to_int(r, magic), translation));
+	}
+}
+
+SIMD_TARGET("sse4.2")
+static
+void sse_fit_points(gds_bbox* self, const gds_pair* pairs, int npairs)
+{
+	__m128i lo = _mm_set_epi64x(self->ymin, self->xmin);
+	__m128i hi = _mm_set_epi64x(self->ymax, self->xmax);
+
+	for (int i = 0; i < npairs; i++)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)&pairs[i]);
+
+		lo = _mm_blendv_epi8(lo, v, _mm_cmpgt_epi64(lo, v));
+		hi = _mm_blendv_epi8(hi, v, _mm_cmpgt_epi64(v, hi));
+	}
+
+	self->xmin = _mm_cvtsi128_si64(lo);
+	self->ymin = _mm_extract_epi64(lo, 1);
+	self->xmax = _mm_cvtsi128_si64(hi);
+	self->ymax = _mm_extract_epi64(hi, 1);
+}
+
+SIMD_TARGET("sse4.2")
+static
+void sse_fit_points32(gds_bbox32* self, const int32_t* xy, int npairs)
+{
+	// Two pairs per register: (x, y, x, y)
+	__m128i lo = _mm_set_epi32(self->ymin, self->xmin, self->ymin, self->xmin);
+	__m128i hi = _mm_set_epi32(self->ymax, self->xmax, self->ymax, self->xmax);
+
+	int i = 0;
+
+	for (; i + 2 <= npairs; i += 2)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)&xy[2 * i]);
+
+		lo = _mm_min_epi32(lo, v);
+		hi = _mm_max_epi32(hi, v);
+	}
+
+	lo = _mm_min_epi32(lo, _mm_shuffle_epi32(lo, 0x4E));
+	hi = _mm_max_epi32(hi, _mm_shuffle_epi32(hi, 0x4E));
+
+	self->xmin = _mm_cvtsi128_si32(lo);
+	self->ymin = _mm_extract_epi32(lo, 1);
+	self->xmax = _mm_cvtsi128_si32(hi);
+	self->ymax = _mm_extract_epi32(hi, 1);
+
+	scalar_fit_points32(self, &xy[2 * i], npairs - i);
+}
+
+static const gds_simd_kernels sse_kernels = {
+	"sse4.2", sse_transform_pairs, sse_fit_points, sse_fit_points32
+};
+
+//
+// AVX2 kernels (two pairs per register)
+//
+
+SIMD_TARGET("avx2")
+static
+void avx2_transform_pairs(gds_pair* out, const gds_pair* in, int npairs, const gds_transform* t)
+{
+	__m256i translation = _mm256_set_epi64x(t->translation.y, t->translation.x, t->translation.y, t->translation.x);
+
+	int i = 0;
+
+	if (t->exact)
+	{
+		bool swap;
+		int64_t nx, ny;
+		exact_orientation(t, &swap, &nx, &ny);
+
+		__m256i negate = _mm256_set_epi64x(ny, nx, ny, nx);
+
+		for (; i + 2 <= npairs; i += 2)
+		{
+			__m256i v = _mm256_loadu_si256((const __m256i*)&in[i]);
+
+			if (swap)
+				v = _mm256_shuffle_epi32(v, 0x4E);
+
+			v = _mm256_sub_epi64(_mm256_xor_si256(v, negate), negate);
+
+			_mm256_storeu_si256((__m256i*)&out[i], _mm256_add_epi64(v, translation));
+		}
+	} else
+	{
+		const double* m = t->m;
+		__m256d direct = _mm256_set_pd(m[3], m[0], m[3], m[0]);
+		__m256d cross = _mm256_set_pd(m[2], m[1], m[2], m[1]);
+
+		__m256i magic = _mm256_set1_epi64x(0x4338000000000000LL); // 2^52 + 2^51
+		__m256i bias = _mm256_set1_epi64x(1LL << 51);
+		__m256i span = _mm256_set1_epi64x((1LL << 52) - 1);
+		__m256d limit = _mm256_set1_pd(SIMD_EXACT_LIMIT);
+		__m256d abs_mask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7FFFFFFFFFFFFFFFLL));
+
+		for (; i + 2 <= npairs; i += 2)
+		{
+			__m256i v = _mm256_loadu_si256((const __m256i*)&in[i]);
+
+			__m256i biased = _mm256_add_epi64(v, bias);
+			__m256i outside = _mm256_or_si256(_mm256_cmpgt_epi64(_mm256_setzero_si256(), biased),
+				_mm256_cmpgt_epi64(biased, span));
+
+			__m256d d = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_add_epi64(v, magic)), _mm256_castsi256_pd(magic));
+			__m256d r = _mm256_add_pd(_mm256_mul_pd(d, direct), _mm256_mul_pd(_mm256_permute_pd(d, 0x5), cross));
+			r = _mm256_round_pd(r, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+
+			if (!_mm256_testz_si256(outside, outside) ||
+				_mm256_movemask_pd(_mm256_cmp_pd(_mm256_and_pd(r, abs_mask), limit, _CMP_LT_OQ)) != 0xF)
+			{
+				out[i] = transform_pair(in[i], t, false);
+				out[i + 1] = transform_pair(in[i + 1], t, false);
+				continue;
+			}
+
+			__m256i result = _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(r, _mm256_castsi256_pd(magic))), magic);
+
+			_mm256_storeu_si256((__m256i*)&out[i], _mm256_add_epi64(result, translation));
+		}
+	}
+
+	for (; i < npairs; i++)
+		out[i] = transform_pair(in[i], t, false);
+}
+
+SIMD_TARGET("avx2")
+static
+void avx2_fit_points(gds_bbox* self, const gds_pair* pairs, int npairs)
+{
+	__m256i lo = _mm256_set_epi64x(self->ymin, self->xmin, self->ymin, self->xmin);
+	__m256i hi = _mm256_set_epi64x(self->ymax, self->xmax, self->ymax, self->xmax);
+
+	int i = 0;
+
+	for (; i + 2 <= npairs; i += 2)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)&pairs[i]);
+
+		lo = _mm256_blendv_epi8(lo, v, _mm256_cmpgt_epi64(lo, v));
+		hi = _mm256_blendv_epi8(hi, v, _mm256_cmpgt_epi64(v, hi));
+	}
+
+	// Fold the two pairs of each register into one
+	__m128i lo2 = _mm256_extracti128_si256(lo, 1);
+	__m128i hi2 = _mm256_extracti128_si256(hi, 1);
+	__m128i lo1 = _mm256_castsi256_si128(lo);
+	__m128i hi1 = _mm256_castsi256_si128(hi);
+
+	lo1 = _mm_blendv_epi8(lo1, lo2, _mm_cmpgt_epi64(lo1, lo2));
+	hi1 = _mm_blendv_epi8(hi1, hi2, _mm_cmpgt_epi64(hi2, hi1));
+
+	self->xmin = _mm_cvtsi128_si64(lo1);
+	self->ymin = _mm_extract_epi64(lo1, 1);
+	self->xmax = _mm_cvtsi128_si64(hi1);
+	self->ymax = _mm_extract_epi64(hi1, 1);
+
+	scalar_fit_points(self, &pairs[i], npairs - i);
+}
+
+SIMD_TARGET("avx2")
+static
+void avx2_fit_points32(gds_bbox32* self, const int32_t* xy, int npairs)
+{
+	// Four pairs per register
+	__m256i lo = _mm256_set_epi32(self->ymin, self->xmin, self->ymin, self->xmin, self->ymin, self->xmin, self->ymin, self->xmin);
+	__m256i hi = _mm256_set_epi32(self->ymax, self->xmax, self->ymax, self->xmax, self->ymax, self->xmax, self->ymax, self->xmax);
+
+	int i = 0;
+
+	for (; i + 4 <= npairs; i += 4)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)&xy[2 * i]);
+
+		lo = _mm256_min_epi32(lo, v);
+		hi = _mm256_max_epi32(hi, v);
+	}
+
+	__m128i lo1 = _mm_min_epi32(_mm256_castsi256_si128(lo), _mm256_extracti128_si256(lo, 1));
+	__m128i hi1 = _mm_max_epi32(_mm256_castsi256_si128(hi), _mm256_extracti128_si256(hi, 1));
+
+	lo1 = _mm_min_epi32(lo1, _mm_shuffle_epi32(lo1, 0x4E));
+	hi1 = _mm_max_epi32(hi1, _mm_shuffle_epi32(hi1, 0x4E));
+
+	self->xmin = _mm_cvtsi128_si32(lo1);
+	self->ymin = _mm_extract_epi32(lo1, 1);
+	self->xmax = _mm_cvtsi128_si32(hi1);
+	self->ymax = _mm_extract_epi32(hi1, 1);
+
+	scalar_fit_points32(self, &xy[2 * i], npairs - i);
+}
+
+static const gds_simd_kernels avx2_kernels = {
+	"avx2", avx2_transform_pairs, avx2_fit_points, avx2_fit_points32
+};
+
+static
+int detect_kernels(const gds_simd_kernels** sets, int max)
+{
+	// The kernel sets this CPU supports, fastest first
+
+#ifdef _MSC_VER
+	int info[4];
+
+	__cpuid(info, 1);
+	bool sse42 = (info[2] & (1 << 20)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+
+	// The OS needs to save the AVX registers too
+	bool avx_usable = osxsave && avx && (_xgetbv(0) & 6) == 6;
+
+	__cpuidex(info, 7, 0);
+	bool avx2 = avx_usable && (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+
+	bool sse42 = __builtin_cpu_supports("sse4.2");
+	bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+	int n = 0;
+
+	if (avx2 && n < max)
+		sets[n++] = &avx2_kernels;
+
+	if (sse42 && n < max)
+		sets[n++] = &sse_kernels;
+
+	if (n < max)
+		sets[n++] = &scalar_kernels;
+
+	return n;
+}
+
+#else
+
+static
+int detect_kernels(const gds_simd_kernels** sets, int max)
+{
+	if (max < 1)
+		return 0;
+
+	sets[0] = &scalar_kernels;
+	return 1;
+}
+
+#endif
+
+static
+const gds_simd_kernels* best_kernels()
+{
+	const gds_simd_kernels* sets[1];
+	detect_kernels(sets, 1);
+
+	return sets[0];
+}
+
+const gds_simd_kernels* simd_kernels()
+{
+	static const gds_simd_kernels* kernels = best_kernels();
+
+	return kernels;
+}
+
+int simd_kernel_sets(const gds_simd_kernels** sets, int max)
+{
+	return detect_kernels(sets, max);
+}
+
+const gds_simd_kernels* simd_scalar_kernels()
+{
+	return &scalar_kernels;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "BBox.h"
+#include "Cell.h"
+#include "Pair.h"
+#include "Transform.h"
+
+#include <stdint.h>
+
+/*
+	Kernels over whole arrays of coordinates. An implementation is picked once at run time for the
+	instruction sets of the CPU (AVX2, SSE4.2 or plain scalar code). Building with GDS_NO_SIMD
+	defined, or for a CPU other than x86-64, leaves only the scalar kernels.
+ */
+struct gds_simd_kernels
+{
+	const char* name;
+
+	// Forward transformation of @npairs pairs from @in to @out
+	void (*transform_pairs)(gds_pair* out, const gds_pair* in, int npairs, const gds_transform* transform);
+
+	// Grow @self to fit the pairs
+	void (*fit_points)(gds_bbox* self, const gds_pair* pairs, int npairs);
+
+	// Grow @self to fit the pairs of 32 bit coordinates (x, y, x, y, ...) in @xy
+	void (*fit_points32)(gds_bbox32* self, const int32_t* xy, int npairs);
+};
+
+// The kernels for this CPU
+const gds_simd_kernels* simd_kernels();
+
+// The scalar kernels, which the vector kernels fall back on for coordinates out of their range
+const gds_simd_kernels* simd_scalar_kernels();
+
+/*
+	Store the kernels this CPU can run in @sets, the fastest first and the scalar ones last, to
+	check them against each other
+
+	@return: number of kernel sets stored (at most @max)
+ */
+int simd_kernel_sets(const gds_simd_kernels** sets, int max);
@@ -0,0 +1,687 @@
+#include "Snapshot.h"
+
+#include "Gds.h"
+#include "Index.h"
+#include "Parallel.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define SNAPSHOT_MAGIC "GDSSNAP"
+
+// Written as a native integer, so a snapshot made on a machine with another byte order is refused
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+
+// A file larger than SNAPSHOT_HASH_BLOCKS blocks is hashed by that many evenly spaced blocks only
+#define SNAPSHOT_HASH_BLOCKS 16
+#define SNAPSHOT_HASH_BLOCK_SIZE (64 << 10)
+
+#define SNAPSHOT_BUFFER_SIZE (4 << 20)
+
+/*
+	Layout of a snapshot file:
+
+	header | for every cell: boundary, path, SREF and AREF tables, index arrays, vertices | cell table
+
+	All positions are byte offsets from the start of the file and every table starts at a multiple
+	of 8 bytes, so the tables and vertices can be used in place from a mapping at any address. The
+	vertices are stored as gds_pair, the layout the elements of a cell point to.
+ */
+
+struct snapshot_range
+{
+	uint64_t offset, count;
+};
+
+struct snapshot_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint64_t size; // Size of the complete file, smaller when the writer did not finish
+
+	gds_source_key source;
+
+	double dbunit_in_uu, dbunit_in_meter;
+	uint32_t gds_version;
+	uint32_t reserved;
+
+	snapshot_range cells;
+};
+
+struct snapshot_cell
+{
+	char name[40]; // GDS_MAX_CELL_NAME + 1 rounded up to 8 bytes
+
+	gds_bbox bbox;
+	gds_layer_mask layers;
+
+	snapshot_range boundaries, paths, srefs, arefs;
+
+	// Arrays of the gds_index of the cell, empty for a cell without index
+	snapshot_range index_entries, index_nodes, index_levels;
+};
+
+struct snapshot_boundary
+{
+	uint16_t layer, datatype;
+	uint32_t npairs;
+	uint64_t pairs;
+	gds_bbox bbox;
+};
+
+struct snapshot_path
+{
+	uint16_t layer, datatype, pathtype, reserved;
+	uint32_t width;
+
+	uint32_t npairs;
+	uint64_t pairs;
+
+	uint32_t nepairs, reserved2;
+	uint64_t epairs;
+
+	gds_bbox bbox;
+};
+
+struct snapshot_sref
+{
+	uint16_t strans, reserved;
+	uint32_t cell; // Position of the referenced cell in the cell table
+
+	double angle, mag;
+	gds_pair origin;
+};
+
+struct snapshot_aref
+{
+	uint16_t strans, reserved;
+	uint32_t cell; // Position of the referenced cell in the cell table
+
+	int32_t ncols, nrows;
+	double angle, mag;
+	gds_pair vectors[3];
+};
+
+static
+uint64_t fnv1a(uint64_t hash, const uint8_t* data, size_t size)
+{
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= data[i];
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+int snapshot_source_key(const wchar_t* file, bool hash_all, gds_source_key* key)
+{
+	int result = gds_file_info(file, &key->size, &key->mtime);
+	if (result != ERR_SUCCESS)
+		return result;
+
+	gds_mapped_file map;
+	result = mapped_file_open(&map, file, MAPPED_SEQUENTIAL);
+	if (result != ERR_SUCCESS)
+		return result;
+
+	// Hashing a large file completely would take as long as parsing it. Together with the size and
+	// the modification time the sampled blocks tell apart rewritten files.
+	uint64_t hash = 14695981039346656037ull;
+	uint64_t block = SNAPSHOT_HASH_BLOCK_SIZE;
+
+	if (hash_all || map.size <= SNAPSHOT_HASH_BLOCKS * block)
+	{
+		hash = fnv1a(hash, map.data, (size_t)map.size);
+	} else
+	{
+		for (int i = 0; i < SNAPSHOT_HASH_BLOCKS; i++)
+		{
+			uint64_t start = (map.size - block) * i / (SNAPSHOT_HASH_BLOCKS - 1);
+			hash = fnv1a(hash, map.data + start, (size_t)block);
+		}
+	}
+
+	mapped_file_close(&map);
+
+	key->hash = hash;
+
+	return ERR_SUCCESS;
+}
+
+static
+bool source_equal(const gds_source_key* a, const gds_source_key* b)
+{
+	return a->size == b->size && a->mtime == b->mtime && a->hash == b->hash;
+}
+
+static
+uint64_t padded(uint64_t size)
+{
+	return (size + 7) & ~(uint64_t)7;
+}
+
+typedef struct SnapshotWriter
+{
+	FILE* file;
+	uint64_t offset; // Position of the next byte written
+	bool failed;
+} SnapshotWriter;
+
+static
+void snapshot_put(SnapshotWriter* w, const void* data, size_t size)
+{
+	// Write @size bytes and pad them to a multiple of 8
+
+	static const uint8_t zeros[8] = {0};
+
+	size_t pad = (size_t)(padded(size) - size);
+
+	if (size > 0 && fwrite(data, 1, size, w->file) != size)
+		w->failed = true;
+
+	if (pad > 0 && fwrite(zeros, 1, pad, w->file) != pad)
+		w->failed = true;
+
+	w->offset += size + pad;
+}
+
+template<typename T>
+static
+snapshot_range snapshot_put_array(SnapshotWriter* w, const T* data, size_t count)
+{
+	snapshot_range range = {count > 0 ? w->offset : 0, count};
+
+	snapshot_put(w, data, count * sizeof(T));
+
+	return range;
+}
+
+static
+snapshot_cell snapshot_put_cell(SnapshotWriter* w, const gds_cell* cell,
+	const std::unordered_map<const gds_cell*, uint32_t>& numbers, std::vector<gds_pair>* scratch)
+{
+	// Write the tables of @cell followed by the vertices they point to
+
+	snapshot_cell c;
+	memset(&c, 0, sizeof(c));
+
+	strcpy(c.name, cell->name);
+	c.bbox = cell->bbox;
+	c.layers = cell->layers;
+
+	int nboundaries = cell_boundary_count(cell);
+	const gds_index* index = cell->index;
+
+	uint64_t tables =
+		padded(nboundaries * sizeof(snapshot_boundary)) +
+		padded(cell->paths.size() * sizeof(snapshot_path)) +
+		padded(cell->srefs.size() * sizeof(snapshot_sref)) +
+		padded(cell->arefs.size() * sizeof(snapshot_aref));
+
+	if (index != NULL)
+	{
+		tables +=
+			padded(index->entries.size() * sizeof(gds_index_entry)) +
+			padded(index->nodes.size() * sizeof(gds_index_entry)) +
+			padded(index->levels.size() * sizeof(uint64_t));
+	}
+
+	uint64_t pairs = w->offset + tables;
+
+	std::vector<snapshot_boundary> boundaries(nboundaries);
+
+	for (int i = 0; i < nboundaries; i++)
+	{
+		gds_boundary b;
+		cell_boundary(cell, i, &b, scratch);
+
+		snapshot_boundary* sb = &boundaries[i];
+		memset(sb, 0, sizeof(*sb));
+
+		sb->layer = b.layer;
+		sb->datatype = b.datatype;
+		sb->npairs = (uint32_t)b.npairs;
+		sb->pairs = pairs;
+		sb->bbox = b.bbox;
+
+		pairs += b.npairs * sizeof(gds_pair);
+	}
+
+	std::vector<snapshot_path> paths(cell->paths.size());
+
+	for (size_t i = 0; i < cell->paths.size(); i++)
+	{
+		const gds_path* p = cell->paths[i];
+
+		snapshot_path* sp = &paths[i];
+		memset(sp, 0, sizeof(*sp));
+
+		sp->layer = p->layer;
+		sp->datatype = p->datatype;
+		sp->pathtype = p->pathtype;
+		sp->width = p->width;
+		sp->npairs = (uint32_t)p->npairs;
+		sp->pairs = pairs;
+		sp->nepairs = (uint32_t)p->nepairs;
+		sp->epairs = pairs + p->npairs * sizeof(gds_pair);
+		sp->bbox = p->bbox;
+
+		pairs += (p->npairs + p->nepairs) * sizeof(gds_pair);
+	}
+
+	std::vector<snapshot_sref> srefs(cell->srefs.size());
+
+	for (size_t i = 0; i < cell->srefs.size(); i++)
+	{
+		const gds_sref* sref = cell->srefs[i];
+
+		snapshot_sref* ss = &srefs[i];
+		memset(ss, 0, sizeof(*ss));
+
+		ss->strans = sref->strans;
+		ss->cell = numbers.at(sref->cell);
+		ss->angle = sref->angle;
+		ss->mag = sref->mag;
+		ss->origin = sref->origin;
+	}
+
+	std::vector<snapshot_aref> arefs(cell->arefs.size());
+
+	for (size_t i = 0; i < cell->arefs.size(); i++)
+	{
+		const gds_aref* aref = cell->arefs[i];
+
+		snapshot_aref* sa = &arefs[i];
+		memset(sa, 0, sizeof(*sa));
+
+		sa->strans = aref->strans;
+		sa->cell = numbers.at(aref->cell);
+		sa->ncols = aref->ncols;
+		sa->nrows = aref->nrows;
+		sa->angle = aref->angle;
+		sa->mag = aref->mag;
+		memcpy(sa->vectors, aref->vectors, sizeof(sa->vectors));
+	}
+
+	c.boundaries = snapshot_put_array(w, boundaries.data(), boundaries.size());
+	c.paths = snapshot_put_array(w, paths.data(), paths.size());
+	c.srefs = snapshot_put_array(w, srefs.data(), srefs.size());
+	c.arefs = snapshot_put_array(w, arefs.data(), arefs.size());
+
+	if (index != NULL)
+	{
+		std::vector<uint64_t> levels(index->levels.begin(), index->levels.end());
+
+		c.index_entries = snapshot_put_array(w, index->entries.data(), index->entries.size());
+		c.index_nodes = snapshot_put_array(w, index->nodes.data(), index->nodes.size());
+		c.index_levels = snapshot_put_array(w, levels.data(), levels.size());
+	}
+
+	// The vertices in the order they were given their offsets above
+	for (int i = 0; i < nboundaries; i++)
+	{
+		gds_boundary b;
+		cell_boundary(cell, i, &b, scratch);
+
+		snapshot_put(w, b.pairs, b.npairs * sizeof(gds_pair));
+	}
+
+	for (const gds_path* p : cell->paths)
+	{
+		snapshot_put(w, p->pairs, p->npairs * sizeof(gds_pair));
+		snapshot_put(w, p->epairs, p->nepairs * sizeof(gds_pair));
+	}
+
+	if (!w->failed && w->offset != pairs)
+		w->failed = true;
+
+	return c;
+}
+
+int snapshot_write(const wchar_t* dest, gds_db* db, const gds_source_key* key)
+{
+	// All cells need their elements, bounding box and index
+	for (gds_cell* cell : db->cell_list)
+	{
+		int result = gds_prepare_cell(db, cell);
+		if (result != ERR_SUCCESS)
+			return result;
+	}
+
+	std::unordered_map<const gds_cell*, uint32_t> numbers;
+	numbers.reserve(db->cell_list.size());
+
+	for (size_t i = 0; i < db->cell_list.size(); i++)
+		numbers[db->cell_list[i]] = (uint32_t)i;
+
+	// The snapshot is written under another name and renamed when complete, so a process opening it
+	// at the same time sees either no snapshot or a complete one
+	std::wstring temp = std::wstring(dest) + L".tmp";
+
+	FILE* file = gds_fopen(temp.c_str(), L"wb");
+
+	if (!file)
+		return ERR_FILE_OPEN;
+
+	setvbuf(file, NULL, _IOFBF, SNAPSHOT_BUFFER_SIZE);
+
+	SnapshotWriter w;
+	w.file = file;
+	w.offset = 0;
+	w.failed = false;
+
+	// Written again at the end with the position of the cell table
+	snapshot_header header;
+	memset(&header, 0, sizeof(header));
+
+	snapshot_put(&w, &header, sizeof(header));
+
+	std::vector<snapshot_cell> cells;
+	cells.reserve(db->cell_list.size());
+
+	std::vector<gds_pair> scratch;
+
+	for (const gds_cell* cell : db->cell_list)
+		cells.push_back(snapshot_put_cell(&w, cell, numbers, &scratch));
+
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = GDS_SNAPSHOT_VERSION;
+	header.byte_order = SNAPSHOT_BYTE_ORDER;
+	header.source = *key;
+	header.dbunit_in_uu = db->dbunit_in_uu;
+	header.dbunit_in_meter = db->dbunit_in_meter;
+	header.gds_version = db->version;
+	header.cells = snapshot_put_array(&w, cells.data(), cells.size());
+	header.size = w.offset;
+
+	if (fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1)
+		w.failed = true;
+
+	if (fclose(file) != 0)
+		w.failed = true;
+
+	if (w.failed)
+		return ERR_FILE_WRITE;
+
+	return gds_rename(temp.c_str(), dest);
+}
+
+int gds_write_snapshot(const wchar_t* dest, const wchar_t* source, gds_db* db)
+{
+	gds_source_key key;
+
+	int result = snapshot_source_key(source, db->options.snapshot_hash_all, &key);
+	if (result != ERR_SUCCESS)
+		return result;
+
+	return snapshot_write(dest, db, &key);
+}
+
+static
+const void* snapshot_array(const gds_mapped_file* map, snapshot_range range, size_t size)
+{
+	// The array of @range.count elements of @size bytes at @range.offset, or NULL when it does not
+	// lie within the snapshot
+
+	if (range.offset % 8 != 0 || range.offset > map->size || range.count > (map->size - range.offset) / size)
+		return NULL;
+
+	return map->data + range.offset;
+}
+
+static
+const gds_pair* snapshot_pairs(const gds_mapped_file* map, uint64_t offset, uint32_t count)
+{
+	return (const gds_pair*)snapshot_array(map, {offset, count}, sizeof(gds_pair));
+}
+
+static
+bool snapshot_load_cell(gds_db* db, const gds_mapped_file* map, const snapshot_cell* c, gds_cell* cell)
+{
+	// Create the elements of @cell from its tables. The coordinates stay in the mapping, which is
+	// read-only, and the library never writes to the coordinates of loaded elements.
+
+	const snapshot_boundary* boundaries =
+		(const snapshot_boundary*)snapshot_array(map, c->boundaries, sizeof(snapshot_boundary));
+	const snapshot_path* paths = (const snapshot_path*)snapshot_array(map, c->paths, sizeof(snapshot_path));
+	const snapshot_sref* srefs = (const snapshot_sref*)snapshot_array(map, c->srefs, sizeof(snapshot_sref));
+	const snapshot_aref* arefs = (const snapshot_aref*)snapshot_array(map, c->arefs, sizeof(snapshot_aref));
+
+	if (!boundaries || !paths || !srefs || !arefs)
+		return false;
+
+	size_t ncells = db->cell_list.size();
+
+	if (c->boundaries.count > 0)
+	{
+		gds_boundary* b = (gds_boundary*)arena_alloc(&cell->arena, c->boundaries.count * sizeof(gds_boundary));
+		if (b == NULL)
+			return false;
+
+		cell->boundaries.resize(c->boundaries.count);
+
+		for (uint64_t i = 0; i < c->boundaries.count; i++)
+		{
+			const snapshot_boundary* sb = &boundaries[i];
+
+			const gds_pair* pairs = snapshot_pairs(map, sb->pairs, sb->npairs);
+			if (pairs == NULL)
+				return false;
+
+			b[i].layer = sb->layer;
+			b[i].datatype = sb->datatype;
+			b[i].pairs = (gds_pair*)pairs;
+			b[i].npairs = (int)sb->npairs;
+			b[i].bbox = sb->bbox;
+
+			cell->boundaries[i] = &b[i];
+		}
+	}
+
+	if (c->paths.count > 0)
+	{
+		gds_path* p = (gds_path*)arena_alloc(&cell->arena, c->paths.count * sizeof(gds_path));
+		if (p == NULL)
+			return false;
+
+		cell->paths.resize(c->paths.count);
+
+		for (uint64_t i = 0; i < c->paths.count; i++)
+		{
+			const snapshot_path* sp = &paths[i];
+
+			const gds_pair* pairs = snapshot_pairs(map, sp->pairs, sp->npairs);
+			const gds_pair* epairs = snapshot_pairs(map, sp->epairs, sp->nepairs);
+			if (pairs == NULL || epairs == NULL)
+				return false;
+
+			p[i].layer = sp->layer;
+			p[i].datatype = sp->datatype;
+			p[i].pathtype = sp->pathtype;
+			p[i].width = sp->width;
+			p[i].pairs = (gds_pair*)pairs;
+			p[i].npairs = (int)sp->npairs;
+			p[i].epairs = (gds_pair*)epairs;
+			p[i].nepairs = (int)sp->nepairs;
+			p[i].bbox = sp->bbox;
+
+			cell->paths[i] = &p[i];
+		}
+	}
+
+	if (c->srefs.count > 0)
+	{
+		gds_sref* r = (gds_sref*)arena_alloc(&cell->arena, c->srefs.count * sizeof(gds_sref));
+		if (r == NULL)
+			return false;
+
+		cell->srefs.resize(c->srefs.count);
+
+		for (uint64_t i = 0; i < c->srefs.count; i++)
+		{
+			const snapshot_sref* ss = &srefs[i];
+
+			if (ss->cell >= ncells)
+				return false;
+
+			r[i].strans = ss->strans;
+			r[i].angle = ss->angle;
+			r[i].mag = ss->mag;
+			r[i].origin = ss->origin;
+			r[i].cell = db->cell_list[ss->cell];
+			strcpy(r[i].sname, r[i].cell->name);
+
+			cell->srefs[i] = &r[i];
+		}
+	}
+
+	if (c->arefs.count > 0)
+	{
+		gds_aref* r = (gds_aref*)arena_alloc(&cell->arena, c->arefs.count * sizeof(gds_aref));
+		if (r == NULL)
+			return false;
+
+		cell->arefs.resize(c->arefs.count);
+
+		for (uint64_t i = 0; i < c->arefs.count; i++)
+		{
+			const snapshot_aref* sa = &arefs[i];
+
+			if (sa->cell >= ncells)
+				return false;
+
+			r[i].strans = sa->strans;
+			r[i].ncols = sa->ncols;
+			r[i].nrows = sa->nrows;
+			r[i].angle = sa->angle;
+			r[i].mag = sa->mag;
+			memcpy(r[i].vectors, sa->vectors, sizeof(r[i].vectors));
+			r[i].cell = db->cell_list[sa->cell];
+			strcpy(r[i].sname, r[i].cell->name);
+
+			cell->arefs[i] = &r[i];
+		}
+	}
+
+	if (c->index_entries.count > 0)
+	{
+		const gds_index_entry* entries =
+			(const gds_index_entry*)snapshot_array(map, c->index_entries, sizeof(gds_index_entry));
+		const gds_index_entry* nodes =
+			(const gds_index_entry*)snapshot_array(map, c->index_nodes, sizeof(gds_index_entry));
+		const uint64_t* levels = (const uint64_t*)snapshot_array(map, c->index_levels, sizeof(uint64_t));
+
+		if (!entries || !nodes || !levels)
+			return false;
+
+		// Every hit has to name an element of the cell
+		const uint64_t counts[] = {c->boundaries.count, c->paths.count, c->srefs.count, c->arefs.count};
+
+		for (uint64_t i = 0; i < c->index_entries.count; i++)
+		{
+			if (INDEX_HIT_ELEMENT(entries[i].hit) >= counts[INDEX_HIT_KIND(entries[i].hit)])
+				return false;
+		}
+
+		for (uint64_t i = 0; i < c->index_levels.count; i++)
+		{
+			if (levels[i] > c->index_nodes.count)
+				return false;
+		}
+
+		gds_index* index = new gds_index;
+		index->entries.assign(entries, entries + c->index_entries.count);
+		index->nodes.assign(nodes, nodes + c->index_nodes.count);
+		index->levels.assign(levels, levels + c->index_levels.count);
+
+		cell->index = index;
+	}
+
+	cell->bbox = c->bbox;
+	cell->layers = c->layers;
+	cell->initialized = true;
+
+	return true;
+}
+
+int snapshot_open(gds_db* db, const wchar_t* snapshot, const gds_source_key* key)
+{
+	gds_mapped_file map;
+
+	// The cells are read where extractions take them for as long as the database is open
+	if (mapped_file_open(&map, snapshot, MAPPED_ON_DEMAND) != ERR_SUCCESS)
+		return ERR_FILE_OPEN;
+
+	const snapshot_header* header = (const snapshot_header*)map.data;
+	const snapshot_cell* cells = NULL;
+
+	bool valid = map.size >= sizeof(snapshot_header) &&
+		memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) == 0 &&
+		header->version == GDS_SNAPSHOT_VERSION &&
+		header->byte_order == SNAPSHOT_BYTE_ORDER &&
+		header->size == map.size &&
+		source_equal(&header->source, key);
+
+	if (valid)
+		cells = (const snapshot_cell*)snapshot_array(&map, header->cells, sizeof(snapshot_cell));
+
+	if (cells == NULL)
+	{
+		mapped_file_close(&map);
+		return ERR_FILE_OPEN;
+	}
+
+	size_t ncells = (size_t)header->cells.count;
+
+	// All cells exist before any is filled, so references are set by the position of their cell
+	db->cell_list.resize(ncells);
+
+	for (size_t i = 0; i < ncells; i++)
+	{
+		gds_cell* cell = new gds_cell;
+
+		memcpy(cell->name, cells[i].name, GDS_MAX_CELL_NAME);
+		cell->name[GDS_MAX_CELL_NAME] = 0;
+
+		db->cell_list[i] = cell;
+	}
+
+	std::vector<char> loaded(ncells, 0);
+
+	parallel_for((int)ncells, db->options.nthreads, [&](int i) {
+		loaded[i] = snapshot_load_cell(db, &map, &cells[i], db->cell_list[i]);
+	});
+
+	if (std::find(loaded.begin(), loaded.end(), 0) != loaded.end())
+	{
+		for (gds_cell* cell : db->cell_list)
+			delete cell;
+
+		db->cell_list.clear();
+
+		mapped_file_close(&map);
+		return ERR_FILE_OPEN;
+	}
+
+	// Like find_cell over the cell list the first cell with a given name wins
+	db->cell_index.reserve(ncells);
+
+	for (gds_cell* cell : db->cell_list)
+		db->cell_index.emplace(cell->name, cell);
+
+	db->version = (uint16_t)header->gds_version;
+	db->dbunit_in_uu = header->dbunit_in_uu;
+	db->dbunit_in_meter = header->dbunit_in_meter;
+
+	// The elements point into the mapping until the database is destructed
+	db->map = map;
+
+	return ERR_SUCCESS;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <wchar.h>
+
+class gds_db;
+
+// Version of the snapshot layout. Snapshots of another version are not opened.
+#define GDS_SNAPSHOT_VERSION 2
+
+// Identifies the GDS file a snapshot was made from
+struct gds_source_key
+{
+	uint64_t size;
+	int64_t mtime; // Nanoseconds since the epoch (see gds_file_info)
+	uint64_t hash; // FNV-1a over the whole file, or over SNAPSHOT_HASH_BLOCKS blocks spread over a large file
+};
+
+/*
+	Determine the key of the GDS file @file, hashing all of it when @hash_all is set
+
+	@return: ERR_SUCCESS or ERR_FILE_OPEN
+ */
+int snapshot_source_key(const wchar_t* file, bool hash_all, gds_source_key* key);
+
+/*
+	Fill the empty database @db from the snapshot file @snapshot when it was made from the file with
+	@key. The snapshot stays mapped for the lifetime of @db and the coordinates of the elements point
+	into the mapping.
+
+	@return: ERR_SUCCESS, or ERR_FILE_OPEN when the snapshot is missing, damaged, of another version or
+		made from another file
+ */
+int snapshot_open(gds_db* db, const wchar_t* snapshot, const gds_source_key* key);
+
+/*
+	Write a snapshot of @db, which was loaded from the file with @key, to @dest
+
+	@return: error code
+ */
+int snapshot_write(const wchar_t* dest, gds_db* db, const gds_source_key* key);
@@ -0,0 +1,165 @@
+#include "Stats.h"
+
+#include "Records.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Names of the record types for the JSON output
+static const struct
+{
+	gds_record record;
+	const char* name;
+} record_names[] = {
+	{HEADER, "HEADER"}, {BGNLIB, "BGNLIB"}, {LIBNAME, "LIBNAME"}, {UNITS, "UNITS"}, {ENDLIB, "ENDLIB"},
+	{BGNSTR, "BGNSTR"}, {STRNAME, "STRNAME"}, {ENDSTR, "ENDSTR"}, {BOUNDARY, "BOUNDARY"}, {PATH, "PATH"},
+	{SREF, "SREF"}, {AREF, "AREF"}, {TEXT, "TEXT"}, {LAYER, "LAYER"}, {DATATYPE, "DATATYPE"},
+	{WIDTH, "WIDTH"}, {XY, "XY"}, {ENDEL, "ENDEL"}, {SNAME, "SNAME"}, {COLROW, "COLROW"},
+	{TEXTNODE, "TEXTNODE"}, {NODE, "NODE"}, {TEXTTYPE, "TEXTTYPE"}, {PRESENTATION, "PRESENTATION"},
+	{STRING, "STRING"}, {STRANS, "STRANS"}, {MAG, "MAG"}, {ANGLE, "ANGLE"}, {REFLIBS, "REFLIBS"},
+	{FONTS, "FONTS"}, {PATHTYPE, "PATHTYPE"}, {GENERATIONS, "GENERATIONS"}, {ATTRTABLE, "ATTRTABLE"},
+	{ELFLAGS, "ELFLAGS"}, {NODETYPE, "NODETYPE"}, {PROPATTR, "PROPATTR"}, {PROPVALUE, "PROPVALUE"},
+	{BOX, "BOX"}, {BOXTYPE, "BOXTYPE"}, {PLEX, "PLEX"}, {BGNEXTN, "BGNEXTN"}, {ENDEXTN, "ENDEXTN"},
+	{FORMAT, "FORMAT"},
+};
+
+gds_load_stats::gds_load_stats()
+{
+	memset(records, 0, sizeof(records));
+	memset(bytes, 0, sizeof(bytes));
+
+	cells = 0;
+	allocations = 0;
+
+	parse_seconds = 0.;
+	link_seconds = 0.;
+	bbox_seconds = 0.;
+}
+
+gds_extract_stats::gds_extract_stats()
+{
+	cells_visited = 0;
+	elements_tested = 0;
+	elements_accepted = 0;
+	elements_filtered = 0;
+	references_tested = 0;
+	subtrees_pruned = 0;
+	aref_instances_skipped = 0;
+	transforms = 0;
+	allocations = 0;
+	tasks = 0;
+
+	seconds = 0.;
+}
+
+void load_stats_add(gds_load_stats* self, const gds_load_stats* other)
+{
+	for (int i = 0; i < 256; i++)
+	{
+		self->records[i] += other->records[i];
+		self->bytes[i] += other->bytes[i];
+	}
+
+	self->cells += other->cells;
+	self->allocations += other->allocations;
+
+	self->parse_seconds += other->parse_seconds;
+	self->link_seconds += other->link_seconds;
+	self->bbox_seconds += other->bbox_seconds;
+}
+
+void extract_stats_add(gds_extract_stats* self, const gds_extract_stats* other)
+{
+	self->cells_visited += other->cells_visited;
+	self->elements_tested += other->elements_tested;
+	self->elements_accepted += other->elements_accepted;
+	self->elements_filtered += other->elements_filtered;
+	self->references_tested += other->references_tested;
+	self->subtrees_pruned += other->subtrees_pruned;
+	self->aref_instances_skipped += other->aref_instances_skipped;
+	self->transforms += other->transforms;
+	self->allocations += other->allocations;
+	self->tasks += other->tasks;
+
+	self->seconds += other->seconds;
+}
+
+static void json_int(std::string* out, const char* name, int64_t value)
+{
+	char buf[64];
+	snprintf(buf, sizeof(buf), ", \"%s\": %lld", name, (long long)value);
+	out->append(buf);
+}
+
+static void json_seconds(std::string* out, const char* name, double value)
+{
+	char buf[64];
+	snprintf(buf, sizeof(buf), ", \"%s\": %.6f", name, value);
+	out->append(buf);
+}
+
+std::string gds_load_stats_json(const gds_load_stats* stats)
+{
+	std::string out = "{\"records\": {";
+
+	// Only the record types found, unknown types by their number
+	bool first = true;
+
+	for (int i = 0; i < 256; i++)
+	{
+		if (stats->records[i] == 0)
+			continue;
+
+		char number[8];
+		snprintf(number, sizeof(number), "0x%02x", i);
+
+		const char* name = number;
+		for (const auto& r : record_names)
+		{
+			if ((r.record >> 8) == i)
+				name = r.name;
+		}
+
+		char buf[128];
+		snprintf(buf, sizeof(buf), "%s\"%s\": {\"count\": %lld, \"bytes\": %lld}", first ? "" : ", ", name,
+			(long long)stats->records[i], (long long)stats->bytes[i]);
+		out.append(buf);
+
+		first = false;
+	}
+
+	out.append("}");
+
+	json_int(&out, "cells", stats->cells);
+	json_int(&out, "allocations", stats->allocations);
+	json_seconds(&out, "parse_seconds", stats->parse_seconds);
+	json_seconds(&out, "link_seconds", stats->link_seconds);
+	json_seconds(&out, "bbox_seconds", stats->bbox_seconds);
+
+	out.append("}");
+
+	return out;
+}
+
+std::string gds_extract_stats_json(const gds_extract_stats* stats)
+{
+	char buf[64];
+	snprintf(buf, sizeof(buf), "{\"cells_visited\": %lld", (long long)stats->cells_visited);
+
+	std::string out = buf;
+
+	json_int(&out, "elements_tested", stats->elements_tested);
+	json_int(&out, "elements_accepted", stats->elements_accepted);
+	json_int(&out, "elements_filtered", stats->elements_filtered);
+	json_int(&out, "references_tested", stats->references_tested);
+	json_int(&out, "subtrees_pruned", stats->subtrees_pruned);
+	json_int(&out, "aref_instances_skipped", stats->aref_instances_skipped);
+	json_int(&out, "transforms", stats->transforms);
+	json_int(&out, "allocations", stats->allocations);
+	json_int(&out, "tasks", stats->tasks);
+	json_seconds(&out, "seconds", stats->seconds);
+
+	out.append("}");
+
+	return out;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <chrono>
+#include <string>
+
+/*
+	Statistics of loading a database, collected when gds_load_options::stats is set. Cells parsed
+	later by a lazily loaded database are added when they are loaded.
+ */
+struct gds_load_stats
+{
+	gds_load_stats();
+
+	// Number and total size (including the headers) of the records of each type, by record number
+	// (the high byte of the record type in Records.h)
+	int64_t records[256];
+	int64_t bytes[256];
+
+	int64_t cells; // Cells parsed
+	int64_t allocations; // Arena blocks allocated for the elements and coordinates of the cells
+
+	double parse_seconds; // Parsing the records (only the table of contents up front when lazy)
+	double link_seconds; // Resolving the names of referenced cells
+	double bbox_seconds; // Bounding boxes, layer masks and spatial indices of the cells
+};
+
+/*
+	Statistics of one extraction, filled in when gds_extract_options::stats is set
+ */
+struct gds_extract_stats
+{
+	gds_extract_stats();
+
+	int64_t cells_visited; // Cell instances walked
+	int64_t elements_tested; // Boundaries and paths tested against the target
+	int64_t elements_accepted; // Polygons returned or handed to the visitor
+	int64_t elements_filtered; // Boundaries and paths not on a selected layer
+	int64_t references_tested; // SREFs and AREF instances tested against the target
+	int64_t subtrees_pruned; // References to cells without any selected layer
+	int64_t aref_instances_skipped; // AREF instances left out by solving the columns and rows in reach
+	int64_t transforms; // Transformations composed for references
+	int64_t allocations; // Chunks allocated for the vertices of the returned polygons
+	int64_t tasks; // Tasks of a parallel extraction
+
+	double seconds;
+};
+
+// Seconds passed since @start
+inline double stats_seconds_since(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Add the counters of @other to @self
+void load_stats_add(gds_load_stats* self, const gds_load_stats* other);
+void extract_stats_add(gds_extract_stats* self, const gds_extract_stats* other);
+
+// The statistics as a JSON object
+std::string gds_load_stats_json(const gds_load_stats* stats);
+std::string gds_extract_stats_json(const gds_extract_stats* stats);
@@ -0,0 +1,139 @@
+#include "Tiles.h"
+
+#include <algorithm>
+
+static
+int64_t grid_edge(int64_t min, int64_t extent, int n, int i)
+{
+	// Position of the edge before column (or row) @i of @n evenly splitting @extent
+	return min + extent * i / n;
+}
+
+static
+bool grid_range(int64_t min, int64_t max, int n, int64_t lo, int64_t hi, int* first, int* last)
+{
+	// The columns (or rows) overlapping the open interval (@lo, @hi), with the same test as
+	// bbox_check_overlap: edge(i) < hi and edge(i + 1) > lo
+
+	int64_t extent = max - min;
+
+	// Estimate from the position in the grid and step to the exact column, the integer division of
+	// the edges puts it at most one column off
+	int64_t clo = std::min(std::max(lo, min), max);
+	int64_t chi = std::min(std::max(hi, min), max);
+
+	int c0 = (int)std::min<int64_t>(n - 1, (clo - min) * n / extent);
+	int c1 = (int)std::min<int64_t>(n - 1, (chi - min) * n / extent);
+
+	while (c0 > 0 && grid_edge(min, extent, n, c0) > lo)
+		c0--;
+
+	while (c0 < n && grid_edge(min, extent, n, c0 + 1) <= lo)
+		c0++;
+
+	while (c1 < n - 1 && grid_edge(min, extent, n, c1 + 1) < hi)
+		c1++;
+
+	while (c1 >= 0 && grid_edge(min, extent, n, c1) >= hi)
+		c1--;
+
+	*first = c0;
+	*last = c1;
+
+	return c0 <= c1;
+}
+
+int gds_tile_count(const gds_tiles* tiles)
+{
+	return tiles->targets != NULL ? tiles->ntargets : tiles->ncols * tiles->nrows;
+}
+
+gds_bbox gds_tile_box(const gds_tiles* tiles, int tile)
+{
+	if (tiles->targets != NULL)
+		return tiles->targets[tile];
+
+	const gds_bbox* a = &tiles->area;
+
+	int c = tile % tiles->ncols;
+	int r = tile / tiles->ncols;
+
+	return {
+		grid_edge(a->xmin, a->xmax - a->xmin, tiles->ncols, c),
+		grid_edge(a->ymin, a->ymax - a->ymin, tiles->nrows, r),
+		grid_edge(a->xmin, a->xmax - a->xmin, tiles->ncols, c + 1),
+		grid_edge(a->ymin, a->ymax - a->ymin, tiles->nrows, r + 1)
+	};
+}
+
+bool tile_router_init(gds_tile_router* self, const gds_tiles* tiles)
+{
+	self->tiles = tiles;
+
+	if (tiles->targets == NULL)
+	{
+		const gds_bbox* a = &tiles->area;
+
+		if (tiles->ncols < 1 || tiles->nrows < 1 || a->xmax <= a->xmin || a->ymax <= a->ymin)
+			return false;
+
+		self->bounds = *a;
+
+		return true;
+	}
+
+	if (tiles->ntargets < 1 || (size_t)tiles->ntargets >= INDEX_MAX_ELEMENTS)
+		return false;
+
+	// The index keeps 32 bit boxes, like the coordinates of the GDSII stream
+	bbox_init(&self->bounds);
+
+	for (int i = 0; i < tiles->ntargets; i++)
+	{
+		bbox_fit_bbox(&self->bounds, &tiles->targets[i]);
+		index_add(&self->index, &tiles->targets[i], INDEX_BOUNDARY, (uint32_t)i);
+	}
+
+	index_build(&self->index);
+
+	return true;
+}
+
+void tile_route(const gds_tile_router* self, const gds_bbox* box, std::vector<uint32_t>* tiles)
+{
+	tiles->clear();
+
+	const gds_tiles* t = self->tiles;
+
+	if (t->targets == NULL)
+	{
+		int c0, c1, r0, r1;
+
+		if (!grid_range(t->area.xmin, t->area.xmax, t->ncols, box->xmin, box->xmax, &c0, &c1) ||
+			!grid_range(t->area.ymin, t->area.ymax, t->nrows, box->ymin, box->ymax, &r0, &r1))
+			return;
+
+		for (int r = r0; r <= r1; r++)
+		{
+			for (int c = c0; c <= c1; c++)
+				tiles->push_back((uint32_t)(r * t->ncols + c));
+		}
+
+		return;
+	}
+
+	// The index also returns boxes that only touch
+	index_query(&self->index, box, tiles);
+
+	size_t n = 0;
+
+	for (uint32_t hit : *tiles)
+	{
+		uint32_t i = INDEX_HIT_ELEMENT(hit);
+
+		if (bbox_check_overlap(box, &t->targets[i]))
+			(*tiles)[n++] = i;
+	}
+
+	tiles->resize(n);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "BBox.h"
+#include "Index.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+/*
+	Target boxes of a multi-tile extraction: a list of boxes or a grid of equal tiles. A polygon goes
+	to every tile its bounding box overlaps, like a gds_extract with that tile as target.
+ */
+struct gds_tiles
+{
+	// List of @ntargets target boxes in database units, or NULL for a grid
+	const gds_bbox* targets = NULL;
+	int ntargets = 0;
+
+	// Grid of @ncols by @nrows tiles splitting @area evenly, used when @targets is NULL. Tile number
+	// r * ncols + c is in column c and row r, counted from the bottom left.
+	gds_bbox area = {0, 0, 0, 0};
+	int ncols = 0, nrows = 0;
+};
+
+// Number of tiles of @tiles
+int gds_tile_count(const gds_tiles* tiles);
+
+// Target box of tile @tile
+gds_bbox gds_tile_box(const gds_tiles* tiles, int tile);
+
+/*
+	Finds the tiles a bounding box overlaps. A grid computes the columns and rows directly, a list
+	queries a spatial index over its boxes.
+ */
+struct gds_tile_router
+{
+	const gds_tiles* tiles;
+
+	gds_bbox bounds; // Bounding box of all tiles
+	gds_index index; // Over the boxes of a list of tiles
+};
+
+/*
+	Prepare @self for @tiles, which has to stay alive while @self is used
+
+	@return: false when @tiles has no tiles or an empty grid area
+ */
+bool tile_router_init(gds_tile_router* self, const gds_tiles* tiles);
+
+// Replace @tiles by the numbers of the tiles overlapping @box in increasing order
+void tile_route(const gds_tile_router* self, const gds_bbox* box, std::vector<uint32_t>* tiles);
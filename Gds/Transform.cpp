@@ -1,53 +1,171 @@
+#define _USE_MATH_DEFINES
+
 #include "Transform.h"
+#include "Simd.h"
 
 #include <assert.h>
 #include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
 
+// Angles within this many quarter turns of a multiple of 90 degrees count as Manhattan. Angles are
+// stored from the degrees of the GDSII file and are not exact multiples of pi / 2.
+#define QUARTER_TOLERANCE 1e-6
 
-static gds_pair
-AddPairs(gds_pair one, gds_pair two)
+// Cosine and sine of the quarter turns
+static const int quarter_cos[4] = {1, 0, -1, 0};
+static const int quarter_sin[4] = {0, 1, 0, -1};
+
+static int
+AngleQuarters(double angle)
 {
-	return {one.x + two.x, one.y + two.y};
+	double q = angle / M_PI_2;
+	double r = floor(q + 0.5);
+
+	if (fabs(q - r) > QUARTER_TOLERANCE)
+		return -1;
+
+	return (((int)fmod(r, 4.0)) + 4) % 4;
 }
 
-static gds_pair
-SubtractPairs(gds_pair one, gds_pair two)
+static void
+SetManhattan(gds_transform* self, int quarters)
 {
-	return {one.x - two.x, one.y - two.y};
+	// Exact matrix entries for a rotation over @quarters quarter turns
+
+	double sign = self->mirror ? -1. : 1.;
+	double c = quarter_cos[quarters] * self->magnification;
+	double s = quarter_sin[quarters] * self->magnification;
+
+	self->m[0] = c;
+	self->m[1] = -sign * s;
+	self->m[2] = s;
+	self->m[3] = sign * c;
+
+	self->quarters = quarters;
+	self->exact = self->magnification == 1.;
 }
 
 static gds_pair
-RotatePair(const gds_pair in, double angle, double mag, bool Rx)
+ExactPair(const gds_pair in, const gds_transform* t)
 {
-	double sign = Rx ? -1. : 1.;
+	// Integer transformation for the Manhattan orientations at magnification 1
 
-	double s = sin(angle);
-	double c = cos(angle);
+	int64_t x = in.x;
+	int64_t y = t->mirror ? -in.y : in.y;
 
-	int64_t x = (int64_t)(mag * (in.x * c - sign * in.y * s));
-	int64_t y = (int64_t)(mag * (in.x * s + sign * in.y * c));
+	switch (t->quarters)
+	{
+		case 0:
+			return {t->translation.x + x, t->translation.y + y};
+		case 1:
+			return {t->translation.x - y, t->translation.y + x};
+		case 2:
+			return {t->translation.x - x, t->translation.y - y};
+		default:
+			return {t->translation.x + y, t->translation.y - x};
+	}
+}
 
-	//assert(std::in_range<int32_t>(x) && std::in_range<int32_t>(y)); // They need to be in the GDSII database range of 4 byte signed integers
+void
+transform_init(gds_transform* self)
+{
+	*self = transform_make({0, 0}, 1., 0., false);
+}
+
+gds_transform
+transform_make(gds_pair translation, double magnification, double angle, bool mirror)
+{
+	gds_transform t;
+	t.translation = translation;
+	t.magnification = magnification;
+	t.angle = angle;
+	t.mirror = mirror ? 0x8000 : 0x0000;
+
+	int quarters = AngleQuarters(angle);
+
+	if (quarters >= 0)
+	{
+		SetManhattan(&t, quarters);
+	} else
+	{
+		double sign = mirror ? -1. : 1.;
+		double s = sin(angle) * magnification;
+		double c = cos(angle) * magnification;
+
+		t.m[0] = c;
+		t.m[1] = -sign * s;
+		t.m[2] = s;
+		t.m[3] = sign * c;
+
+		t.quarters = -1;
+		t.exact = false;
+	}
 
-	return { x, y };
+	return t;
+}
+
+gds_transform
+transform_compose(const gds_transform* outer, const gds_transform* inner)
+{
+	gds_transform t;
+	t.translation = transform_pair(inner->translation, outer, false);
+	t.magnification = outer->magnification * inner->magnification;
+	t.mirror = (outer->mirror != 0) != (inner->mirror != 0) ? 0x8000 : 0x0000;
+
+	// A mirror in the outer transformation turns the rotation of the inner one around
+	t.angle = outer->mirror ? outer->angle - inner->angle : outer->angle + inner->angle;
+
+	if (outer->quarters >= 0 && inner->quarters >= 0)
+	{
+		int quarters = outer->mirror ? outer->quarters - inner->quarters : outer->quarters + inner->quarters;
+
+		SetManhattan(&t, (quarters + 4) % 4);
+	} else
+	{
+		const double* a = outer->m;
+		const double* b = inner->m;
+
+		t.m[0] = a[0] * b[0] + a[1] * b[2];
+		t.m[1] = a[0] * b[1] + a[1] * b[3];
+		t.m[2] = a[2] * b[0] + a[3] * b[2];
+		t.m[3] = a[2] * b[1] + a[3] * b[3];
+
+		t.quarters = AngleQuarters(t.angle);
+		t.exact = false;
+
+		// Rotations adding up to a multiple of 90 degrees get the exact matrix again
+		if (t.quarters >= 0)
+			SetManhattan(&t, t.quarters);
+	}
+
+	return t;
 }
 
 gds_pair
 transform_pair(const gds_pair in, const gds_transform* transform, bool inv)
 {
-	gds_pair p;
+	const double* m = transform->m;
 
 	if (inv)
 	{
-		p = RotatePair(SubtractPairs(in, transform->translation), -transform->angle, 1. / transform->magnification, transform->mirror != 0x0000);
-	} else
-	{
-		p = AddPairs(transform->translation, RotatePair(in, transform->angle, transform->magnification, transform->mirror != 0x0000));
+		double x = (double)(in.x - transform->translation.x);
+		double y = (double)(in.y - transform->translation.y);
+
+		double det = m[0] * m[3] - m[1] * m[2];
+
+		return {(int64_t)((m[3] * x - m[1] * y) / det), (int64_t)((m[0] * y - m[2] * x) / det)};
 	}
 
-	return p;
+	if (transform->exact)
+		return ExactPair(in, transform);
+
+	int64_t x = (int64_t)(m[0] * in.x + m[1] * in.y);
+	int64_t y = (int64_t)(m[2] * in.x + m[3] * in.y);
+
+	//assert(std::in_range<int32_t>(x) && std::in_range<int32_t>(y)); // They need to be in the GDSII database range of 4 byte signed integers
+
+	return {transform->translation.x + x, transform->translation.y + y};
 }
 
 void
@@ -57,6 +175,12 @@ transform_pairs(gds_pair* out, const gds_pair* in, int npairs, const gds_transfo
 
 	assert(out && in);
 
+	if (!inv)
+	{
+		simd_kernels()->transform_pairs(out, in, npairs, tra);
+		return;
+	}
+
 	for (int i = 0; i < npairs; ++i)
 	{
 		out[i] = transform_pair(in[i], tra, inv);
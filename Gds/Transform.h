@@ -9,8 +9,33 @@ typedef struct Transform
 	short mirror;
 	gds_pair translation;
 	double magnification, angle;
+
+	// Precomputed linear part: x' = m[0] * x + m[1] * y, y' = m[2] * x + m[3] * y (before translation)
+	double m[4];
+
+	// Number of quarter turns (0 to 3) when the angle is a multiple of 90 degrees, otherwise -1
+	int quarters;
+
+	// Set for the eight Manhattan orientations at magnification 1, which are transformed exactly
+	// with integer arithmetic
+	bool exact;
 } gds_transform;
 
+// Set @self to the identity transformation
+void transform_init(gds_transform* self);
+
+/*
+	Transformation that mirrors in the x-axis (when @mirror is set), then magnifies and rotates over
+	@angle (in radians) and finally translates
+ */
+gds_transform transform_make(gds_pair translation, double magnification, double angle, bool mirror);
+
+/*
+	Transformation applying @inner first and @outer after it, like a reference (@inner) inside a
+	cell that is placed with @outer
+ */
+gds_transform transform_compose(const gds_transform* outer, const gds_transform* inner);
+
 gds_pair transform_pair(const gds_pair in, const gds_transform* transform, bool inv);
 
 void transform_pairs(gds_pair* out, const gds_pair* in, int npairs, const gds_transform* transform, bool inv);
@@ -1,5 +1,9 @@
+#define _USE_MATH_DEFINES
+
 #include "Gds.h"
 
+#include "File.h"
+#include "Parallel.h"
 #include "Records.h"
 
 #include <assert.h>
@@ -8,6 +12,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+#include <unordered_set>
+#include <vector>
+
 static void swap_big_endian(uint64_t* buf, uint64_t n)
 {
 	while (n > 0)
@@ -57,7 +65,7 @@ static void double_to_buffer(double value, uint8_t* buf)
 
 	tmp.b = ((uint64_t)left_byte << 56) | (mantissa & 0x00FFFFFFFFFFFFFF);
 
-	swap_big_endian(&tmp.b, 8);
+	swap_big_endian(&tmp.b, 1);
 
 	for (int i = 0; i < 8; i++)
 	{
@@ -78,63 +86,166 @@ static void int_to_buffer(char* p, int offset, int32_t n)
 	p[offset + 3] = n & 0xFF;
 }
 
-static void append_record(FILE* file, uint16_t record)
+// Records are encoded into the buffer of a writer, which goes to the file in blocks of this size
+#define WRITE_BUFFER_SIZE (4 << 20)
+
+// Polygons a thread encodes at once when a polygon set is written on several threads
+#define WRITE_CHUNK_POLYGONS 16384
+
+// Most pairs one XY record holds, its length is 16 bits
+#define WRITE_MAX_XY_PAIRS 8191
+
+typedef struct Writer
 {
-	/* Write a GDS record to a file */
+	FILE* file; // NULL when the records are only collected in the buffer
+
+	uint8_t* buf;
+	size_t size; // Bytes in use
+	size_t capacity;
+
+	bool failed; // Set when writing to the file or growing the buffer failed, or on a record that is too long
+} Writer;
+
+static void writer_init(Writer* w, FILE* file)
+{
+	w->file = file;
+	w->buf = NULL;
+	w->size = 0;
+	w->capacity = 0;
+	w->failed = false;
+}
+
+static void writer_flush(Writer* w)
+{
+	/* Write the buffer to the file */
+
+	if (w->file == NULL || w->size == 0)
+		return;
+
+	if (fwrite(w->buf, 1, w->size, w->file) != w->size)
+		w->failed = true;
+
+	w->size = 0;
+}
+
+static void writer_free(Writer* w)
+{
+	free(w->buf);
+
+	w->buf = NULL;
+	w->size = 0;
+	w->capacity = 0;
+}
+
+static uint8_t* writer_reserve(Writer* w, size_t count)
+{
+	/* Room for @count more bytes at the end of the buffer, or NULL when out of memory */
+
+	if (w->size + count > w->capacity)
+	{
+		writer_flush(w);
+
+		if (w->size + count > w->capacity)
+		{
+			size_t capacity = w->capacity > 0 ? 2 * w->capacity : WRITE_BUFFER_SIZE;
+
+			while (capacity < w->size + count)
+				capacity *= 2;
+
+			uint8_t* buf = (uint8_t*)realloc(w->buf, capacity);
+			if (buf == NULL)
+			{
+				w->failed = true;
+				return NULL;
+			}
+
+			w->buf = buf;
+			w->capacity = capacity;
+		}
+	}
+
+	uint8_t* p = w->buf + w->size;
+	w->size += count;
+
+	return p;
+}
+
+static void writer_append(Writer* w, const Writer* other)
+{
+	/* Add the bytes collected by @other; large buffers go to the file without being copied */
+
+	if (other->failed)
+		w->failed = true;
+
+	if (w->file != NULL && other->size >= WRITE_BUFFER_SIZE / 4)
+	{
+		writer_flush(w);
+
+		if (fwrite(other->buf, 1, other->size, w->file) != other->size)
+			w->failed = true;
 
-	char buf[4];
+		return;
+	}
+
+	uint8_t* p = writer_reserve(w, other->size);
+	if (p != NULL)
+		memcpy(p, other->buf, other->size);
+}
+
+static void put_header(uint8_t* p, int length, uint16_t record)
+{
+	/* The header of a record of @length bytes (including the header) */
+
+	p[0] = (length >> 8) & 0xFF;
+	p[1] = length & 0xFF;
+	p[2] = (record >> 8) & 0xFF;
+	p[3] = record & 0xFF;
+}
+
+static void append_record(Writer* w, uint16_t record)
+{
+	/* Write a GDS record to a file */
 
-	// The record header
-	buf[0] = 0;
-	buf[1] = 4;
-	buf[2] = (record >> 8) & 0xFF;
-	buf[3] = record & 0xFF;
+	uint8_t* buf = writer_reserve(w, 4);
+	if (buf == NULL)
+		return;
 
-	fwrite(buf, 4, 1, file);
+	put_header(buf, 4, record);
 }
 
-static void append_short(FILE* file, uint16_t record, uint16_t data)
+static void append_short(Writer* w, uint16_t record, uint16_t data)
 {
 	/* Write a record with a short payload to GDS file */
 
-	char buf[6];
+	uint8_t* buf = writer_reserve(w, 6);
+	if (buf == NULL)
+		return;
 
-	// The record header
-	buf[0] = 0;
-	buf[1] = 6;
-	buf[2] = (record >> 8) & 0xFF;
-	buf[3] = record & 0xFF;
+	put_header(buf, 6, record);
 
 	// The payload
 	buf[4] = (data >> 8) & 0xFF;
 	buf[5] = data & 0xFF;
-
-	fwrite(buf, 6, 1, file);
 }
 
-static void append_byte(FILE* file, uint16_t record, const char* data, int count)
+static void append_byte(Writer* w, uint16_t record, const char* data, int count)
 {
 	/* Write record with byte payload to GDS file */
 
-	char buf[4];
+	uint8_t* buf = writer_reserve(w, 4 + count);
+	if (buf == NULL)
+		return;
 
-	// The record header
-	buf[0] = ((count + 4) >> 8) & 0xFF;
-	buf[1] = (count + 4) & 0xFF;
-	buf[2] = (record >> 8) & 0xFF;
-	buf[3] = record & 0xFF;
-	fwrite(buf, 4, 1, file);
+	put_header(buf, count + 4, record);
 
 	// The payload
-	fwrite(data, count, 1, file);
+	memcpy(buf + 4, data, count);
 }
 
-static void append_string(FILE* file, uint16_t record, const char* data)
+static void append_string(Writer* w, uint16_t record, const char* data)
 {
 	 /* Write record with string payload to GDS file */
 
-	char buf[4];
-
 	int countChars = (int)strlen(data);
 
 	int record_len = countChars;
@@ -143,87 +254,339 @@ static void append_string(FILE* file, uint16_t record, const char* data)
 
 	record_len += 4; // Add 4 for the header
 
-	// The record header
-	buf[0] = (record_len >> 8) & 0xFF;
-	buf[1] = record_len & 0xFF;
-	buf[2] = (record >> 8) & 0xFF;
-	buf[3] = record & 0xFF;
+	uint8_t* buf = writer_reserve(w, record_len);
+	if (buf == NULL)
+		return;
 
-	fwrite(buf, 4, 1, file);
+	put_header(buf, record_len, record);
 
 	// The payload
-	fwrite(data, countChars, 1, file);
+	memcpy(buf + 4, data, countChars);
 
 	// Extra 0 if countChars was odd
 	if (countChars % 2)
-		putc(0, file);
+		buf[4 + countChars] = 0;
 }
 
-static void append_boundary(FILE* file, const gds_pair* p, int npairs, uint16_t layer)
+static void append_double(Writer* w, uint16_t record, double value)
 {
-	/* Add boundary element to GDS file */
+	/* Write record with a single real payload to GDS file */
+
+	uint8_t buf[8];
+	double_to_buffer(value, buf);
+
+	append_byte(w, record, (const char*)buf, 8);
+}
+
+static void append_xy(Writer* w, const gds_pair* p, int npairs)
+{
+	/* Write an XY record with the coordinates of @npairs pairs straight into the buffer */
 
-	// Allocate the buffer
-	char* buf = (char *) malloc(npairs * 8 * sizeof(char));
+	// The length would wrap around and corrupt the file
+	if (npairs > WRITE_MAX_XY_PAIRS)
+	{
+		w->failed = true;
+		return;
+	}
+
+	uint8_t* buf = writer_reserve(w, 4 + 8 * (size_t)npairs);
+	if (buf == NULL)
+		return;
+
+	put_header(buf, 4 + 8 * npairs, XY);
 
 	for (int i = 0; i < npairs; i++)
 	{
 		assert(p[i].x <= INT32_MAX && p[i].x >= INT32_MIN);
 		assert(p[i].y <= INT32_MAX && p[i].y >= INT32_MIN);
 
-		int_to_buffer(buf, 8 * i, (int32_t)p[i].x);
-		int_to_buffer(buf, 8 * i + 4, (int32_t)p[i].y);
+		int_to_buffer((char*)buf, 4 + 8 * i, (int32_t)p[i].x);
+		int_to_buffer((char*)buf, 8 + 8 * i, (int32_t)p[i].y);
 	}
+}
+
+static void append_boundary(Writer* w, const gds_pair* p, int npairs, uint16_t layer, uint16_t datatype)
+{
+	/* Add boundary element to GDS file */
 
 	// Write the necessary records to the file
-	append_record(file, BOUNDARY);
-	append_short(file, LAYER, layer);
-	append_short(file, DATATYPE, 0);
-	append_byte(file, XY, buf, 8 * npairs);
-	append_record(file, ENDEL);
+	append_record(w, BOUNDARY);
+	append_short(w, LAYER, layer);
+	append_short(w, DATATYPE, datatype);
+	append_xy(w, p, npairs);
+	append_record(w, ENDEL);
+}
 
-	free(buf);
+static void append_path(Writer* w, const gds_path* path)
+{
+	/* Add path element with its centerline to GDS file */
+
+	char width[4];
+	int_to_buffer(width, 0, (int32_t)path->width);
+
+	append_record(w, PATH);
+	append_short(w, LAYER, path->layer);
+	append_short(w, DATATYPE, path->datatype);
+	append_short(w, PATHTYPE, path->pathtype);
+	append_byte(w, WIDTH, width, 4);
+	append_xy(w, path->pairs, path->npairs);
+	append_record(w, ENDEL);
 }
 
-int gds_write(const wchar_t* dest, gds_polyset* pset, double dbunit_size_uu, double dbunit_size_in_m)
+static void append_strans(Writer* w, uint16_t strans, double mag, double angle)
 {
-	/* Write polygon set to a file */
+	/* Write the STRANS, MAG and ANGLE records of a reference when it is not a plain translation */
 
-	FILE* fp;
-	_wfopen_s(&fp, dest, L"wb");
+	if (strans == 0 && mag == 1. && angle == 0.)
+		return;
 
-	if (!fp)
-		return EXIT_FAILURE;
+	append_short(w, STRANS, strans);
+
+	if (mag != 1.)
+		append_double(w, MAG, mag);
+
+	// The angle is kept in radians
+	if (angle != 0.)
+		append_double(w, ANGLE, angle * 180.0 / M_PI);
+}
+
+static void append_sref(Writer* w, const gds_sref* sref)
+{
+	/* Add SREF element to GDS file */
+
+	append_record(w, SREF);
+	append_string(w, SNAME, sref->sname);
+	append_strans(w, sref->strans, sref->mag, sref->angle);
+	append_xy(w, &sref->origin, 1);
+	append_record(w, ENDEL);
+}
+
+static void append_aref(Writer* w, const gds_aref* aref)
+{
+	/* Add AREF element to GDS file */
+
+	char colrow[4];
+	colrow[0] = (aref->ncols >> 8) & 0xFF;
+	colrow[1] = aref->ncols & 0xFF;
+	colrow[2] = (aref->nrows >> 8) & 0xFF;
+	colrow[3] = aref->nrows & 0xFF;
+
+	append_record(w, AREF);
+	append_string(w, SNAME, aref->sname);
+	append_strans(w, aref->strans, aref->mag, aref->angle);
+	append_byte(w, COLROW, colrow, 4);
+	append_xy(w, aref->vectors, 3);
+	append_record(w, ENDEL);
+}
+
+static void append_cell(Writer* w, const gds_cell* cell, std::vector<gds_pair>* scratch)
+{
+	/* Add a structure with all its elements to GDS file */
+
+	char zeros[24] = {0};
+	append_byte(w, BGNSTR, zeros, 24);
+	append_string(w, STRNAME, cell->name);
+
+	int nboundaries = cell_boundary_count(cell);
+	for (int i = 0; i < nboundaries; i++)
+	{
+		gds_boundary b;
+		cell_boundary(cell, i, &b, scratch);
+
+		append_boundary(w, b.pairs, b.npairs, b.layer, b.datatype);
+	}
+
+	for (const gds_path* path : cell->paths)
+		append_path(w, path);
 
-	append_short(fp, HEADER, 600);
+	for (const gds_sref* sref : cell->srefs)
+		append_sref(w, sref);
+
+	for (const gds_aref* aref : cell->arefs)
+		append_aref(w, aref);
+
+	append_record(w, ENDSTR);
+}
+
+static void append_header(Writer* w, uint16_t version, double dbunit_size_uu, double dbunit_size_in_m)
+{
+	/* Write the records in front of the first structure */
+
+	append_short(w, HEADER, version);
 
 	// Just write zeros to BGNLIB
 	char zeros[24] = {0};
-	append_byte(fp, BGNLIB, zeros, 24);
+	append_byte(w, BGNLIB, zeros, 24);
 
 	// Empty library name
-	append_string(fp, LIBNAME, "");
+	append_string(w, LIBNAME, "");
 
 	// Write the units
 	uint8_t tmp[16] = {0};
 	double_to_buffer(dbunit_size_uu, tmp);
 	double_to_buffer(dbunit_size_in_m, &tmp[8]);
-	append_byte(fp, UNITS, (const char*)tmp, 16);
+	append_byte(w, UNITS, (const char*)tmp, 16);
+}
 
-	// The cell name is "TOP"
-	append_byte(fp, BGNSTR, zeros, 24);
-	append_string(fp, STRNAME, "TOP");
+static void append_polygons(Writer* w, gds_polyset* pset, size_t begin, size_t end)
+{
+	/* Add the polygons @begin up to @end of @pset as boundary elements */
 
-	for (gds_polygon* poly : *pset)
+	for (size_t i = begin; i < end; i++)
 	{
-		append_boundary(fp, poly->pairs, poly->npairs, poly->layer);
+		gds_polygon poly = (*pset)[i];
+		append_boundary(w, poly.pairs, poly.npairs, poly.layer, poly.datatype);
 	}
+}
+
+static void append_polygons_parallel(Writer* w, gds_polyset* pset, int nthreads)
+{
+	/*
+		Encode chunks of the polygons on @nthreads threads, a few chunks per thread at a time, and
+		add the encoded chunks in order. The buffers of the chunks are reused for the next batch.
+	 */
+
+	size_t nchunks = (pset->size() + WRITE_CHUNK_POLYGONS - 1) / WRITE_CHUNK_POLYGONS;
+	int batch = 4 * nthreads;
+
+	std::vector<Writer> chunks(batch);
+	for (Writer& chunk : chunks)
+		writer_init(&chunk, NULL);
+
+	for (size_t first = 0; first < nchunks && !w->failed; first += batch)
+	{
+		int n = (int)std::min((size_t)batch, nchunks - first);
+
+		parallel_for(n, nthreads, [&](int i) {
+			size_t begin = (first + i) * WRITE_CHUNK_POLYGONS;
+			size_t end = std::min(begin + WRITE_CHUNK_POLYGONS, pset->size());
+
+			chunks[i].size = 0;
+			append_polygons(&chunks[i], pset, begin, end);
+		});
+
+		for (int i = 0; i < n; i++)
+			writer_append(w, &chunks[i]);
+	}
+
+	for (Writer& chunk : chunks)
+		writer_free(&chunk);
+}
+
+static void collect_subtree(gds_cell* cell, std::unordered_set<gds_cell*>* cells)
+{
+	// Add @cell and all cells below it to @cells (each once)
+
+	if (!cells->insert(cell).second)
+		return;
+
+	for (gds_sref* sref : cell->srefs)
+		collect_subtree(sref->cell, cells);
+
+	for (gds_aref* aref : cell->arefs)
+		collect_subtree(aref->cell, cells);
+}
+
+int gds_write(const wchar_t* dest, gds_polyset* pset, double dbunit_size_uu, double dbunit_size_in_m,
+	const gds_write_options* options)
+{
+	/* Write polygon set to a file */
+
+	FILE* file = gds_fopen(dest, L"wb");
+
+	if (!file)
+		return EXIT_FAILURE;
+
+	Writer w;
+	writer_init(&w, file);
+
+	append_header(&w, 600, dbunit_size_uu, dbunit_size_in_m);
+
+	// The cell name is "TOP"
+	char zeros[24] = {0};
+	append_byte(&w, BGNSTR, zeros, 24);
+	append_string(&w, STRNAME, "TOP");
+
+	gds_write_options defaults;
+	if (options == NULL)
+		options = &defaults;
+
+	int nthreads = parallel_threads(options->nthreads);
+
+	if (nthreads > 1 && pset->size() > WRITE_CHUNK_POLYGONS)
+		append_polygons_parallel(&w, pset, nthreads);
+	else
+		append_polygons(&w, pset, 0, pset->size());
 
 	// Write the tail headers
-	append_record(fp, ENDSTR);
-	append_record(fp, ENDLIB);
+	append_record(&w, ENDSTR);
+	append_record(&w, ENDLIB);
+
+	writer_flush(&w);
+	writer_free(&w);
+
+	if (fclose(file) != 0)
+		w.failed = true;
+
+	return w.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int gds_write_db(const wchar_t* dest, gds_db* db, const char* const* cell_names, int ncells)
+{
+	/* Write cells of a database with their references to a file */
+
+	// The cells to write: the named cells and all cells below them, or all cells
+	std::unordered_set<gds_cell*> selected;
+
+	for (int i = 0; cell_names != NULL && i < ncells; i++)
+	{
+		gds_cell* cell = find_cell(db, cell_names[i]);
+		if (cell == NULL)
+			return ERR_CELL_NAME_NOT_FOUND;
+
+		int result = gds_prepare_cell(db, cell);
+		if (result != ERR_SUCCESS)
+			return result;
+
+		collect_subtree(cell, &selected);
+	}
+
+	if (cell_names == NULL)
+	{
+		for (gds_cell* cell : db->cell_list)
+		{
+			int result = gds_prepare_cell(db, cell);
+			if (result != ERR_SUCCESS)
+				return result;
+		}
+	}
+
+	FILE* file = gds_fopen(dest, L"wb");
+
+	if (!file)
+		return ERR_FILE_OPEN;
+
+	Writer w;
+	writer_init(&w, file);
+
+	append_header(&w, db->version != 0 ? db->version : 600, db->dbunit_in_uu, db->dbunit_in_meter);
+
+	// The structures keep the order of the source file
+	std::vector<gds_pair> scratch;
+
+	for (gds_cell* cell : db->cell_list)
+	{
+		if (cell_names == NULL || selected.count(cell) != 0)
+			append_cell(&w, cell, &scratch);
+	}
+
+	append_record(&w, ENDLIB);
+
+	writer_flush(&w);
+	writer_free(&w);
 
-	fclose(fp);
+	if (fclose(file) != 0)
+		w.failed = true;
 
-	return EXIT_SUCCESS;
+	return w.failed ? ERR_FILE_WRITE : ERR_SUCCESS;
 }
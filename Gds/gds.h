@@ -3,15 +3,112 @@
 #include "BBox.h"
 #include "Cell.h"
 #include "Errors.h" // Error codes for the database constructor and poly extraction
+#include "File.h"
+#include "FlatCache.h"
+#include "Layers.h"
 #include "Polyset.h"
+#include "Stats.h"
+#include "Tiles.h"
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include <mutex>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #define GDS_MAX_CELL_NAME 32
 
+// Options controlling how a GDS file is loaded into a gds_db
+struct gds_load_options
+{
+	// Map the file into memory and parse the records in place. When the file can not be mapped
+	// the records are read with stdio instead.
+	bool use_mmap = true;
+
+	// Number of threads parsing the structures of a mapped file and computing the cell sizes (0 uses
+	// all hardware threads). With more than one thread the record headers are scanned first for the
+	// structure ranges and every structure is then parsed on its own.
+	int nthreads = 1;
+
+	// Only record the byte range and the referenced cell names of every structure on a quick first
+	// pass over the record headers. The elements of a cell are parsed the first time gds_extract or
+	// the bounding box computation reaches it. Requires a mapped file; when the file can not be
+	// mapped it is loaded completely.
+	bool lazy = false;
+
+	// Store the boundaries of each cell in the compact layout of gds_compact_boundaries: one pool of
+	// 32 bit coordinates per cell with offset, count, layer and bounding box arrays
+	bool compact = false;
+
+	// Count the records by type and time the load phases in gds_db::stats
+	bool stats = false;
+
+	// Snapshot file of the parsed database, or NULL. When the snapshot was made from the same file
+	// (by size, modification time and a hash) it is mapped instead of parsing the file, and the cells
+	// come with their bounding boxes, expanded paths and indices. Otherwise the file is loaded
+	// completely and the snapshot is written for the next time. Cells opened from a snapshot are
+	// never compact.
+	const wchar_t* snapshot = NULL;
+
+	// The hash of a file over 1 MB only covers 16 blocks of 64 KB spread over it. A rewrite of the
+	// same size within the resolution of the modification time that only changes bytes between them
+	// would open a stale snapshot. Set to hash the whole file, which reads all of it.
+	bool snapshot_hash_all = false;
+};
+
+// Options controlling how gds_extract walks the reference tree
+struct gds_extract_options
+{
+	// Number of threads extracting (0 uses all hardware threads). With more than one thread the
+	// subtrees below SREFs and ranges of AREF instances become tasks of a work-stealing pool, and
+	// every thread collects its polygons in its own buffer.
+	int nthreads = 1;
+
+	// Return the polygons of a parallel extraction in the order of a single threaded extraction.
+	// Otherwise the polygon buffers of the threads are appended one after the other.
+	bool deterministic = false;
+
+	// Layers and datatypes to extract, or NULL for all. Subtrees without any of the selected layers
+	// (by the layer mask of their cell) are not walked.
+	const gds_layer_selection* layers = NULL;
+
+	// Receives the statistics of the extraction when not NULL
+	gds_extract_stats* stats = NULL;
+
+	// Cache of flattened cells, or NULL to walk every placed cell. Cells placed with a Manhattan
+	// transformation at magnification 1 are then served from the cache, with the same polygons.
+	gds_flat_cache* cache = NULL;
+
+	// Clip every polygon to the target box, so only its part inside the target is returned (see
+	// clip_polygon). A multi-tile extraction clips the polygons to every tile they go to.
+	bool clip = false;
+};
+
+// Options controlling how gds_write encodes a polygon set
+struct gds_write_options
+{
+	// Number of threads encoding the polygons (0 uses all hardware threads). With more than one
+	// thread chunks of polygons are encoded to separate buffers at the same time and written to the
+	// file in order, so the file does not depend on the number of threads.
+	int nthreads = 1;
+};
+
+// Options controlling how gds_merge joins the polygons of a polygon set
+struct gds_merge_options
+{
+	// Number of threads merging (0 uses all hardware threads). The layers, and the strips of a layer,
+	// are swept on separate threads.
+	int nthreads = 1;
+
+	// Split a layer with more edges than this into horizontal strips of about this many edges, which
+	// are swept independently, or 0 to sweep every layer at once. Trapezoids reaching over the border
+	// of two strips are cut there. The result does not depend on the number of threads.
+	int strip_edges = 0;
+};
+
 class gds_db
 {
 public:
@@ -20,17 +117,33 @@ public:
 	// The contents of the gds UNIT records
 	double dbunit_in_uu, dbunit_in_meter;
 
+	// The options the database was loaded with
+	gds_load_options options;
+
+	// Statistics of loading, only collected with gds_load_options::stats
+	gds_load_stats stats;
+
 	std::vector<gds_cell*> cell_list;
 
+	// Name to cell index over cell_list, built once after the cells are parsed
+	std::unordered_map<std::string, gds_cell*> cell_index;
+
+	// A lazily loaded database keeps its file mapped to parse cells on demand, and a database
+	// opened from a snapshot keeps the snapshot mapped
+	bool lazy;
+	gds_mapped_file map;
+	std::mutex load_mutex;
+
 	/*
 		Construct a gds_db structure from a file. A pointer to int needs to be provided for a possible
 		error code upon return.
 		
 		@file: file name of the GDS file to be loaded
 		@error: pointer to int which will be filled with 0 (success) or an error code
+		@options: load options or NULL for the defaults
 		@return: A pointer to the gds_db if succesful or NULL if loading failed
 	*/
-	gds_db(const wchar_t* file, int* error);
+	gds_db(const wchar_t* file, int* error, const gds_load_options* options = NULL);
 
 	~gds_db();
 };
@@ -38,12 +151,32 @@ public:
 // Defined in gds_expand_path.c
 int gds_expand_path(gds_pair* out, const gds_pair* in, int npairs_in, uint32_t width, uint16_t pathtype);
 
-// Defined in CellSizes.c
+// Defined in CellSizes.c. Loads and sizes all cells under the load lock of @db, so extractions may
+// run at the same time.
 void gds_cell_sizes(gds_db* db);
 
+// Print the width and height of all cells to the console
+void gds_print_cell_sizes(gds_db* db);
+
 // Find the pointer to cell with name @sname
 gds_cell* find_cell(gds_db* db, const char* name);
 
+/*
+	Parse the elements of @cell and of all cells below it when not done yet (lazily loaded database).
+	Takes no lock; use gds_prepare_cell while other threads may load cells of the same database.
+
+	@return: error code
+ */
+int gds_load_subtree(gds_db* db, gds_cell* cell);
+
+/*
+	Make sure @cell and all cells below it are loaded and have their bounding box determined. Safe to
+	call from several threads.
+
+	@return: error code
+ */
+int gds_prepare_cell(gds_db* db, gds_cell* cell);
+
 /*
 	Extract polygons from a region (given by @target) of a cell in a GDSII database
 	
@@ -52,18 +185,109 @@ gds_cell* find_cell(gds_db* db, const char* name);
 	@target: boundings box of the target area in database units
 	@resolution: polygon sized smaller than @res (in database units) are ignored
 	@pset: pointer to list of polygons
+	@options: extraction options or NULL for the defaults (single threaded)
 	@return: error code (in case of error)	
  */
 int gds_extract(gds_db* db, const char* cell_name, gds_bbox target, int64_t resolution,
-	gds_polyset* pset, int64_t* nskipped);
+	gds_polyset* pset, int64_t* nskipped, const gds_extract_options* options = NULL);
+
+/*
+	Receives one polygon found by gds_extract_visit. The vertices (in database units of the top
+	cell) live in a buffer that is reused for the next polygon, so they are only valid during the call.
+
+	@user: the pointer given to gds_extract_visit
+	@return: true to continue, false to stop the extraction
+ */
+typedef bool (*gds_polygon_visitor)(void* user, const gds_pair* pairs, int npairs, uint16_t layer, uint16_t datatype,
+	const gds_bbox* bbox);
+
+/*
+	Extract polygons like gds_extract but hand each polygon to @visitor instead of storing it, so
+	there is no limit on the number of polygons. With more than one thread in @options the visitor
+	is called concurrently from the extraction threads and the order of the polygons is not defined.
+
+	@return: error code, ERR_SUCCESS also when the visitor stopped the extraction
+ */
+int gds_extract_visit(gds_db* db, const char* cell_name, gds_bbox target, int64_t resolution,
+	gds_polygon_visitor visitor, void* user, int64_t* nskipped, const gds_extract_options* options = NULL);
+
+/*
+	Extract polygons for many target boxes in one walk over the hierarchy. The walk covers the bounding
+	box of all tiles and every polygon found is added to each tile it overlaps, so tile i gets the
+	polygons gds_extract would return for target gds_tile_box(tiles, i).
+
+	@tiles: a list of target boxes or a grid of tiles
+	@psets: one polygon set per tile (gds_tile_count(tiles) sets)
+	@return: error code, ERR_PARAM for a list without boxes or an empty grid
+ */
+int gds_extract_tiles(gds_db* db, const char* cell_name, const gds_tiles* tiles, int64_t resolution,
+	gds_polyset* psets, int64_t* nskipped, const gds_extract_options* options = NULL);
+
+/*
+	Receives one polygon of tile @tile found by gds_extract_tiles_visit. A polygon overlapping several
+	tiles is handed over once for each of them. The vertices are only valid during the call.
+
+	@return: true to continue, false to stop the extraction
+ */
+typedef bool (*gds_tile_visitor)(void* user, int tile, const gds_pair* pairs, int npairs, uint16_t layer,
+	uint16_t datatype, const gds_bbox* bbox);
+
+/*
+	Extract polygons for many target boxes like gds_extract_tiles but hand them to @visitor. With more
+	than one thread in @options the visitor is called concurrently from the extraction threads.
+
+	@return: error code, ERR_SUCCESS also when the visitor stopped the extraction
+ */
+int gds_extract_tiles_visit(gds_db* db, const char* cell_name, const gds_tiles* tiles, int64_t resolution,
+	gds_tile_visitor visitor, void* user, int64_t* nskipped, const gds_extract_options* options = NULL);
 
 
 /*
 	Write all polygon elements of a polygon set to a GDS file
 	
-	All polygons are saved as boundary elements in top cell "TOP"
+	All polygons are saved as boundary elements in top cell "TOP". A boundary holds at most 8191
+	vertices (the closing one included); the file of a set with a longer polygon is not complete and
+	EXIT_FAILURE is returned.
 	
 	@dbunit_size_uu: database size in user units
 	@dbunit_size_in_m: database size in meter
+	@options: write options or NULL for the defaults (single threaded)
+ */
+int gds_write(const wchar_t* dest, gds_polyset* pset, double dbunit_size_uu, double dbunit_size_in_m,
+	const gds_write_options* options = NULL);
+
+/*
+	Write cells of a GDSII database to a GDS file with their hierarchy: boundaries, paths (with their
+	centerline), SREF and AREF elements are written as they were read. Text, box and node elements and
+	properties are not kept by the reader and are left out.
+
+	@cell_names: names of the cells to write together with all cells below them, or NULL for all cells
+	@ncells: number of names in @cell_names
+	@return: error code
+ */
+int gds_write_db(const wchar_t* dest, gds_db* db, const char* const* cell_names = NULL, int ncells = 0);
+
+/*
+	Merge the polygons of @pset by layer and datatype into non-overlapping trapezoids covering the same
+	area, added to @merged. A scanline sweeps every layer upwards and cuts the area covered by any
+	polygon into trapezoids with horizontal top and bottom sides, joined upwards as long as their sides
+	go on straight. Polygons touching along an edge are joined as well.
+
+	Manhattan layers give rectangles and 45 degree layers trapezoids on the database grid. Where two 45
+	degree edges cross half way between two grid lines, and on other slanted edges, the corners are
+	rounded to the nearest database unit.
+
+	@options: merge options or NULL for the defaults (single threaded, one sweep per layer)
+	@return: error code
+ */
+int gds_merge(const gds_polyset* pset, gds_polyset* merged, const gds_merge_options* options = NULL);
+
+/*
+	Write a snapshot of a database that gds_load_options::snapshot opens instead of parsing @source
+	again. The snapshot holds all cells with their elements, expanded paths, bounding boxes, indices
+	and resolved references, at byte offsets so it can be used straight from a mapping.
+
+	@source: the GDS file @db was loaded from, hashed as gds_load_options::snapshot_hash_all of @db
+	@return: error code
  */
-int gds_write(const wchar_t* dest, gds_polyset* pset, double dbunit_size_uu, double dbunit_size_in_m);
+int gds_write_snapshot(const wchar_t* dest, const wchar_t* source, gds_db* db);
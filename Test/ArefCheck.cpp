@@ -0,0 +1,144 @@
+#define _USE_MATH_DEFINES
+
+#include "Checks.h"
+#include "../Gds/Reference.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Columns and rows of the largest random AREF
+#define AREF_CHECK_MAX_SIZE 40
+
+static
+void random_aref(gds_aref* aref, int kind)
+{
+	// kind 0: Manhattan lattice, 1: any lattice, 2: zero vectors, 3: collinear vectors
+
+	static const double mags[] = {1., 1., 0.5, 2.5};
+	bool rotated = check_random() % 2 != 0;
+
+	aref->mag = mags[check_random() % 4];
+	aref->angle = rotated ? (double)(check_random() % 360) * M_PI / 180 : (check_random() % 4) * M_PI_2;
+	aref->strans = check_random() % 2 != 0 ? 0x8000 : 0;
+	aref->ncols = 1 + (int)(check_random() % AREF_CHECK_MAX_SIZE);
+	aref->nrows = 1 + (int)(check_random() % AREF_CHECK_MAX_SIZE);
+
+	gds_pair origin = {check_random_coord(10000), check_random_coord(10000)};
+	// Pitches down to below a unit, where the truncated origins stray furthest from the lattice
+	int64_t pitch = check_random() % 4 == 0 ? 2 : 500;
+	gds_pair col = {check_random_coord(pitch), check_random_coord(pitch)};
+	gds_pair row = {check_random_coord(pitch), check_random_coord(pitch)};
+
+	switch (kind)
+	{
+		case 0:
+			col = {col.x, 0};
+			row = {0, row.y};
+			break;
+		case 2:
+			// A single column or row, or a degenerate lattice in both directions
+			if (check_random() % 2 != 0)
+				col = {0, 0};
+			else
+				row = {0, 0};
+
+			if (check_random() % 3 == 0)
+				col = row = {0, 0};
+
+			break;
+		case 3:
+		{
+			int64_t k = check_random_coord(3);
+			row = {k * col.x, k * col.y};
+			break;
+		}
+	}
+
+	// The vectors give the origin and the far ends of the first column and row. A remainder makes
+	// the pitch fractional, so the origins of the instances are truncated.
+	aref->vectors[0] = origin;
+	aref->vectors[1] = {origin.x + col.x * aref->ncols, origin.y + col.y * aref->ncols};
+	aref->vectors[2] = {origin.x + row.x * aref->nrows, origin.y + row.y * aref->nrows};
+
+	if (kind < 2 && check_random() % 2 != 0)
+	{
+		aref->vectors[1].x += check_random_coord(aref->ncols - 1);
+		aref->vectors[2].y += check_random_coord(aref->nrows - 1);
+
+		if (kind == 1)
+		{
+			aref->vectors[1].y += check_random_coord(aref->ncols - 1);
+			aref->vectors[2].x += check_random_coord(aref->nrows - 1);
+		}
+	}
+}
+
+static
+int check_failed(int failures, const gds_aref* aref, int c, int r, const gds_aref_range* range, bool found)
+{
+	if (failures < CHECK_MAX_PRINTED)
+	{
+		printf("--> aref check %d x %d at %.0f degrees%s: instance (%d, %d) overlaps, range %s (%d-%d, %d-%d)\n",
+			aref->ncols, aref->nrows, aref->angle * 180 / M_PI, aref->strans != 0 ? " mirrored" : "", c, r,
+			found ? "" : "none", range->c0, range->c1, range->r0, range->r1);
+	}
+
+	return failures + 1;
+}
+
+int check_arefs()
+{
+	int failures = 0;
+
+	gds_cell cell;
+
+	for (int i = 0; i < 1000; i++)
+	{
+		// The referenced cell does not need to contain its origin
+		int64_t x = check_random_coord(300), y = check_random_coord(300);
+		cell.bbox = {x, y, x + 1 + (int64_t)(check_random() % 600), y + 1 + (int64_t)(check_random() % 600)};
+
+		gds_aref aref;
+		memset(&aref, 0, sizeof(aref));
+		aref.cell = &cell;
+		random_aref(&aref, i % 4);
+
+		gds_bbox extent = aref_extent(&aref);
+
+		for (int q = 0; q < 20; q++)
+		{
+			// Targets around and inside the extent, of any size down to a point
+			int64_t w = extent.xmax - extent.xmin, h = extent.ymax - extent.ymin;
+			int64_t tx = extent.xmin - w / 4 + (int64_t)(check_random() % (uint64_t)(w + w / 2 + 1));
+			int64_t ty = extent.ymin - h / 4 + (int64_t)(check_random() % (uint64_t)(h + h / 2 + 1));
+			int64_t tw = q % 4 == 0 ? 0 : (int64_t)(check_random() % (uint64_t)(w / 3 + 1));
+			int64_t th = q % 4 == 0 ? 0 : (int64_t)(check_random() % (uint64_t)(h / 3 + 1));
+			gds_bbox target = {tx, ty, tx + tw, ty + th};
+
+			gds_aref_range range;
+			bool found = aref_range(&aref, &target, &range);
+
+			// Every instance overlapping the target needs to be in the range
+			for (int c = 0; c < aref.ncols; c++)
+			{
+				for (int r = 0; r < aref.nrows; r++)
+				{
+					gds_transform t = reference_transform(aref_origin(&aref, c, r), aref.mag, aref.angle, aref.strans);
+					gds_bbox box = bbox_transform(&cell.bbox, &t, false);
+
+					if (!bbox_check_overlap(&box, &target))
+						continue;
+
+					if (!found || c < range.c0 || c > range.c1 || r < range.r0 || r > range.r1)
+						failures = check_failed(failures, &aref, c, r, &range, found);
+				}
+			}
+		}
+	}
+
+	printf("AREF check: %d failures\n", failures);
+
+	return failures;
+}
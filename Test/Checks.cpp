@@ -0,0 +1,18 @@
+#include "Checks.h"
+
+static uint64_t random_state = 0x9E3779B97F4A7C15ull;
+
+uint64_t check_random()
+{
+	// xorshift64*
+	random_state ^= random_state >> 12;
+	random_state ^= random_state << 25;
+	random_state ^= random_state >> 27;
+
+	return random_state * 0x2545F4914F6CDD1Dull;
+}
+
+int64_t check_random_coord(int64_t range)
+{
+	return (int64_t)(check_random() % (uint64_t)(2 * range + 1)) - range;
+}
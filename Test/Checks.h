@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+
+// Failures printed in full, the others are only counted
+#define CHECK_MAX_PRINTED 10
+
+// Next number of a pseudo random sequence that is the same on every platform
+uint64_t check_random();
+
+// Pseudo random coordinate in [-@range, @range]
+int64_t check_random_coord(int64_t range);
+
+/*
+	Checks of library kernels against straightforward reference code, run by the test program before
+	it opens its database. Each prints its first failures and returns the number of failed checks.
+ */
+
+// transform_compose and the exact Manhattan path against transforming twice and a double precision
+// reference (TransformCheck.cpp)
+int check_transforms();
+
+// Every SIMD kernel set the CPU runs against the scalar kernels (SimdCheck.cpp)
+int check_simd();
+
+// gds_merge on Manhattan, 45 degree and slanted layers, also swept in strips on several threads,
+// against the area of the union of the polygons and for overlapping trapezoids (MergeCheck.cpp)
+int check_merge();
+
+// Reopening a snapshot of an unchanged GDS file, and refusing one of a rewritten file or a damaged
+// one (SnapshotCheck.cpp). Writes its files to the current directory.
+int check_snapshot();
+
+// The R-tree query of Index.cpp against a linear scan of random cells (IndexCheck.cpp)
+int check_index();
+
+// aref_range against testing every instance of random AREFs, also rotated, mirrored and with zero or
+// collinear lattice vectors (ArefCheck.cpp)
+int check_arefs();
+
+// Extraction through a gds_flat_cache against walking every placed cell of a random hierarchy,
+// clipped extraction against clipping the polygons after, and gds_extract_tiles against extracting
+// every tile on its own (ExtractCheck.cpp). Writes its file to the current directory.
+int check_extract();
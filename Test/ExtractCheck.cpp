@@ -0,0 +1,533 @@
+#define _USE_MATH_DEFINES
+
+#include "Checks.h"
+#include "../Gds/gds.h"
+#include "../Gds/Clip.h"
+#include "../Gds/Records.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define EXTRACT_CHECK_GDS "ExtractCheck.gds"
+
+// Cells with boundaries and a path only, and cells placing them, which are placed by the top cell
+#define EXTRACT_CHECK_LEAVES 3
+#define EXTRACT_CHECK_MIDS 2
+
+// Random targets of every check
+#define EXTRACT_CHECK_TARGETS 8
+
+static
+void put_record(FILE* file, uint16_t record, const uint8_t* data, int length)
+{
+	uint8_t header[4] = {(uint8_t)((length + 4) >> 8), (uint8_t)(length + 4), (uint8_t)(record >> 8), (uint8_t)record};
+
+	fwrite(header, 1, 4, file);
+	fwrite(data, 1, length, file);
+}
+
+static
+void put_shorts(FILE* file, uint16_t record, const int16_t* values, int count)
+{
+	uint8_t data[32];
+
+	for (int i = 0; i < count; i++)
+	{
+		data[2 * i] = (uint8_t)(values[i] >> 8);
+		data[2 * i + 1] = (uint8_t)values[i];
+	}
+
+	put_record(file, record, data, 2 * count);
+}
+
+static
+void put_short(FILE* file, uint16_t record, int16_t value)
+{
+	put_shorts(file, record, &value, 1);
+}
+
+static
+void put_xy(FILE* file, const gds_pair* pairs, int npairs)
+{
+	std::vector<uint8_t> data(8 * npairs);
+
+	for (int i = 0; i < 2 * npairs; i++)
+	{
+		uint32_t n = (uint32_t)(int32_t)(i % 2 == 0 ? pairs[i / 2].x : pairs[i / 2].y);
+
+		for (int b = 0; b < 4; b++)
+			data[4 * i + b] = (uint8_t)(n >> (24 - 8 * b));
+	}
+
+	put_record(file, XY, data.data(), (int)data.size());
+}
+
+static
+void put_string(FILE* file, uint16_t record, const char* s)
+{
+	// Padded to an even length with a zero byte
+	uint8_t data[GDS_MAX_CELL_NAME + 2] = {0};
+	int length = (int)strlen(s);
+
+	memcpy(data, s, length);
+	put_record(file, record, data, length + length % 2);
+}
+
+static
+void put_real(FILE* file, uint16_t record, const double* values, int count)
+{
+	// Excess 64 exponent of 16 and a 56 bit mantissa
+
+	uint8_t data[16] = {0};
+
+	for (int i = 0; i < count; i++)
+	{
+		double v = fabs(values[i]);
+		int exponent = 64;
+
+		if (v != 0)
+		{
+			for (; v >= 1; exponent++)
+				v /= 16;
+
+			for (; v < 1. / 16; exponent--)
+				v *= 16;
+		}
+
+		uint64_t mantissa = (uint64_t)ldexp(v, 56);
+		uint64_t n = (values[i] < 0 ? (uint64_t)1 << 63 : 0) | (v != 0 ? (uint64_t)exponent << 56 : 0) | mantissa;
+
+		for (int b = 0; b < 8; b++)
+			data[8 * i + b] = (uint8_t)(n >> (56 - 8 * b));
+	}
+
+	put_record(file, record, data, 8 * count);
+}
+
+static
+void put_strans(FILE* file, bool mirror, double mag, double angle)
+{
+	put_short(file, STRANS, mirror ? (int16_t)0x8000 : 0);
+
+	if (mag != 1)
+		put_real(file, MAG, &mag, 1);
+
+	if (angle != 0)
+		put_real(file, ANGLE, &angle, 1);
+}
+
+static
+void put_shape(FILE* file, int64_t range, int64_t size)
+{
+	// A rectangle, a triangle or a path on one of three layers
+
+	int64_t x = (int64_t)(check_random() % (uint64_t)range), y = (int64_t)(check_random() % (uint64_t)range);
+	int64_t w = 1 + (int64_t)(check_random() % (uint64_t)size), h = 1 + (int64_t)(check_random() % (uint64_t)size);
+	int kind = (int)(check_random() % 4);
+
+	std::vector<gds_pair> v;
+
+	if (kind == 3)
+	{
+		v = {{x, y}, {x + w, y}, {x + w, y + h}};
+
+		put_record(file, PATH, NULL, 0);
+		put_short(file, LAYER, 2);
+		put_short(file, DATATYPE, 0);
+		put_short(file, PATHTYPE, check_random() % 2 != 0 ? 2 : 0);
+		put_record(file, WIDTH, (const uint8_t*)"\0\0\0\x14", 4);
+	} else
+	{
+		if (kind == 2)
+			v = {{x, y}, {x + w, y + (int64_t)(check_random() % 30)}, {x + (int64_t)(check_random() % 20), y + h}, {x, y}};
+		else
+			v = {{x, y}, {x + w, y}, {x + w, y + h}, {x, y + h}, {x, y}};
+
+		put_record(file, BOUNDARY, NULL, 0);
+		put_short(file, LAYER, (int16_t)(1 + check_random() % 3));
+		put_short(file, DATATYPE, (int16_t)(check_random() % 2));
+	}
+
+	put_xy(file, v.data(), (int)v.size());
+	put_record(file, ENDEL, NULL, 0);
+}
+
+static
+void put_sref(FILE* file, const char* name, int64_t range)
+{
+	// Mostly placed with a Manhattan transformation at magnification 1, which the cache serves
+
+	gds_pair origin = {check_random_coord(range), check_random_coord(range)};
+	int kind = (int)(check_random() % 8);
+
+	put_record(file, SREF, NULL, 0);
+	put_string(file, SNAME, name);
+	put_strans(file, check_random() % 2 != 0, kind == 6 ? 2. : 1., kind == 7 ? 30. : 90. * (check_random() % 4));
+	put_xy(file, &origin, 1);
+	put_record(file, ENDEL, NULL, 0);
+}
+
+static
+void put_aref(FILE* file, const char* name, gds_pair origin, int ncols, int nrows, int64_t pitch, double angle)
+{
+	// Columns along x and rows along y before the rotation by @angle
+	double c = cos(angle * M_PI / 180), s = sin(angle * M_PI / 180);
+	gds_pair col = {(int64_t)llround(c * pitch * ncols), (int64_t)llround(s * pitch * ncols)};
+	gds_pair row = {(int64_t)llround(-s * pitch * nrows), (int64_t)llround(c * pitch * nrows)};
+	gds_pair v[3] = {origin, {origin.x + col.x, origin.y + col.y}, {origin.x + row.x, origin.y + row.y}};
+	int16_t colrow[2] = {(int16_t)ncols, (int16_t)nrows};
+
+	put_record(file, AREF, NULL, 0);
+	put_string(file, SNAME, name);
+	put_strans(file, false, 1., angle);
+	put_shorts(file, COLROW, colrow, 2);
+	put_xy(file, v, 3);
+	put_record(file, ENDEL, NULL, 0);
+}
+
+static
+bool write_hierarchy()
+{
+	FILE* file = fopen(EXTRACT_CHECK_GDS, "wb");
+	if (file == NULL)
+		return false;
+
+	int16_t date[12] = {2024, 1, 1, 0, 0, 0, 2024, 1, 1, 0, 0, 0};
+	double units[2] = {0.001, 1e-9};
+
+	put_short(file, HEADER, 600);
+	put_shorts(file, BGNLIB, date, 12);
+	put_string(file, LIBNAME, "CHECK");
+	put_real(file, UNITS, units, 2);
+
+	char name[GDS_MAX_CELL_NAME + 1];
+
+	for (int i = 0; i < EXTRACT_CHECK_LEAVES; i++)
+	{
+		snprintf(name, sizeof(name), "LEAF%d", i);
+
+		put_shorts(file, BGNSTR, date, 12);
+		put_string(file, STRNAME, name);
+
+		for (int k = 0; k < 8; k++)
+			put_shape(file, 1000, 300);
+
+		put_record(file, ENDSTR, NULL, 0);
+	}
+
+	for (int i = 0; i < EXTRACT_CHECK_MIDS; i++)
+	{
+		snprintf(name, sizeof(name), "MID%d", i);
+
+		put_shorts(file, BGNSTR, date, 12);
+		put_string(file, STRNAME, name);
+
+		for (int k = 0; k < 6; k++)
+			put_shape(file, 3000, 800);
+
+		char leaf[GDS_MAX_CELL_NAME + 1];
+
+		for (int k = 0; k < 10; k++)
+		{
+			snprintf(leaf, sizeof(leaf), "LEAF%d", (int)(check_random() % EXTRACT_CHECK_LEAVES));
+			put_sref(file, leaf, 3000);
+		}
+
+		put_aref(file, "LEAF0", {-4000, 0}, 3, 2, 1200, 0.);
+		put_record(file, ENDSTR, NULL, 0);
+	}
+
+	put_shorts(file, BGNSTR, date, 12);
+	put_string(file, STRNAME, "TOP");
+
+	for (int k = 0; k < 3; k++)
+		put_shape(file, 20000, 5000);
+
+	for (int k = 0; k < 12; k++)
+	{
+		snprintf(name, sizeof(name), "MID%d", k % EXTRACT_CHECK_MIDS);
+		put_sref(file, name, 20000);
+	}
+
+	put_aref(file, "MID0", {-30000, -30000}, 3, 3, 9000, 0.);
+	put_aref(file, "MID1", {30000, -30000}, 2, 3, 9000, 90.);
+	put_aref(file, "MID1", {-30000, 30000}, 2, 2, 9000, 45.);
+
+	put_record(file, ENDSTR, NULL, 0);
+	put_record(file, ENDLIB, NULL, 0);
+
+	return fclose(file) == 0;
+}
+
+static
+void polygon_keys(const gds_polyset* pset, std::vector<std::string>* keys)
+{
+	// One string per polygon with its layer, datatype and vertices, sorted so the order of the
+	// polygons does not matter
+
+	keys->clear();
+
+	for (size_t i = 0; i < pset->size(); i++)
+	{
+		gds_polygon p = (*pset)[i];
+		std::string key((const char*)&p.layer, sizeof(p.layer));
+
+		key.append((const char*)&p.datatype, sizeof(p.datatype));
+		key.append((const char*)p.pairs, p.npairs * sizeof(gds_pair));
+		keys->push_back(key);
+	}
+
+	std::sort(keys->begin(), keys->end());
+}
+
+static
+gds_bbox random_target(const gds_bbox* extent, int i)
+{
+	// The whole extent, or a part of it of any size
+
+	if (i == 0)
+		return *extent;
+
+	int64_t w = extent->xmax - extent->xmin, h = extent->ymax - extent->ymin;
+	int64_t x = extent->xmin + (int64_t)(check_random() % (uint64_t)(w + 1));
+	int64_t y = extent->ymin + (int64_t)(check_random() % (uint64_t)(h + 1));
+
+	return {x, y, x + (int64_t)(check_random() % (uint64_t)(w / 2 + 1)), y + (int64_t)(check_random() % (uint64_t)(h / 2 + 1))};
+}
+
+static
+int check_failed(int failures, const char* what, const gds_bbox* target, size_t got, size_t expected)
+{
+	if (failures < CHECK_MAX_PRINTED)
+	{
+		printf("--> extract check %s at (%lld, %lld)-(%lld, %lld): %zu polygons, expected %zu\n", what,
+			(long long)target->xmin, (long long)target->ymin, (long long)target->xmax, (long long)target->ymax, got,
+			expected);
+	}
+
+	return failures + 1;
+}
+
+static
+int check_cache(int failures, gds_db* db, const gds_bbox* extent)
+{
+	// Cached extractions, on one and on several threads, against walking every placed cell. The
+	// cache stays filled from one target to the next.
+
+	gds_flat_cache cache;
+	std::vector<std::string> expected, keys;
+
+	for (int i = 0; i < EXTRACT_CHECK_TARGETS; i++)
+	{
+		gds_bbox target = random_target(extent, i);
+		int64_t resolution = i % 3 == 2 ? 150 : 0, nskipped = 0;
+
+		gds_polyset walked;
+		int walk_result = gds_extract(db, "TOP", target, resolution, &walked, &nskipped);
+		polygon_keys(&walked, &expected);
+
+		for (int nthreads = 1; nthreads <= 4; nthreads += 3)
+		{
+			gds_extract_options options;
+			options.cache = &cache;
+			options.nthreads = nthreads;
+
+			gds_polyset cached;
+			int result = gds_extract(db, "TOP", target, resolution, &cached, &nskipped, &options);
+			polygon_keys(&cached, &keys);
+
+			if (result != walk_result || keys != expected)
+				failures = check_failed(failures, nthreads > 1 ? "cache threads" : "cache", &target, keys.size(), expected.size());
+		}
+	}
+
+	if (cache.hits == 0)
+		failures = check_failed(failures, "cache hits", extent, 0, 1);
+
+	return failures;
+}
+
+static
+int check_clip(int failures, gds_db* db, const gds_bbox* extent)
+{
+	// Clipped extractions, also on several threads and through the cache, against clipping every
+	// polygon of the unclipped extraction. The vertices of the clipped polygons stay inside the target.
+
+	gds_flat_cache cache;
+	std::vector<gds_pair> clipped, scratch;
+	std::vector<std::string> expected, keys;
+
+	for (int i = 0; i < EXTRACT_CHECK_TARGETS; i++)
+	{
+		gds_bbox target = random_target(extent, i);
+		int64_t nskipped = 0;
+
+		gds_polyset whole, reference;
+		int whole_result = gds_extract(db, "TOP", target, 0, &whole, &nskipped);
+
+		for (size_t k = 0; k < whole.size(); k++)
+		{
+			gds_polygon p = whole[k];
+
+			// Polygons inside the target, and the center lines of paths there, are left as they are
+			if (!clip_needed(&p.bbox, &target))
+			{
+				memcpy(gds_polyset_add(&reference, p.npairs, p.layer, p.datatype, &p.bbox), p.pairs, p.npairs * sizeof(gds_pair));
+				continue;
+			}
+
+			int npairs = clip_polygon(p.pairs, p.npairs, &target, &clipped, &scratch);
+
+			if (npairs > 0)
+				memcpy(gds_polyset_add(&reference, npairs, p.layer, p.datatype, &p.bbox), clipped.data(), npairs * sizeof(gds_pair));
+		}
+
+		polygon_keys(&reference, &expected);
+
+		for (int variant = 0; variant < 3; variant++)
+		{
+			static const char* variants[] = {"clip", "clip threads", "clip cache"};
+
+			gds_extract_options options;
+			options.clip = true;
+			options.nthreads = variant == 1 ? 4 : 1;
+			options.cache = variant == 2 ? &cache : NULL;
+
+			gds_polyset out;
+			int result = gds_extract(db, "TOP", target, 0, &out, &nskipped, &options);
+			polygon_keys(&out, &keys);
+
+			bool inside = true;
+
+			for (size_t k = 0; k < out.size(); k++)
+			{
+				gds_polygon p = out[k];
+
+				gds_bbox box;
+				bbox_init(&box);
+				bbox_fit_points(&box, p.pairs, p.npairs);
+
+				inside = inside && box.xmin >= target.xmin && box.ymin >= target.ymin && box.xmax <= target.xmax &&
+					box.ymax <= target.ymax;
+			}
+
+			if (result != whole_result || keys != expected || !inside)
+				failures = check_failed(failures, variants[variant], &target, keys.size(), expected.size());
+		}
+	}
+
+	return failures;
+}
+
+static
+int check_tiles(int failures, gds_db* db, const gds_bbox* extent)
+{
+	// Multi-tile extractions of grids and of lists of overlapping boxes, clipped or not and on one
+	// or four threads, against extracting every tile on its own
+
+	std::vector<std::string> expected, keys;
+
+	for (int i = 0; i < EXTRACT_CHECK_TARGETS; i++)
+	{
+		gds_tiles tiles;
+		gds_bbox boxes[6];
+
+		if (i % 2 == 0)
+		{
+			tiles.area = random_target(extent, i);
+			tiles.ncols = 1 + (int)(check_random() % 4);
+			tiles.nrows = 1 + (int)(check_random() % 4);
+		} else
+		{
+			tiles.ntargets = 1 + (int)(check_random() % 6);
+			tiles.targets = boxes;
+
+			for (int k = 0; k < tiles.ntargets; k++)
+				boxes[k] = random_target(extent, 1);
+		}
+
+		int ntiles = gds_tile_count(&tiles);
+
+		for (int variant = 0; variant < 4; variant++)
+		{
+			static const char* variants[] = {"tiles", "tiles clip", "tiles threads", "tiles clip threads"};
+
+			gds_extract_options options;
+			options.clip = variant % 2 != 0;
+			options.nthreads = variant >= 2 ? 4 : 1;
+
+			gds_polyset* psets = new gds_polyset[ntiles];
+			int64_t nskipped = 0;
+			int result = gds_extract_tiles(db, "TOP", &tiles, 0, psets, &nskipped, &options);
+
+			gds_extract_options single;
+			single.clip = options.clip;
+
+			bool found = false;
+			size_t ngot = 0, nexpected = 0;
+
+			for (int t = 0; t < ntiles; t++)
+			{
+				gds_bbox target = gds_tile_box(&tiles, t);
+
+				gds_polyset tile;
+				found = gds_extract(db, "TOP", target, 0, &tile, &nskipped, &single) == ERR_SUCCESS || found;
+				polygon_keys(&tile, &expected);
+				polygon_keys(&psets[t], &keys);
+
+				ngot += keys.size();
+				nexpected += expected.size();
+
+				if (keys != expected)
+					failures = check_failed(failures, variants[variant], &target, keys.size(), expected.size());
+			}
+
+			// Tiles that together have no polygons give an error like a single extraction
+			if ((result == ERR_SUCCESS) != found)
+				failures = check_failed(failures, variants[variant], &tiles.area, ngot, nexpected);
+
+			delete[] psets;
+		}
+	}
+
+	return failures;
+}
+
+int check_extract()
+{
+	if (!write_hierarchy())
+	{
+		printf("--> extract check: could not write %s\n", EXTRACT_CHECK_GDS);
+		return 1;
+	}
+
+	int failures = 0;
+
+	int result = ERR_SUCCESS;
+	gds_db* db = new gds_db(L"" EXTRACT_CHECK_GDS, &result);
+	gds_cell* top = find_cell(db, "TOP");
+
+	if (result != ERR_SUCCESS || top == NULL)
+	{
+		printf("--> extract check: error %d loading %s\n", result, EXTRACT_CHECK_GDS);
+		failures++;
+	} else
+	{
+		failures = check_cache(failures, db, &top->bbox);
+		failures = check_clip(failures, db, &top->bbox);
+		failures = check_tiles(failures, db, &top->bbox);
+	}
+
+	delete db;
+	remove(EXTRACT_CHECK_GDS);
+
+	printf("Extract check: %d failures\n", failures);
+
+	return failures;
+}
@@ -0,0 +1,93 @@
+#include "Checks.h"
+#include "../Gds/Index.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+// Elements of the largest random cell
+#define INDEX_CHECK_MAX_ELEMENTS 3000
+
+static
+gds_bbox random_box(int64_t range, int64_t max_size)
+{
+	// Also points and boxes without width or height
+
+	int64_t x = check_random_coord(range), y = check_random_coord(range);
+	int64_t w = check_random() % 4 == 0 ? 0 : (int64_t)(check_random() % (uint64_t)(max_size + 1));
+	int64_t h = check_random() % 4 == 0 ? 0 : (int64_t)(check_random() % (uint64_t)(max_size + 1));
+
+	return {x, y, x + w, y + h};
+}
+
+static
+bool touches(const gds_bbox* a, const gds_bbox* b)
+{
+	return a->xmin <= b->xmax && a->xmax >= b->xmin && a->ymin <= b->ymax && a->ymax >= b->ymin;
+}
+
+int check_index()
+{
+	int failures = 0;
+
+	for (int c = 0; c < 200; c++)
+	{
+		// Cells of every size from a few elements up, spread wide or packed into a small area
+		int nelements = 1 + (int)(check_random() % INDEX_CHECK_MAX_ELEMENTS);
+		int64_t range = c % 2 == 0 ? 1000000 : 2000;
+		int64_t max_size = c % 3 == 0 ? range : range / 50;
+
+		gds_index index;
+		std::vector<gds_bbox> boxes[4];
+
+		for (int i = 0; i < nelements; i++)
+		{
+			int kind = (int)(check_random() % 4);
+			gds_bbox box = random_box(range, max_size);
+
+			index_add(&index, &box, (gds_index_kind)kind, (uint32_t)boxes[kind].size());
+			boxes[kind].push_back(box);
+		}
+
+		index_build(&index);
+
+		std::vector<uint32_t> hits, expected;
+
+		for (int q = 0; q < 50; q++)
+		{
+			gds_bbox query = random_box(range + range / 10, q % 5 == 0 ? 2 * range : range / 10);
+
+			// The linear scan gives the hits in the order of the element lists
+			expected.clear();
+
+			for (int kind = 0; kind < 4; kind++)
+			{
+				for (size_t i = 0; i < boxes[kind].size(); i++)
+				{
+					if (touches(&boxes[kind][i], &query))
+						expected.push_back(INDEX_HIT(kind, i));
+				}
+			}
+
+			hits.clear();
+			index_query(&index, &query, &hits);
+
+			if (hits != expected)
+			{
+				if (failures < CHECK_MAX_PRINTED)
+				{
+					printf("--> index check cell %d of %d elements: %zu hits for (%lld, %lld)-(%lld, %lld), expected %zu\n",
+						c, nelements, hits.size(), (long long)query.xmin, (long long)query.ymin, (long long)query.xmax,
+						(long long)query.ymax, expected.size());
+				}
+
+				failures++;
+			}
+		}
+	}
+
+	printf("Index check: %d failures\n", failures);
+
+	return failures;
+}
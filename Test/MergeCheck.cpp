@@ -0,0 +1,345 @@
+#include "Checks.h"
+#include "../Gds/gds.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+// Polygons of one run, on two layers of a square of this many units
+#define MERGE_CHECK_POLYGONS 40
+#define MERGE_CHECK_SIZE 200
+
+// Layers of the polygons of a run, merged separately
+#define MERGE_CHECK_LAYERS 2
+
+struct MergeCase
+{
+	const char* name;
+	int shapes; // 0: rectangles, 1: octagons with 45 degree corners, 2: triangles, 3: all of them
+	int strip_edges;
+	int nthreads;
+	double area_tolerance; // Area of the rounded corners per vertex of the trapezoids
+};
+
+static const MergeCase merge_cases[] = {
+	{"manhattan", 0, 0, 1, 0.},
+	{"45 degree", 1, 0, 1, 0.05},
+	{"slanted", 2, 0, 1, 0.25},
+	{"strips", 3, 16, 4, 0.25}
+};
+
+static
+void add_shape(gds_polyset* pset, int shapes, uint16_t layer)
+{
+	int64_t x = check_random() % MERGE_CHECK_SIZE, y = check_random() % MERGE_CHECK_SIZE;
+	int64_t w = 1 + check_random() % 40, h = 1 + check_random() % 40;
+
+	if (shapes == 3)
+		shapes = check_random() % 3;
+
+	std::vector<gds_pair> v;
+
+	if (shapes == 0)
+	{
+		v = {{x, y}, {x + w, y}, {x + w, y + h}, {x, y + h}};
+	} else if (shapes == 1)
+	{
+		int64_t c = 1 + check_random() % 10;
+		v = {{x + c, y}, {x + w + c, y}, {x + w + 2 * c, y + c}, {x + w + 2 * c, y + h + c},
+			{x + w + c, y + h + 2 * c}, {x + c, y + h + 2 * c}, {x, y + h + c}, {x, y + c}};
+	} else
+	{
+		v = {{x, y}, {x + w, y + (int64_t)(check_random() % 30)}, {x + (int64_t)(check_random() % 20), y + h}};
+	}
+
+	// Either orientation
+	if (check_random() % 2 != 0)
+		std::reverse(v.begin(), v.end());
+
+	v.push_back(v[0]);
+
+	gds_bbox box;
+	bbox_init(&box);
+	bbox_fit_points(&box, v.data(), (int)v.size());
+
+	gds_pair* pairs = gds_polyset_add(pset, (int)v.size(), layer, 0, &box);
+	memcpy(pairs, v.data(), v.size() * sizeof(gds_pair));
+}
+
+static
+double polygon_area(const gds_polygon& p)
+{
+	double area = 0;
+
+	for (int i = 0; i + 1 < p.npairs; i++)
+		area += (double)p.pairs[i].x * p.pairs[i + 1].y - (double)p.pairs[i + 1].x * p.pairs[i].y;
+
+	return fabs(area) / 2;
+}
+
+static
+void add_crossings(std::vector<double>* out, const gds_polygon& p, double x)
+{
+	// Heights where the edges of @p cross the vertical line at @x, not through a vertex
+
+	for (int i = 0; i + 1 < p.npairs; i++)
+	{
+		gds_pair a = p.pairs[i], b = p.pairs[i + 1];
+
+		if ((a.x < x) != (b.x < x))
+			out->push_back(a.y + (double)(b.y - a.y) * (x - a.x) / (double)(b.x - a.x));
+	}
+}
+
+static
+double union_area(const gds_polyset* pset, uint16_t layer)
+{
+	// The slabs between the x of all vertices and edge crossings have the same edges from left to
+	// right, so the length covered at the middle of a slab times its width is its area
+
+	std::vector<gds_polygon> polys;
+	std::vector<double> xs;
+
+	for (size_t i = 0; i < pset->size(); i++)
+	{
+		if ((*pset)[i].layer == layer)
+			polys.push_back((*pset)[i]);
+	}
+
+	std::vector<std::pair<gds_pair, gds_pair>> edges;
+
+	for (const gds_polygon& p : polys)
+	{
+		for (int i = 0; i + 1 < p.npairs; i++)
+		{
+			xs.push_back((double)p.pairs[i].x);
+			edges.push_back({p.pairs[i], p.pairs[i + 1]});
+		}
+	}
+
+	for (size_t i = 0; i < edges.size(); i++)
+	{
+		for (size_t j = i + 1; j < edges.size(); j++)
+		{
+			gds_pair a = edges[i].first, b = edges[i].second, c = edges[j].first, d = edges[j].second;
+
+			double dx1 = (double)(b.x - a.x), dy1 = (double)(b.y - a.y);
+			double dx2 = (double)(d.x - c.x), dy2 = (double)(d.y - c.y);
+			double det = dx1 * dy2 - dy1 * dx2;
+
+			if (det == 0)
+				continue;
+
+			double t = ((c.x - a.x) * dy2 - (c.y - a.y) * dx2) / det;
+			double u = ((c.x - a.x) * dy1 - (c.y - a.y) * dx1) / det;
+
+			if (t > 0 && t < 1 && u > 0 && u < 1)
+				xs.push_back(a.x + t * dx1);
+		}
+	}
+
+	std::sort(xs.begin(), xs.end());
+
+	double area = 0;
+	std::vector<double> ys;
+	std::vector<std::pair<double, double>> covered;
+
+	for (size_t i = 0; i + 1 < xs.size(); i++)
+	{
+		if (xs[i + 1] <= xs[i])
+			continue;
+
+		double x = (xs[i] + xs[i + 1]) / 2;
+		covered.clear();
+
+		for (const gds_polygon& p : polys)
+		{
+			ys.clear();
+			add_crossings(&ys, p, x);
+			std::sort(ys.begin(), ys.end());
+
+			for (size_t k = 0; k + 1 < ys.size(); k += 2)
+				covered.push_back({ys[k], ys[k + 1]});
+		}
+
+		std::sort(covered.begin(), covered.end());
+
+		double length = 0, top = -INFINITY;
+
+		for (const std::pair<double, double>& c : covered)
+		{
+			if (c.second > top)
+			{
+				length += c.second - std::max(c.first, top);
+				top = c.second;
+			}
+		}
+
+		area += (xs[i + 1] - xs[i]) * length;
+	}
+
+	return area;
+}
+
+static
+void trapezoid_span(const gds_polygon& p, double y, double* left, double* right)
+{
+	// Sides of a trapezoid at a height between its bottom and top
+
+	*left = INFINITY;
+	*right = -INFINITY;
+
+	for (int i = 0; i + 1 < p.npairs; i++)
+	{
+		gds_pair a = p.pairs[i], b = p.pairs[i + 1];
+
+		if ((a.y < y) != (b.y < y))
+		{
+			double x = a.x + (double)(b.x - a.x) * (y - a.y) / (double)(b.y - a.y);
+			*left = std::min(*left, x);
+			*right = std::max(*right, x);
+		}
+	}
+}
+
+static
+double overlap_width(const gds_polygon& a, const gds_polygon& b)
+{
+	// Widest overlap of two trapezoids, at heights spread over the band they share
+
+	double bottom = (double)std::max(a.bbox.ymin, b.bbox.ymin);
+	double top = (double)std::min(a.bbox.ymax, b.bbox.ymax);
+
+	if (top <= bottom || a.bbox.xmax <= b.bbox.xmin || b.bbox.xmax <= a.bbox.xmin)
+		return 0;
+
+	double widest = 0;
+
+	for (int k = 0; k < 8; k++)
+	{
+		double y = bottom + (k + 0.5) * (top - bottom) / 8;
+		double al, ar, bl, br;
+		trapezoid_span(a, y, &al, &ar);
+		trapezoid_span(b, y, &bl, &br);
+
+		widest = std::max(widest, std::min(ar, br) - std::max(al, bl));
+	}
+
+	return widest;
+}
+
+static
+int check_failed(int failures, const MergeCase& c, int run, const char* what, double got, double expected)
+{
+	if (failures < CHECK_MAX_PRINTED)
+		printf("--> merge check %s run %d: %s %.2f, expected %.2f\n", c.name, run, what, got, expected);
+
+	return failures + 1;
+}
+
+static
+int check_box(int failures, const MergeCase& c, int run, const char* what, const gds_bbox* got, const gds_bbox* expected)
+{
+	if (memcmp(got, expected, sizeof(gds_bbox)) == 0)
+		return failures;
+
+	if (failures < CHECK_MAX_PRINTED)
+	{
+		printf("--> merge check %s run %d: %s (%lld, %lld)-(%lld, %lld), expected (%lld, %lld)-(%lld, %lld)\n", c.name,
+			run, what, (long long)got->xmin, (long long)got->ymin, (long long)got->xmax, (long long)got->ymax,
+			(long long)expected->xmin, (long long)expected->ymin, (long long)expected->xmax, (long long)expected->ymax);
+	}
+
+	return failures + 1;
+}
+
+int check_merge()
+{
+	int failures = 0;
+
+	for (const MergeCase& c : merge_cases)
+	{
+		for (int run = 0; run < 20; run++)
+		{
+			gds_polyset pset, merged;
+
+			for (int i = 0; i < MERGE_CHECK_POLYGONS; i++)
+				add_shape(&pset, c.shapes, (uint16_t)(i % MERGE_CHECK_LAYERS));
+
+			gds_merge_options options;
+			options.strip_edges = c.strip_edges;
+			options.nthreads = c.nthreads;
+
+			if (gds_merge(&pset, &merged, &options) != ERR_SUCCESS)
+			{
+				failures = check_failed(failures, c, run, "error", 0, 0);
+				continue;
+			}
+
+			for (uint16_t layer = 0; layer < MERGE_CHECK_LAYERS; layer++)
+			{
+				std::vector<gds_polygon> out;
+				double area = 0;
+				int nvertices = 0;
+
+				gds_bbox in_box, out_box;
+				bbox_init(&in_box);
+				bbox_init(&out_box);
+
+				for (size_t i = 0; i < pset.size(); i++)
+				{
+					if (pset[i].layer == layer)
+						bbox_fit_points(&in_box, pset[i].pairs, pset[i].npairs);
+				}
+
+				for (size_t i = 0; i < merged.size(); i++)
+				{
+					gds_polygon p = merged[i];
+					if (p.layer != layer)
+						continue;
+
+					gds_bbox box;
+					bbox_init(&box);
+					bbox_fit_points(&box, p.pairs, p.npairs);
+
+					failures = check_box(failures, c, run, "trapezoid box", &p.bbox, &box);
+
+					bbox_fit_points(&out_box, p.pairs, p.npairs);
+
+					out.push_back(p);
+					area += polygon_area(p);
+					nvertices += p.npairs - 1;
+				}
+
+				// Layers on the grid keep their extent, slivers of slanted polygons may be rounded away
+				if (c.shapes <= 1)
+					failures = check_box(failures, c, run, "layer box", &out_box, &in_box);
+
+				// The trapezoids cover the union of the polygons once, up to the rounded corners
+				double expected = union_area(&pset, layer);
+
+				if (fabs(area - expected) > c.area_tolerance * nvertices + 1e-6)
+					failures = check_failed(failures, c, run, "area", area, expected);
+
+				for (size_t i = 0; i < out.size(); i++)
+				{
+					for (size_t j = i + 1; j < out.size(); j++)
+					{
+						double width = overlap_width(out[i], out[j]);
+
+						if (width > 1e-9)
+							failures = check_failed(failures, c, run, "overlap width", width, 0);
+					}
+				}
+			}
+		}
+	}
+
+	printf("Merge check: %d failures\n", failures);
+
+	return failures;
+}
@@ -0,0 +1,154 @@
+#define _USE_MATH_DEFINES
+
+#include "Checks.h"
+#include "../Gds/Simd.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+// Longest array checked, every length up to it is run to cover the odd pair at the end of a register
+#define SIMD_CHECK_MAX_PAIRS 37
+
+// Coordinates at the edges of the ranges of the kernels: the 32 bit GDSII range, and beyond the 2^51
+// where the vector kernels fall back to scalar code
+static const int64_t edge_values[] = {
+	0, 1, -1, INT32_MAX, INT32_MIN, (int64_t)INT32_MAX + 1, (int64_t)INT32_MIN - 1,
+	(int64_t)1 << 40, -((int64_t)1 << 40), ((int64_t)1 << 50) + 12345, -((int64_t)1 << 51) + 1,
+	(int64_t)1 << 52, -((int64_t)1 << 52)
+};
+
+static
+int64_t random_value(int kind)
+{
+	// kind 0: small, 1: negative, 2: edge values
+
+	switch (kind)
+	{
+		case 0:
+			return check_random_coord(1 << 20);
+		case 1:
+			return -1 - (int64_t)(check_random() % ((uint64_t)1 << 31));
+		default:
+			return edge_values[check_random() % (sizeof(edge_values) / sizeof(edge_values[0]))];
+	}
+}
+
+static
+int32_t random_value32(int kind)
+{
+	static const int32_t edge_values32[] = {0, 1, -1, INT32_MAX, INT32_MIN, INT32_MAX - 1, INT32_MIN + 1};
+
+	if (kind == 2)
+		return edge_values32[check_random() % (sizeof(edge_values32) / sizeof(edge_values32[0]))];
+
+	// Small and negative values are within 32 bits
+	return (int32_t)random_value(kind);
+}
+
+static
+gds_transform random_transform(int i)
+{
+	gds_pair translation = {check_random_coord(1 << 20), check_random_coord(1 << 20)};
+
+	if (i % 5 == 4)
+		translation = {random_value(2), random_value(2)};
+
+	bool mirror = check_random() % 2 != 0;
+	double quarter = (check_random() % 4) * M_PI_2;
+
+	switch (i % 4)
+	{
+		case 0:
+			return transform_make(translation, 1., quarter, mirror);
+		case 1:
+			return transform_make(translation, 2., quarter, mirror);
+		case 2:
+			return transform_make(translation, 0.75, (double)(check_random() % 360) * M_PI / 180, mirror);
+		default:
+			return transform_make(translation, 1., (double)(check_random() % 360) * M_PI / 180, mirror);
+	}
+}
+
+static
+int check_failed(int failures, const gds_simd_kernels* kernels, const char* kernel, int npairs)
+{
+	if (failures < CHECK_MAX_PRINTED)
+		printf("--> simd check %s %s differs from scalar for %d pairs\n", kernels->name, kernel, npairs);
+
+	return failures + 1;
+}
+
+int check_simd()
+{
+	const gds_simd_kernels* sets[8];
+	int nsets = simd_kernel_sets(sets, 8);
+
+	const gds_simd_kernels* scalar = simd_scalar_kernels();
+
+	std::vector<gds_pair> in(SIMD_CHECK_MAX_PAIRS), expected(SIMD_CHECK_MAX_PAIRS), got(SIMD_CHECK_MAX_PAIRS);
+	std::vector<int32_t> xy(2 * SIMD_CHECK_MAX_PAIRS);
+
+	int failures = 0;
+
+	for (int s = 0; s < nsets; s++)
+	{
+		const gds_simd_kernels* kernels = sets[s];
+
+		for (int i = 0; i < 3000; i++)
+		{
+			int npairs = i % (SIMD_CHECK_MAX_PAIRS + 1);
+			int kind = (i / (SIMD_CHECK_MAX_PAIRS + 1)) % 3;
+
+			for (int n = 0; n < npairs; n++)
+				in[n] = {random_value(kind), random_value(kind)};
+
+			// Transformation
+			gds_transform t = random_transform(i);
+
+			scalar->transform_pairs(expected.data(), in.data(), npairs, &t);
+			kernels->transform_pairs(got.data(), in.data(), npairs, &t);
+
+			if (memcmp(expected.data(), got.data(), npairs * sizeof(gds_pair)) != 0)
+				failures = check_failed(failures, kernels, "transform_pairs", npairs);
+
+			// Bounding box, from an empty box and from one already holding a pair
+			for (int grown = 0; grown < 2; grown++)
+			{
+				gds_bbox a, b;
+				bbox_init(&a);
+
+				if (grown)
+					bbox_fit_point(&a, {random_value(kind), random_value(kind)});
+
+				b = a;
+
+				scalar->fit_points(&a, in.data(), npairs);
+				kernels->fit_points(&b, in.data(), npairs);
+
+				if (memcmp(&a, &b, sizeof(a)) != 0)
+					failures = check_failed(failures, kernels, "fit_points", npairs);
+			}
+
+			// Bounding box of 32 bit coordinates
+			for (int n = 0; n < 2 * npairs; n++)
+				xy[n] = random_value32(kind);
+
+			gds_bbox32 a32 = {INT32_MAX, INT32_MAX, INT32_MIN, INT32_MIN};
+			gds_bbox32 b32 = a32;
+
+			scalar->fit_points32(&a32, xy.data(), npairs);
+			kernels->fit_points32(&b32, xy.data(), npairs);
+
+			if (memcmp(&a32, &b32, sizeof(a32)) != 0)
+				failures = check_failed(failures, kernels, "fit_points32", npairs);
+		}
+	}
+
+	printf("SIMD check (%d kernel sets, %s used): %d failures\n", nsets, simd_kernels()->name, failures);
+
+	return failures;
+}
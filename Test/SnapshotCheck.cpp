@@ -0,0 +1,120 @@
+#include "Checks.h"
+#include "../Gds/gds.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+// Rectangles of the GDS file, enough to make it larger than the blocks the snapshot hash samples
+#define SNAPSHOT_CHECK_POLYGONS 30000
+
+#define SNAPSHOT_CHECK_GDS "SnapshotCheck.gds"
+#define SNAPSHOT_CHECK_SNAP "SnapshotCheck.snap"
+
+static
+bool write_rectangles(int64_t shift)
+{
+	// The file has the same size for every @shift, only the coordinates change
+
+	gds_polyset pset;
+
+	for (int i = 0; i < SNAPSHOT_CHECK_POLYGONS; i++)
+	{
+		int64_t x = (i % 200) * 100 + shift, y = (i / 200) * 100;
+		gds_pair v[5] = {{x, y}, {x + 50, y}, {x + 50, y + 50}, {x, y + 50}, {x, y}};
+
+		gds_bbox box;
+		bbox_init(&box);
+		bbox_fit_points(&box, v, 5);
+
+		memcpy(gds_polyset_add(&pset, 5, 1, 0, &box), v, sizeof(v));
+	}
+
+	return gds_write(L"" SNAPSHOT_CHECK_GDS, &pset, 0.001, 1e-9) == EXIT_SUCCESS;
+}
+
+static
+int check_load(int failures, const char* what, int64_t shift, bool from_snapshot, bool hash_all)
+{
+	// Load the file with the snapshot, which is opened or written, and compare the first rectangle
+
+	gds_load_options options;
+	options.snapshot = L"" SNAPSHOT_CHECK_SNAP;
+	options.snapshot_hash_all = hash_all;
+
+	int result = ERR_SUCCESS;
+	gds_db* db = new gds_db(L"" SNAPSHOT_CHECK_GDS, &result, &options);
+
+	// Only a database opened from a snapshot keeps a mapping without being lazy
+	bool opened = db->map.data != NULL && !db->lazy;
+
+	gds_cell* top = find_cell(db, "TOP");
+	int64_t x = -1;
+
+	if (result == ERR_SUCCESS && top != NULL && !top->boundaries.empty())
+		x = top->boundaries[0]->pairs[0].x;
+
+	delete db;
+
+	if (result != ERR_SUCCESS || opened != from_snapshot || x != shift)
+	{
+		if (failures < CHECK_MAX_PRINTED)
+		{
+			printf("--> snapshot check %s: error %d, %s snapshot, x %lld, expected %s snapshot and x %lld\n", what,
+				result, opened ? "from" : "without", (long long)x, from_snapshot ? "from" : "without", (long long)shift);
+		}
+
+		return failures + 1;
+	}
+
+	return failures;
+}
+
+int check_snapshot()
+{
+	remove(SNAPSHOT_CHECK_SNAP);
+
+	if (!write_rectangles(0))
+	{
+		printf("--> snapshot check: could not write %s\n", SNAPSHOT_CHECK_GDS);
+		return 1;
+	}
+
+	int failures = 0;
+
+	// Written on the first load, opened on the second
+	failures = check_load(failures, "first load", 0, false, false);
+	failures = check_load(failures, "reopen", 0, true, false);
+
+	// A rewrite of the same size right away differs by the modification time
+	if (!write_rectangles(7))
+		failures++;
+
+	failures = check_load(failures, "same size rewrite", 7, false, false);
+	failures = check_load(failures, "reopen rewrite", 7, true, false);
+
+	// The whole file hashed gives another key than the sampled blocks
+	failures = check_load(failures, "hash all", 7, false, true);
+	failures = check_load(failures, "reopen hash all", 7, true, true);
+
+	// A damaged snapshot is not opened
+	FILE* snap = fopen(SNAPSHOT_CHECK_SNAP, "r+b");
+	if (snap != NULL)
+	{
+		fseek(snap, 0, SEEK_SET);
+		fputc('X', snap);
+		fclose(snap);
+	}
+
+	failures = check_load(failures, "damaged", 7, false, true);
+
+	remove(SNAPSHOT_CHECK_GDS);
+	remove(SNAPSHOT_CHECK_SNAP);
+
+	printf("Snapshot check: %d failures\n", failures);
+
+	return failures;
+}
@@ -0,0 +1,121 @@
+#define _USE_MATH_DEFINES
+
+#include "Checks.h"
+#include "../Gds/Transform.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+static
+gds_transform random_transform(int kind)
+{
+	// kind 0: Manhattan at magnification 1, 1: Manhattan magnified, 2: any angle and magnification
+
+	gds_pair translation = {check_random_coord(1 << 24), check_random_coord(1 << 24)};
+	bool mirror = check_random() % 2 != 0;
+
+	if (kind == 0)
+		return transform_make(translation, 1., (check_random() % 4) * M_PI_2, mirror);
+
+	static const double mags[] = {0.5, 2., 3., 0.25};
+	double mag = mags[check_random() % 4];
+
+	if (kind == 1)
+		return transform_make(translation, mag, (check_random() % 4) * M_PI_2, mirror);
+
+	// Angles in whole degrees like a GDSII file, also multiples of 90 degrees
+	double degrees = (double)(check_random() % 360);
+
+	return transform_make(translation, mag * (1 + (check_random() % 8) / 8.), degrees * M_PI / 180, mirror);
+}
+
+static
+void reference_pair(const gds_transform* t, double x, double y, double* ox, double* oy)
+{
+	// Mirror, magnify, rotate and translate without rounding
+
+	if (t->mirror)
+		y = -y;
+
+	double c = cos(t->angle), s = sin(t->angle);
+
+	*ox = t->translation.x + t->magnification * (c * x - s * y);
+	*oy = t->translation.y + t->magnification * (s * x + c * y);
+}
+
+static
+int check_failed(int failures, const char* what, gds_pair p, gds_pair got, double ex, double ey)
+{
+	if (failures < CHECK_MAX_PRINTED)
+	{
+		printf("--> transform check %s: (%lld, %lld) gave (%lld, %lld), expected (%.1f, %.1f)\n", what,
+			(long long)p.x, (long long)p.y, (long long)got.x, (long long)got.y, ex, ey);
+	}
+
+	return failures + 1;
+}
+
+int check_transforms()
+{
+	int failures = 0;
+
+	for (int i = 0; i < 20000; i++)
+	{
+		int outer_kind = i % 3;
+		int inner_kind = (i / 3) % 3;
+
+		gds_transform outer = random_transform(outer_kind);
+		gds_transform inner = random_transform(inner_kind);
+		gds_transform composed = transform_compose(&outer, &inner);
+
+		gds_pair p = {check_random_coord(1 << 20), check_random_coord(1 << 20)};
+
+		// Composition of two references inside each other
+		double ix, iy, ex, ey;
+		reference_pair(&inner, (double)p.x, (double)p.y, &ix, &iy);
+		reference_pair(&outer, ix, iy, &ex, &ey);
+
+		gds_pair got = transform_pair(p, &composed, false);
+
+		gds_pair batch;
+		transform_pairs(&batch, &p, 1, &composed, false);
+
+		if (batch.x != got.x || batch.y != got.y)
+			failures = check_failed(failures, "transform_pairs", p, batch, (double)got.x, (double)got.y);
+
+		// Only Manhattan transformations at magnification 1 compose into an exact one
+		bool exact = outer_kind == 0 && inner_kind == 0;
+
+		if (exact && !composed.exact)
+			failures = check_failed(failures, "exact flag", p, got, ex, ey);
+
+		// Those give the integer coordinates. Otherwise the translation of @inner placed by @outer and
+		// the transformed pair are truncated, so each coordinate is within two units.
+		if (exact)
+		{
+			if (got.x != llround(ex) || got.y != llround(ey))
+				failures = check_failed(failures, "exact compose", p, got, ex, ey);
+		} else
+		{
+			double tolerance = 2 + 1e-9 * (fabs(ex) + fabs(ey));
+
+			if (fabs(got.x - ex) > tolerance || fabs(got.y - ey) > tolerance)
+				failures = check_failed(failures, "compose", p, got, ex, ey);
+		}
+
+		// The flattened cell cache transforms the polygons of a cell, placed inside it with @inner,
+		// once more with an exact @outer. That has to give the coordinates of a walk composing both.
+		if (outer.exact)
+		{
+			gds_pair twice = transform_pair(transform_pair(p, &inner, false), &outer, false);
+
+			if (twice.x != got.x || twice.y != got.y)
+				failures = check_failed(failures, "exact outer", p, twice, (double)got.x, (double)got.y);
+		}
+	}
+
+	printf("Transform check: %d failures\n", failures);
+
+	return failures;
+}
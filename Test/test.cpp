@@ -1,10 +1,26 @@
 #include "../Gds/gds.h"
+#include "Checks.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 
 int main()
 {
+	//
+	// Check the kernels of the library against reference code
+	//
+
+	int failures = check_transforms();
+	failures += check_simd();
+	failures += check_index();
+	failures += check_arefs();
+	failures += check_merge();
+	failures += check_snapshot();
+	failures += check_extract();
+
+	if (failures != 0)
+		printf("\n%d checks failed\n", failures);
+
 	//
 	// Construct a GDSII database object
 	//
@@ -23,6 +39,9 @@ int main()
 		return 1;
 	}
 
+	// List the cells in the database with their width and height
+	gds_print_cell_sizes(db);
+
 	//
 	// Extract polygons from a region in a cell in the GDSII data base
 	//